@@ -0,0 +1,86 @@
+/********************************************************
+    * @file    : FrameLoader.cpp
+    * @brief   : the frame files of a scan directory, in capture order
+*********************************************************/
+#include "FrameLoader.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#if defined(WIN32) || defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace FrameIO
+{
+	// file names in dir, without the directory
+	static std::vector<std::string> listFiles(const std::string& dir)
+	{
+		std::vector<std::string> names;
+#if defined(WIN32) || defined(_WIN32)
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((dir + "/*").c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE)
+			return names;
+		do
+		{
+			if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				names.push_back(data.cFileName);
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+#else
+		DIR* directory = opendir(dir.c_str());
+		if (directory == NULL)
+			return names;
+		while (struct dirent* entry = readdir(directory))
+		{
+			struct stat info;
+			std::string path = dir + "/" + entry->d_name;
+			if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+				names.push_back(entry->d_name);
+		}
+		closedir(directory);
+#endif
+		return names;
+	}
+
+	static bool captureOrder(const FrameFile& a, const FrameFile& b)
+	{
+		// files without a scan and frame number go last
+		if ((a.scan < 0) != (b.scan < 0))
+			return b.scan < 0;
+		if (a.scan != b.scan)
+			return a.scan < b.scan;
+		if (a.frame != b.frame)
+			return a.frame < b.frame;
+		return a.path < b.path;
+	}
+
+	std::vector<FrameFile> ListFrames(const std::string& dir, const char* extension)
+	{
+		std::string suffix = std::string(".") + extension;
+		std::vector<std::string> names = listFiles(dir);
+		std::vector<FrameFile> frames;
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			const std::string& name = names[i];
+			if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+				continue;
+			FrameFile frame;
+			frame.path = dir + "/" + name;
+			int used = 0;
+			if (sscanf(name.c_str(), "frame-S%dF%d%n", &frame.scan, &frame.frame, &used) != 2 ||
+				name.compare(used, std::string::npos, suffix) != 0)
+				frame.scan = frame.frame = -1;
+			frames.push_back(frame);
+		}
+		std::sort(frames.begin(), frames.end(), captureOrder);
+		return frames;
+	}
+}
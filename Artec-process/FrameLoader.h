@@ -0,0 +1,196 @@
+/*!
+ * \brief Loading the frames of a scan directory on several threads
+ *
+ * ListFrames finds the frame-S%02dF%02d.obj (or .ply) files of a scan
+ * directory and puts them in capture order: by scan, then by frame.
+ *
+ * FrameLoader reads them on a few reader threads and hands them to the
+ * caller in that order, on the calling thread, each as soon as it and
+ * every frame before it are loaded. At most window frames are loaded
+ * ahead of the one being handed over, so memory stays bounded however
+ * long the scan is, as long as the caller passes frames on rather than
+ * keeping them all.
+ *
+ * Readers decide how many files are read at once: a spinning disk wants
+ * 1, an SSD a few; the default is min(cores, FRAME_LOADER_READERS). The
+ * cores left over are for parsing: parseThreads() is what each reader
+ * should give a parser that takes a thread count, e.g. FrameIO::LoadObj.
+ */
+
+#ifndef __FRAME_LOADER_H__
+#define __FRAME_LOADER_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Parallel.h"
+
+// files read at once by default
+#define FRAME_LOADER_READERS 4
+
+namespace FrameIO
+{
+	struct FrameFile
+	{
+		std::string path;
+		int scan;	// -1 if the name does not say
+		int frame;
+	};
+
+	// frame files with extension ("obj", "ply") in capture order; other
+	// files with the extension follow by name
+	std::vector<FrameFile> ListFrames(const std::string& dir, const char* extension = "obj");
+
+	struct LoaderOptions
+	{
+		LoaderOptions() : readers(0), window(0) {}
+
+		unsigned readers;	// 0 for min(cores, FRAME_LOADER_READERS)
+		unsigned window;	// frames loaded ahead, 0 for twice the readers
+	};
+
+	template<typename Frame>
+	class FrameLoader
+	{
+	public:
+		typedef std::function<bool(const FrameFile&, Frame&, std::string&)> LoadFunction;
+		typedef std::function<void(size_t, const FrameFile&, Frame&)> ConsumeFunction;
+
+		FrameLoader(const std::vector<FrameFile>& files, const LoaderOptions& options = LoaderOptions())
+			: files_(files)
+		{
+			readers_ = options.readers ? options.readers : std::min<unsigned>(ThreadCount(0), FRAME_LOADER_READERS);
+			window_ = options.window ? options.window : readers_ * 2;
+		}
+
+		unsigned readers() const { return readers_; }
+
+		// threads each reader has for parsing
+		unsigned parseThreads() const { return std::max<unsigned>(1, ThreadCount(0) / readers_); }
+
+		/********************************************************
+		*  @function :  run
+		*  @brief    :  load every file with load, on the readers; call
+		*               consume with each loaded frame in capture order
+		*  @input    :  load(file, &frame, &error), consume(index, file,
+		*               &frame) which may take the frame over
+		*  @return   :  number of frames consumed; the others are in
+		*               errors()
+		*********************************************************/
+		size_t run(LoadFunction load, ConsumeFunction consume)
+		{
+			size_t count = files_.size();
+			slots_.assign(std::min<size_t>(window_, std::max<size_t>(count, 1)), Slot());
+			errors_.clear();
+			next_ = 0;
+			consumed_ = 0;
+
+			std::vector<std::thread> readers;
+			for (unsigned r = 0; r < readers_ && r < count; r++)
+				readers.push_back(std::thread([this, load]() { read(load); }));
+
+			size_t delivered = 0;
+			for (size_t i = 0; i < count; i++)
+			{
+				Slot& slot = slots_[i % slots_.size()];
+				Frame frame;
+				bool loaded;
+				std::string error;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					changed_.wait(lock, [&slot]() { return slot.ready; });
+					std::swap(frame, slot.frame);
+					slot.frame = Frame();
+					loaded = slot.loaded;
+					error.swap(slot.error);
+					slot.ready = false;
+					consumed_ = i + 1;
+				}
+				changed_.notify_all();
+				if (loaded)
+				{
+					consume(i, files_[i], frame);
+					delivered++;
+				}
+				else
+					errors_.push_back(files_[i].path + ": " + error);
+			}
+			for (size_t r = 0; r < readers.size(); r++)
+				readers[r].join();
+			return delivered;
+		}
+
+		const std::vector<std::string>& errors() const { return errors_; }
+
+	private:
+		struct Slot
+		{
+			Slot() : ready(false), loaded(false) {}
+
+			bool ready;
+			bool loaded;
+			Frame frame;
+			std::string error;
+		};
+
+		// reader thread: take the next file once the window has room
+		void read(const LoadFunction& load)
+		{
+			for (;;)
+			{
+				size_t i;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					if (next_ >= files_.size())
+						return;
+					i = next_++;
+					changed_.wait(lock, [this, i]() { return i < consumed_ + slots_.size(); });
+				}
+				Frame frame;
+				std::string error;
+				bool loaded = load(files_[i], frame, error);
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					Slot& slot = slots_[i % slots_.size()];
+					std::swap(slot.frame, frame);
+					slot.loaded = loaded;
+					slot.error.swap(error);
+					slot.ready = true;
+				}
+				changed_.notify_all();
+			}
+		}
+
+		std::vector<FrameFile> files_;
+		unsigned readers_;
+		unsigned window_;
+		std::vector<Slot> slots_;
+		std::vector<std::string> errors_;
+		size_t next_;		// next file a reader takes
+		size_t consumed_;	// files handed over so far
+		std::mutex mutex_;
+		std::condition_variable changed_;
+	};
+
+	// all frames of files, in capture order, into frames
+	template<typename Frame>
+	size_t LoadFrames(const std::vector<FrameFile>& files, typename FrameLoader<Frame>::LoadFunction load,
+		std::vector<Frame>& frames, std::vector<std::string>& errors, const LoaderOptions& options = LoaderOptions())
+	{
+		FrameLoader<Frame> loader(files, options);
+		frames.clear();
+		frames.reserve(files.size());
+		size_t loaded = loader.run(load, [&frames](size_t, const FrameFile&, Frame& frame)
+		{
+			frames.push_back(Frame());
+			std::swap(frames.back(), frame);
+		});
+		errors = loader.errors();
+		return loaded;
+	}
+}
+
+#endif // __FRAME_LOADER_H__
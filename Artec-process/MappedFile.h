@@ -0,0 +1,107 @@
+/*!
+ * \brief A whole file mapped read-only into memory
+ *
+ * The mapping is not NUL terminated: parse against end(), never look
+ * for a terminator. An empty file opens with a null data().
+ */
+
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <stddef.h>
+#include <string>
+
+#if defined(WIN32) || defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FrameIO
+{
+	class MappedFile
+	{
+	public:
+		MappedFile() : data_(NULL), size_(0) {}
+		~MappedFile() { close(); }
+
+		bool open(const std::string& path)
+		{
+			close();
+#if defined(WIN32) || defined(_WIN32)
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+				FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER size;
+			bool ok = GetFileSizeEx(file, &size) != 0;
+			if (ok && size.QuadPart > 0)
+			{
+				HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (mapping != NULL)
+				{
+					data_ = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+					CloseHandle(mapping);	// the view keeps the mapping
+				}
+				ok = data_ != NULL;
+				if (ok)
+					size_ = (size_t)size.QuadPart;
+			}
+			CloseHandle(file);
+			return ok;
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat info;
+			bool ok = fstat(fd, &info) == 0;
+			if (ok && info.st_size > 0)
+			{
+				void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				ok = data != MAP_FAILED;
+				if (ok)
+				{
+					madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+					data_ = (const char*)data;
+					size_ = (size_t)info.st_size;
+				}
+			}
+			::close(fd);
+			return ok;
+#endif
+		}
+
+		void close()
+		{
+			if (data_ != NULL)
+			{
+#if defined(WIN32) || defined(_WIN32)
+				UnmapViewOfFile(data_);
+#else
+				munmap((void*)data_, size_);
+#endif
+			}
+			data_ = NULL;
+			size_ = 0;
+		}
+
+		const char* data() const { return data_; }
+		const char* end() const { return data_ + size_; }
+		size_t size() const { return size_; }
+
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		const char* data_;
+		size_t size_;
+	};
+}
+
+#endif // __MAPPED_FILE_H__
@@ -0,0 +1,49 @@
+/*!
+ * \brief A frame or mesh in plain arrays, independent of the Artec SDK
+ *
+ * Every per-vertex attribute has an array of its own, so a stage that
+ * only needs positions never touches the rest. Attribute arrays are
+ * either empty or as long as the positions. Faces are triangles, three
+ * zero-based vertex indices each.
+ */
+
+#ifndef __MESH_DATA_H__
+#define __MESH_DATA_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace FrameIO
+{
+	struct MeshData
+	{
+		std::vector<float> x, y, z;
+		std::vector<float> nx, ny, nz;
+		std::vector<float> u, v;
+		std::vector<uint8_t> r, g, b;
+		std::vector<uint32_t> indices;
+
+		// texture image of the mesh, as a path usable from the working
+		// directory; empty if not textured
+		std::string texture;
+
+		size_t vertexCount() const { return x.size(); }
+		size_t triangleCount() const { return indices.size() / 3; }
+		bool hasNormals() const { return !nx.empty(); }
+		bool hasUVs() const { return !u.empty(); }
+		bool hasColors() const { return !r.empty(); }
+
+		void clear()
+		{
+			x.clear(); y.clear(); z.clear();
+			nx.clear(); ny.clear(); nz.clear();
+			u.clear(); v.clear();
+			r.clear(); g.clear(); b.clear();
+			indices.clear();
+			texture.clear();
+		}
+	};
+}
+
+#endif // __MESH_DATA_H__
@@ -0,0 +1,754 @@
+/********************************************************
+    * @file    : ObjFile.cpp
+    * @brief   : OBJ frames without the Artec SDK
+*********************************************************/
+#include "ObjFile.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include "MappedFile.h"
+#include "Parallel.h"
+
+namespace FrameIO
+{
+	// below this a file is parsed on one thread
+	static const size_t OBJ_CHUNK_BYTES = 1 << 20;
+	// elements formatted per job when saving
+	static const size_t OBJ_WRITE_BATCH = 1 << 16;
+
+	// 10^0 .. 10^22, all exact in a double
+	static const double POW10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	static inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+	static inline const char* skipBlanks(const char* p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	/********************************************************
+	*  @function :  ParseFloat
+	*  @brief    :  a decimal float at p, after blanks; up to 19 digits
+	*               and exponents within 10^22 are converted exactly in
+	*               double precision, anything longer goes to strtod
+	*  @input    :  p, end of the text, &value
+	*  @return   :  the character after the number, NULL if none
+	*********************************************************/
+	const char* ParseFloat(const char* p, const char* end, float& value)
+	{
+		p = skipBlanks(p, end);
+		const char* start = p;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		uint64_t mantissa = 0;
+		int digits = 0, exponent = 0;
+		bool any = false;
+		for (; p < end && isDigit(*p); p++, any = true)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+			}
+			else
+				exponent++;
+		}
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && isDigit(*p); p++, any = true)
+			{
+				if (digits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					digits += mantissa != 0;
+					exponent--;
+				}
+			}
+		}
+		if (!any)
+			return NULL;
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* q = p + 1;
+			bool negativeExponent = false;
+			if (q < end && (*q == '-' || *q == '+'))
+				negativeExponent = *q++ == '-';
+			if (q < end && isDigit(*q))
+			{
+				int e = 0;
+				for (; q < end && isDigit(*q); q++)
+					e = e < 10000 ? e * 10 + (*q - '0') : e;
+				exponent += negativeExponent ? -e : e;
+				p = q;
+			}
+		}
+
+		double result;
+		if (mantissa == 0)
+			result = 0;
+		else if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+			result = exponent < 0 ? mantissa / POW10[-exponent] : mantissa * POW10[exponent];
+		else
+		{
+			char text[64];
+			size_t length = (size_t)(p - start);
+			if (length >= sizeof(text))
+				return NULL;
+			memcpy(text, start, length);
+			text[length] = '\0';
+			value = (float)strtod(text, NULL);
+			return p;
+		}
+		value = (float)(negative ? -result : result);
+		return p;
+	}
+
+	/********************************************************
+	*  @function :  FormatFloat
+	*  @brief    :  the fewest significant digits, 6 to 9, that
+	*               ParseFloat reads back as the same float; the digits
+	*               are checked with the very division ParseFloat does.
+	*               Plain notation from 1e-5 to 1e9, printf beyond
+	*  @input    :  value, out gets the text and a terminator
+	*  @return   :  length of the text
+	*********************************************************/
+	int FormatFloat(float value, char* out)
+	{
+		double magnitude = fabs((double)value);
+		if (magnitude == 0 || !(magnitude >= 1e-5 && magnitude < 1e9))
+			return snprintf(out, 16, value == 0 ? "0" : "%.9g", value);
+
+		// magnitude is in [10^e10, 10^(e10 + 1))
+		int e10 = (int)floor(log10(magnitude));
+		if (e10 >= 0 ? magnitude < POW10[e10] : magnitude * POW10[-e10] < 1)
+			e10--;
+		else if (e10 + 1 >= 0 ? magnitude >= POW10[e10 + 1] : magnitude * POW10[-e10 - 1] >= 1)
+			e10++;
+
+		for (int precision = 6; precision <= 9; precision++)
+		{
+			// digits, with shift of them after the decimal point
+			int shift = precision - 1 - e10;
+			double scaled = shift >= 0 ? magnitude * POW10[shift] : magnitude / POW10[-shift];
+			uint64_t digits = (uint64_t)(scaled + 0.5);
+			double back = shift >= 0 ? digits / POW10[shift] : digits * POW10[-shift];
+			if ((float)back != (float)magnitude)
+				continue;
+
+			while (shift > 0 && digits % 10 == 0)
+			{
+				digits /= 10;
+				shift--;
+			}
+			char text[24];
+			int length = 0;
+			do
+			{
+				text[length++] = (char)('0' + digits % 10);
+				digits /= 10;
+			} while (digits != 0);
+			char* p = out;
+			if (value < 0)
+				*p++ = '-';
+			if (shift <= 0)
+			{
+				while (length > 0)
+					*p++ = text[--length];
+				for (; shift < 0; shift++)
+					*p++ = '0';
+			}
+			else
+			{
+				if (length <= shift)
+				{
+					*p++ = '0';
+					*p++ = '.';
+					for (int zeros = shift - length; zeros > 0; zeros--)
+						*p++ = '0';
+				}
+				while (length > 0)
+				{
+					if (length == shift && p != out && p[-1] != '.')
+						*p++ = '.';
+					*p++ = text[--length];
+				}
+			}
+			*p = '\0';
+			return (int)(p - out);
+		}
+		return snprintf(out, 16, "%.9g", value);
+	}
+
+	static inline char* formatUnsigned(uint32_t value, char* out)
+	{
+		char digits[10];
+		int n = 0;
+		do
+		{
+			digits[n++] = (char)('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+		while (n > 0)
+			*out++ = digits[--n];
+		return out;
+	}
+
+	std::string FrameFileName(int scan, int frame, const char* extension)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "frame-S%02dF%02d.%s", scan, frame, extension);
+		return name;
+	}
+
+	static std::string directoryOf(const std::string& path)
+	{
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+
+	static std::string trim(const std::string& text)
+	{
+		size_t first = text.find_first_not_of(" \t\r");
+		if (first == std::string::npos)
+			return std::string();
+		size_t last = text.find_last_not_of(" \t\r");
+		return text.substr(first, last - first + 1);
+	}
+
+	// one face corner as written; negative indices count back from the
+	// elements before the line, resolved when the chunks are joined
+	struct Corner
+	{
+		int32_t v, t, n;
+		uint8_t relative;	// bit 0 v, bit 1 t, bit 2 n
+	};
+
+	struct ObjChunk
+	{
+		const char* begin;
+		const char* end;
+		std::vector<float> x, y, z;
+		std::vector<float> nx, ny, nz;
+		std::vector<float> u, v;
+		std::vector<Corner> corners;	// three per triangle
+		std::string material;
+		size_t lines;
+		size_t errorLine;	// in the chunk, 0 if none
+		std::string error;
+
+		ObjChunk() : begin(NULL), end(NULL), lines(0), errorLine(0) {}
+	};
+
+	// an index at p, 0 if absent; negative ones become relative to count
+	static const char* parseIndex(const char* p, const char* end, size_t count, int32_t& index, bool& relative)
+	{
+		bool negative = p < end && *p == '-';
+		if (negative)
+			p++;
+		if (p >= end || !isDigit(*p))
+			return NULL;
+		int64_t value = 0;
+		for (; p < end && isDigit(*p); p++)
+			value = value < INT32_MAX ? value * 10 + (*p - '0') : value;
+		if (value == 0 || value > INT32_MAX)
+			return NULL;
+		relative = negative;
+		index = negative ? (int32_t)((int64_t)count - value + 1) : (int32_t)value;
+		return p;
+	}
+
+	// v[/[t][/n]]
+	static const char* parseCorner(const char* p, const char* end, const ObjChunk& chunk, Corner& corner)
+	{
+		bool relative = false;
+		corner.v = corner.t = corner.n = 0;
+		corner.relative = 0;
+		p = parseIndex(p, end, chunk.x.size(), corner.v, relative);
+		if (p == NULL)
+			return NULL;
+		corner.relative |= relative ? 1 : 0;
+		if (p < end && *p == '/')
+		{
+			p++;
+			if (p < end && *p != '/')
+			{
+				p = parseIndex(p, end, chunk.u.size(), corner.t, relative);
+				if (p == NULL)
+					return NULL;
+				corner.relative |= relative ? 2 : 0;
+			}
+			if (p < end && *p == '/')
+			{
+				p = parseIndex(p + 1, end, chunk.nx.size(), corner.n, relative);
+				if (p == NULL)
+					return NULL;
+				corner.relative |= relative ? 4 : 0;
+			}
+		}
+		return p;
+	}
+
+	static const char* parseFloats(const char* p, const char* end, float* values, int count)
+	{
+		for (int i = 0; i < count && p; i++)
+			p = ParseFloat(p, end, values[i]);
+		return p;
+	}
+
+	static void parseChunk(ObjChunk& chunk)
+	{
+		std::vector<Corner> polygon;
+		const char* p = chunk.begin;
+		while (p < chunk.end)
+		{
+			const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+			if (lineEnd == NULL)
+				lineEnd = chunk.end;
+			chunk.lines++;
+			const char* q = skipBlanks(p, lineEnd);
+			const char* error = NULL;
+			if (lineEnd - q >= 2 && q[0] == 'v' && (q[1] == ' ' || q[1] == '\t'))
+			{
+				float xyz[3];
+				if (parseFloats(q + 1, lineEnd, xyz, 3) == NULL)
+					error = "vertex expected";
+				else
+				{
+					chunk.x.push_back(xyz[0]);
+					chunk.y.push_back(xyz[1]);
+					chunk.z.push_back(xyz[2]);
+				}
+			}
+			else if (lineEnd - q >= 3 && q[0] == 'v' && q[1] == 'n' && (q[2] == ' ' || q[2] == '\t'))
+			{
+				float xyz[3];
+				if (parseFloats(q + 2, lineEnd, xyz, 3) == NULL)
+					error = "normal expected";
+				else
+				{
+					chunk.nx.push_back(xyz[0]);
+					chunk.ny.push_back(xyz[1]);
+					chunk.nz.push_back(xyz[2]);
+				}
+			}
+			else if (lineEnd - q >= 3 && q[0] == 'v' && q[1] == 't' && (q[2] == ' ' || q[2] == '\t'))
+			{
+				float uv[2];
+				if (parseFloats(q + 2, lineEnd, uv, 2) == NULL)
+					error = "texture coordinate expected";
+				else
+				{
+					chunk.u.push_back(uv[0]);
+					chunk.v.push_back(uv[1]);
+				}
+			}
+			else if (lineEnd - q >= 2 && q[0] == 'f' && (q[1] == ' ' || q[1] == '\t'))
+			{
+				polygon.clear();
+				const char* r = skipBlanks(q + 1, lineEnd);
+				while (r && r < lineEnd && *r != '\r')
+				{
+					Corner corner;
+					r = parseCorner(r, lineEnd, chunk, corner);
+					if (r)
+					{
+						polygon.push_back(corner);
+						r = skipBlanks(r, lineEnd);
+					}
+				}
+				if (r == NULL || polygon.size() < 3)
+					error = "face expected";
+				else
+				{
+					// fan: 0 1 2, 0 2 3, ...
+					for (size_t i = 1; i + 1 < polygon.size(); i++)
+					{
+						chunk.corners.push_back(polygon[0]);
+						chunk.corners.push_back(polygon[i]);
+						chunk.corners.push_back(polygon[i + 1]);
+					}
+				}
+			}
+			else if (lineEnd - q > 7 && strncmp(q, "mtllib", 6) == 0 && (q[6] == ' ' || q[6] == '\t'))
+			{
+				if (chunk.material.empty())
+					chunk.material = trim(std::string(q + 7, lineEnd));
+			}
+			if (error)
+			{
+				chunk.error = error;
+				chunk.errorLine = chunk.lines;
+				return;
+			}
+			p = lineEnd + 1;
+		}
+	}
+
+	// the image the material library of an OBJ names, if any
+	static std::string textureOf(const std::string& objPath, const std::string& material)
+	{
+		if (material.empty())
+			return std::string();
+		std::string mtlPath = directoryOf(objPath) + material;
+		std::ifstream in(mtlPath.c_str());
+		std::string text;
+		while (std::getline(in, text))
+		{
+			text = trim(text);
+			if (text.compare(0, 6, "map_Kd") == 0 && text.size() > 7)
+				return directoryOf(mtlPath) + trim(text.substr(7));
+		}
+		return std::string();
+	}
+
+	struct CornerKey
+	{
+		uint32_t v, t, n;
+		bool operator==(const CornerKey& other) const { return v == other.v && t == other.t && n == other.n; }
+	};
+
+	struct CornerKeyHash
+	{
+		size_t operator()(const CornerKey& key) const
+		{
+			uint64_t h = key.v * 0x9E3779B97F4A7C15ULL;
+			h ^= (key.t + 0x632BE59BD9B4E019ULL) * 0xC2B2AE3D27D4EB4FULL;
+			h ^= (key.n + 0x165667B19E3779F9ULL) * 0x85EBCA77C2B2AE63ULL;
+			return (size_t)(h ^ (h >> 29));
+		}
+	};
+
+	/********************************************************
+	*  @function :  LoadObj
+	*  @brief    :  read an OBJ, and the texture its .mtl names
+	*  @input    :  path, &mesh, &error, threads 0 for one per core
+	*  @return   :  false with error set if the file cannot be read or
+	*               has a line that does not parse
+	*********************************************************/
+	bool LoadObj(const std::string& path, MeshData& mesh, std::string& error, unsigned threads)
+	{
+		mesh.clear();
+		MappedFile file;
+		if (!file.open(path))
+		{
+			error = "cannot open " + path;
+			return false;
+		}
+
+		// line-aligned chunks, one or a few per thread
+		threads = ThreadCount(threads);
+		size_t count = std::max<size_t>(1, std::min<size_t>(threads * 2, file.size() / OBJ_CHUNK_BYTES));
+		std::vector<ObjChunk> chunks(count);
+		const char* p = file.data();
+		for (size_t i = 0; i < count; i++)
+		{
+			chunks[i].begin = p;
+			const char* end = i + 1 == count ? file.end() : file.data() + file.size() / count * (i + 1);
+			if (end < p)
+				end = p;
+			const char* newline = end < file.end() ? (const char*)memchr(end, '\n', file.end() - end) : NULL;
+			end = newline ? newline + 1 : file.end();
+			chunks[i].end = end;
+			p = end;
+		}
+		ParallelFor(count, threads, [&chunks](size_t i) { parseChunk(chunks[i]); });
+
+		// where each chunk's elements start in the whole file
+		size_t vertices = 0, normals = 0, uvs = 0, corners = 0, lines = 0;
+		std::vector<size_t> vertexBase(count), normalBase(count), uvBase(count);
+		std::string material;
+		for (size_t i = 0; i < count; i++)
+		{
+			const ObjChunk& chunk = chunks[i];
+			if (!chunk.error.empty())
+			{
+				std::ostringstream message;
+				message << path << " line " << lines + chunk.errorLine << ": " << chunk.error;
+				error = message.str();
+				return false;
+			}
+			vertexBase[i] = vertices;
+			normalBase[i] = normals;
+			uvBase[i] = uvs;
+			vertices += chunk.x.size();
+			normals += chunk.nx.size();
+			uvs += chunk.u.size();
+			corners += chunk.corners.size();
+			lines += chunk.lines;
+			if (material.empty())
+				material = chunk.material;
+		}
+
+		// zero-based indices into the whole file; 0 stays "none" as -1
+		std::vector<CornerKey> resolved(corners);
+		bool direct = true, anyUV = false, anyNormal = false;
+		size_t k = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			const ObjChunk& chunk = chunks[i];
+			for (size_t c = 0; c < chunk.corners.size(); c++, k++)
+			{
+				const Corner& corner = chunk.corners[c];
+				int64_t v = corner.v + (int64_t)((corner.relative & 1) ? vertexBase[i] : 0) - 1;
+				int64_t t = corner.t == 0 ? -1 : corner.t + (int64_t)((corner.relative & 2) ? uvBase[i] : 0) - 1;
+				int64_t n = corner.n == 0 ? -1 : corner.n + (int64_t)((corner.relative & 4) ? normalBase[i] : 0) - 1;
+				if (v < 0 || v >= (int64_t)vertices || t < -1 || t >= (int64_t)uvs || n < -1 || n >= (int64_t)normals)
+				{
+					error = path + ": face index out of range";
+					return false;
+				}
+				anyUV = anyUV || t >= 0;
+				anyNormal = anyNormal || n >= 0;
+				direct = direct && (t < 0 || t == v) && (n < 0 || n == v);
+				resolved[k].v = (uint32_t)v;
+				resolved[k].t = (uint32_t)t;
+				resolved[k].n = (uint32_t)n;
+			}
+		}
+		// every corner names attribute i for vertex i: keep the arrays
+		direct = direct && (!anyUV || uvs == vertices) && (!anyNormal || normals == vertices);
+
+		std::vector<float> nx, ny, nz, u, v;
+		mesh.x.reserve(vertices);
+		mesh.y.reserve(vertices);
+		mesh.z.reserve(vertices);
+		nx.reserve(normals);
+		ny.reserve(normals);
+		nz.reserve(normals);
+		u.reserve(uvs);
+		v.reserve(uvs);
+		for (size_t i = 0; i < count; i++)
+		{
+			ObjChunk& chunk = chunks[i];
+			mesh.x.insert(mesh.x.end(), chunk.x.begin(), chunk.x.end());
+			mesh.y.insert(mesh.y.end(), chunk.y.begin(), chunk.y.end());
+			mesh.z.insert(mesh.z.end(), chunk.z.begin(), chunk.z.end());
+			nx.insert(nx.end(), chunk.nx.begin(), chunk.nx.end());
+			ny.insert(ny.end(), chunk.ny.begin(), chunk.ny.end());
+			nz.insert(nz.end(), chunk.nz.begin(), chunk.nz.end());
+			u.insert(u.end(), chunk.u.begin(), chunk.u.end());
+			v.insert(v.end(), chunk.v.begin(), chunk.v.end());
+		}
+		chunks.clear();
+
+		if (direct)
+		{
+			mesh.indices.resize(corners);
+			for (size_t c = 0; c < corners; c++)
+				mesh.indices[c] = resolved[c].v;
+			if (normals == vertices)
+			{
+				mesh.nx.swap(nx);
+				mesh.ny.swap(ny);
+				mesh.nz.swap(nz);
+			}
+			if (uvs == vertices)
+			{
+				mesh.u.swap(u);
+				mesh.v.swap(v);
+			}
+		}
+		else
+		{
+			// one vertex per distinct position/texture/normal triple
+			std::vector<float> x, y, z;
+			x.swap(mesh.x);
+			y.swap(mesh.y);
+			z.swap(mesh.z);
+			std::unordered_map<CornerKey, uint32_t, CornerKeyHash> split;
+			split.reserve(corners);
+			mesh.indices.resize(corners);
+			for (size_t c = 0; c < corners; c++)
+			{
+				const CornerKey& key = resolved[c];
+				std::pair<std::unordered_map<CornerKey, uint32_t, CornerKeyHash>::iterator, bool> added =
+					split.insert(std::make_pair(key, (uint32_t)mesh.x.size()));
+				if (added.second)
+				{
+					mesh.x.push_back(x[key.v]);
+					mesh.y.push_back(y[key.v]);
+					mesh.z.push_back(z[key.v]);
+					if (anyNormal)
+					{
+						bool has = key.n != UINT32_MAX;
+						mesh.nx.push_back(has ? nx[key.n] : 0);
+						mesh.ny.push_back(has ? ny[key.n] : 0);
+						mesh.nz.push_back(has ? nz[key.n] : 0);
+					}
+					if (anyUV)
+					{
+						bool has = key.t != UINT32_MAX;
+						mesh.u.push_back(has ? u[key.t] : 0);
+						mesh.v.push_back(has ? v[key.t] : 0);
+					}
+				}
+				mesh.indices[c] = added.first->second;
+			}
+		}
+
+		mesh.texture = textureOf(path, material);
+		return true;
+	}
+
+	static bool copyFile(const std::string& from, const std::string& to)
+	{
+		std::ifstream in(from.c_str(), std::ios::binary);
+		std::ofstream out(to.c_str(), std::ios::binary);
+		if (!in.is_open() || !out.is_open())
+			return false;
+		out << in.rdbuf();
+		return out.good();
+	}
+
+	enum ObjSection { SECTION_V, SECTION_VT, SECTION_VN, SECTION_F };
+
+	struct WriteJob
+	{
+		ObjSection section;
+		size_t begin, end;
+		std::string text;
+	};
+
+	static void formatJob(const MeshData& mesh, WriteJob& job)
+	{
+		char line[128];
+		std::string& text = job.text;
+		text.reserve((job.end - job.begin) * 40);
+		for (size_t i = job.begin; i < job.end; i++)
+		{
+			char* p = line;
+			switch (job.section)
+			{
+			case SECTION_V:
+				*p++ = 'v';
+				*p++ = ' '; p += FormatFloat(mesh.x[i], p);
+				*p++ = ' '; p += FormatFloat(mesh.y[i], p);
+				*p++ = ' '; p += FormatFloat(mesh.z[i], p);
+				break;
+			case SECTION_VT:
+				*p++ = 'v'; *p++ = 't';
+				*p++ = ' '; p += FormatFloat(mesh.u[i], p);
+				*p++ = ' '; p += FormatFloat(mesh.v[i], p);
+				break;
+			case SECTION_VN:
+				*p++ = 'v'; *p++ = 'n';
+				*p++ = ' '; p += FormatFloat(mesh.nx[i], p);
+				*p++ = ' '; p += FormatFloat(mesh.ny[i], p);
+				*p++ = ' '; p += FormatFloat(mesh.nz[i], p);
+				break;
+			case SECTION_F:
+				*p++ = 'f';
+				for (int c = 0; c < 3; c++)
+				{
+					uint32_t index = mesh.indices[i * 3 + c] + 1;
+					*p++ = ' ';
+					p = formatUnsigned(index, p);
+					if (mesh.hasUVs() || mesh.hasNormals())
+					{
+						*p++ = '/';
+						if (mesh.hasUVs())
+							p = formatUnsigned(index, p);
+						if (mesh.hasNormals())
+						{
+							*p++ = '/';
+							p = formatUnsigned(index, p);
+						}
+					}
+				}
+				break;
+			}
+			*p++ = '\n';
+			text.append(line, p - line);
+		}
+	}
+
+	/********************************************************
+	*  @function :  SaveObj
+	*  @brief    :  write a mesh as OBJ; a textured one also gets
+	*               <name>.mtl and its image copied to <name>.<ext>
+	*  @input    :  path, &mesh, &error, threads 0 for one per core
+	*  @return   :  false with error set if a file cannot be written
+	*********************************************************/
+	bool SaveObj(const std::string& path, const MeshData& mesh, std::string& error, unsigned threads)
+	{
+		std::string directory = directoryOf(path);
+		std::string name = path.substr(directory.size());
+		std::string stem = name.substr(0, name.find_last_of('.'));
+
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file == NULL)
+		{
+			error = "cannot write " + path;
+			return false;
+		}
+		if (!mesh.texture.empty())
+		{
+			size_t dot = mesh.texture.find_last_of('.');
+			std::string extension = dot == std::string::npos ? std::string(".png") : mesh.texture.substr(dot);
+			std::string image = stem + extension;
+			if (mesh.texture != directory + image && !copyFile(mesh.texture, directory + image))
+			{
+				fclose(file);
+				error = "cannot copy " + mesh.texture + " to " + directory + image;
+				return false;
+			}
+			std::ofstream mtl((directory + stem + ".mtl").c_str());
+			mtl << "newmtl " << stem << "\nKa 1 1 1\nKd 1 1 1\nillum 1\nmap_Kd " << image << "\n";
+			if (!mtl.good())
+			{
+				fclose(file);
+				error = "cannot write " + directory + stem + ".mtl";
+				return false;
+			}
+			fprintf(file, "mtllib %s.mtl\nusemtl %s\n", stem.c_str(), stem.c_str());
+		}
+
+		// sections cut into jobs, formatted a round at a time so only a
+		// round is ever held in memory
+		std::vector<WriteJob> jobs;
+		size_t sizes[4] = { mesh.vertexCount(), mesh.hasUVs() ? mesh.vertexCount() : 0,
+			mesh.hasNormals() ? mesh.vertexCount() : 0, mesh.triangleCount() };
+		for (int section = SECTION_V; section <= SECTION_F; section++)
+		{
+			for (size_t begin = 0; begin < sizes[section]; begin += OBJ_WRITE_BATCH)
+			{
+				WriteJob job;
+				job.section = (ObjSection)section;
+				job.begin = begin;
+				job.end = std::min(sizes[section], begin + OBJ_WRITE_BATCH);
+				jobs.push_back(job);
+			}
+		}
+		threads = ThreadCount(threads);
+		bool written = true;
+		for (size_t first = 0; first < jobs.size() && written; first += threads)
+		{
+			size_t round = std::min<size_t>(threads, jobs.size() - first);
+			ParallelFor(round, threads, [&](size_t i) { formatJob(mesh, jobs[first + i]); });
+			for (size_t i = 0; i < round; i++)
+			{
+				std::string& text = jobs[first + i].text;
+				written = written && fwrite(text.data(), 1, text.size(), file) == text.size();
+				std::string().swap(text);
+			}
+		}
+		written = fclose(file) == 0 && written;
+		if (!written)
+			error = "cannot write " + path;
+		return written;
+	}
+}
@@ -0,0 +1,40 @@
+/*!
+ * \brief OBJ frames without the Artec SDK
+ *
+ * Reads and writes the frame-S%02dF%02d.obj files the samples save,
+ * with their .mtl and texture image, on machines without the SDK.
+ *
+ * LoadObj maps the file, cuts it into line-aligned chunks and parses
+ * them on several threads. It understands v, vn, vt, f (polygons are
+ * fanned into triangles, negative indices count back) and mtllib;
+ * everything else is skipped. When faces give position, texture and
+ * normal indices that differ, vertices are split so every attribute
+ * has the vertex's index.
+ *
+ * SaveObj formats on several threads too. Floats are written with the
+ * fewest digits that read back to the same float. A textured mesh gets
+ * a .mtl and its image beside the .obj, named after it.
+ */
+
+#ifndef __OBJ_FILE_H__
+#define __OBJ_FILE_H__
+
+#include <string>
+#include "MeshData.h"
+
+namespace FrameIO
+{
+	// frame-S00F00.obj for scan 0, frame 0, as the samples name them
+	std::string FrameFileName(int scan, int frame, const char* extension = "obj");
+
+	// threads 0 picks one per core
+	bool LoadObj(const std::string& path, MeshData& mesh, std::string& error, unsigned threads = 0);
+	bool SaveObj(const std::string& path, const MeshData& mesh, std::string& error, unsigned threads = 0);
+
+	// float parsing and shortest round-trip formatting, shared with the
+	// other text formats; FormatFloat needs 16 bytes at out
+	const char* ParseFloat(const char* p, const char* end, float& value);
+	int FormatFloat(float value, char* out);
+}
+
+#endif // __OBJ_FILE_H__
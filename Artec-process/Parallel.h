@@ -0,0 +1,50 @@
+/*!
+ * \brief Running independent jobs on a few threads
+ */
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace FrameIO
+{
+	// threads to use when asked for 0: one per core
+	static inline unsigned ThreadCount(unsigned threads)
+	{
+		if (threads == 0)
+			threads = std::thread::hardware_concurrency();
+		return threads == 0 ? 1 : threads;
+	}
+
+	// job(i) for i in [0, count), on up to threads threads including the
+	// calling one; jobs are handed out in order as threads become free
+	template<typename Job>
+	void ParallelFor(size_t count, unsigned threads, Job job)
+	{
+		threads = (unsigned)std::min<size_t>(ThreadCount(threads), count);
+		if (threads <= 1)
+		{
+			for (size_t i = 0; i < count; i++)
+				job(i);
+			return;
+		}
+		std::atomic<size_t> next(0);
+		auto worker = [&]()
+		{
+			for (size_t i = next++; i < count; i = next++)
+				job(i);
+		};
+		std::vector<std::thread> pool;
+		for (unsigned t = 1; t < threads; t++)
+			pool.push_back(std::thread(worker));
+		worker();
+		for (size_t t = 0; t < pool.size(); t++)
+			pool[t].join();
+	}
+}
+
+#endif // __PARALLEL_H__
@@ -0,0 +1,553 @@
+/********************************************************
+    * @file    : PlyFile.cpp
+    * @brief   : binary little-endian PLY for frames and fused meshes
+*********************************************************/
+#include "PlyFile.h"
+
+#include <string.h>
+#include <sstream>
+
+#include "MappedFile.h"
+#include "Parallel.h"
+
+// room for a count in the header, patched on close
+#define PLY_COUNT_FORMAT "%-10u"
+#define PLY_COUNT_WIDTH 10
+
+namespace FrameIO
+{
+	static const size_t PLY_BUFFER_BYTES = 1 << 20;
+	// vertices converted per job when loading
+	static const size_t PLY_READ_BATCH = 1 << 16;
+
+	static bool littleEndian()
+	{
+		const uint16_t one = 1;
+		return *(const uint8_t*)&one == 1;
+	}
+
+	VertexArrays VertexArrays::of(const MeshData& mesh)
+	{
+		VertexArrays arrays;
+		arrays.x = mesh.x.empty() ? NULL : &mesh.x[0];
+		arrays.y = mesh.y.empty() ? NULL : &mesh.y[0];
+		arrays.z = mesh.z.empty() ? NULL : &mesh.z[0];
+		arrays.nx = mesh.hasNormals() ? &mesh.nx[0] : NULL;
+		arrays.ny = mesh.hasNormals() ? &mesh.ny[0] : NULL;
+		arrays.nz = mesh.hasNormals() ? &mesh.nz[0] : NULL;
+		arrays.u = mesh.hasUVs() ? &mesh.u[0] : NULL;
+		arrays.v = mesh.hasUVs() ? &mesh.v[0] : NULL;
+		arrays.r = mesh.hasColors() ? &mesh.r[0] : NULL;
+		arrays.g = mesh.hasColors() ? &mesh.g[0] : NULL;
+		arrays.b = mesh.hasColors() ? &mesh.b[0] : NULL;
+		return arrays;
+	}
+
+	PlyWriter::PlyWriter()
+		: file_(NULL), attributes_(0), vertices_(0), triangles_(0), vertexCountAt_(0), faceCountAt_(0),
+		used_(0), failed_(false)
+	{
+	}
+
+	PlyWriter::~PlyWriter()
+	{
+		std::string error;
+		if (file_ != NULL)
+			close(error);
+	}
+
+	/********************************************************
+	*  @function :  open
+	*  @brief    :  start a PLY file, with room in the header for the
+	*               counts close() writes
+	*  @input    :  path, attributes of every vertex, &error
+	*  @return   :  false with error set if the file cannot be written
+	*********************************************************/
+	bool PlyWriter::open(const std::string& path, unsigned attributes, std::string& error)
+	{
+		if (file_ != NULL)
+			close(error);
+		if (!littleEndian())
+		{
+			error = "PLY is only written on little-endian hosts";
+			return false;
+		}
+		file_ = fopen(path.c_str(), "wb");
+		if (file_ == NULL)
+		{
+			error = "cannot write " + path;
+			return false;
+		}
+		path_ = path;
+		attributes_ = attributes;
+		vertices_ = triangles_ = 0;
+		used_ = 0;
+		failed_ = false;
+		buffer_.resize(PLY_BUFFER_BYTES);
+
+		fputs("ply\nformat binary_little_endian 1.0\nelement vertex ", file_);
+		vertexCountAt_ = ftell(file_);
+		fprintf(file_, PLY_COUNT_FORMAT "\nproperty float x\nproperty float y\nproperty float z\n", 0u);
+		if (attributes & NORMALS)
+			fputs("property float nx\nproperty float ny\nproperty float nz\n", file_);
+		if (attributes & COLORS)
+			fputs("property uchar red\nproperty uchar green\nproperty uchar blue\n", file_);
+		if (attributes & UVS)
+			fputs("property float texture_u\nproperty float texture_v\n", file_);
+		fputs("element face ", file_);
+		faceCountAt_ = ftell(file_);
+		fprintf(file_, PLY_COUNT_FORMAT "\nproperty list uchar int vertex_indices\nend_header\n", 0u);
+		if (ferror(file_))
+		{
+			std::string ignored;
+			close(ignored);
+			error = "cannot write " + path;
+			return false;
+		}
+		return true;
+	}
+
+	bool PlyWriter::flush()
+	{
+		if (used_ > 0 && fwrite(&buffer_[0], 1, used_, file_) != used_)
+			failed_ = true;
+		used_ = 0;
+		return !failed_;
+	}
+
+	bool PlyWriter::reserve(size_t bytes)
+	{
+		return buffer_.size() - used_ >= bytes || flush();
+	}
+
+	bool PlyWriter::appendVertices(const VertexArrays& arrays, size_t count)
+	{
+		if (file_ == NULL || failed_ || triangles_ > 0)
+			return false;
+		size_t stride = 12 + ((attributes_ & NORMALS) ? 12 : 0) + ((attributes_ & COLORS) ? 3 : 0) +
+			((attributes_ & UVS) ? 8 : 0);
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!reserve(stride))
+				return false;
+			char* p = &buffer_[used_];
+			memcpy(p, &arrays.x[i], 4);
+			memcpy(p + 4, &arrays.y[i], 4);
+			memcpy(p + 8, &arrays.z[i], 4);
+			p += 12;
+			if (attributes_ & NORMALS)
+			{
+				memcpy(p, &arrays.nx[i], 4);
+				memcpy(p + 4, &arrays.ny[i], 4);
+				memcpy(p + 8, &arrays.nz[i], 4);
+				p += 12;
+			}
+			if (attributes_ & COLORS)
+			{
+				p[0] = (char)arrays.r[i];
+				p[1] = (char)arrays.g[i];
+				p[2] = (char)arrays.b[i];
+				p += 3;
+			}
+			if (attributes_ & UVS)
+			{
+				memcpy(p, &arrays.u[i], 4);
+				memcpy(p + 4, &arrays.v[i], 4);
+			}
+			used_ += stride;
+		}
+		vertices_ += count;
+		return true;
+	}
+
+	bool PlyWriter::appendTriangles(const uint32_t* indices, size_t count, uint32_t base)
+	{
+		if (file_ == NULL || failed_)
+			return false;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!reserve(13))
+				return false;
+			char* p = &buffer_[used_];
+			p[0] = 3;
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t index = indices[i * 3 + c] + base;
+				memcpy(p + 1 + c * 4, &index, 4);
+			}
+			used_ += 13;
+		}
+		triangles_ += count;
+		return true;
+	}
+
+	// writes the counts into the header
+	bool PlyWriter::close(std::string& error)
+	{
+		if (file_ == NULL)
+			return false;
+		bool written = flush();
+		char count[PLY_COUNT_WIDTH + 1];
+		snprintf(count, sizeof(count), PLY_COUNT_FORMAT, (unsigned)vertices_);
+		written = written && fseek(file_, vertexCountAt_, SEEK_SET) == 0 && fwrite(count, 1, PLY_COUNT_WIDTH, file_) == PLY_COUNT_WIDTH;
+		snprintf(count, sizeof(count), PLY_COUNT_FORMAT, (unsigned)triangles_);
+		written = written && fseek(file_, faceCountAt_, SEEK_SET) == 0 && fwrite(count, 1, PLY_COUNT_WIDTH, file_) == PLY_COUNT_WIDTH;
+		written = fclose(file_) == 0 && written;
+		file_ = NULL;
+		std::vector<char>().swap(buffer_);
+		if (!written)
+			error = "cannot write " + path_;
+		return written;
+	}
+
+	bool SavePly(const std::string& path, const MeshData& mesh, std::string& error)
+	{
+		unsigned attributes = (mesh.hasNormals() ? PlyWriter::NORMALS : 0) |
+			(mesh.hasColors() ? PlyWriter::COLORS : 0) | (mesh.hasUVs() ? PlyWriter::UVS : 0);
+		PlyWriter writer;
+		if (!writer.open(path, attributes, error))
+			return false;
+		bool written = writer.appendVertices(VertexArrays::of(mesh), mesh.vertexCount()) &&
+			writer.appendTriangles(mesh.indices.empty() ? NULL : &mesh.indices[0], mesh.triangleCount());
+		written = writer.close(error) && written;
+		if (!written && error.empty())
+			error = "cannot write " + path;
+		return written;
+	}
+
+	enum PlyType { PLY_NONE, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+
+	static PlyType plyType(const std::string& name)
+	{
+		if (name == "char" || name == "int8") return PLY_INT8;
+		if (name == "uchar" || name == "uint8") return PLY_UINT8;
+		if (name == "short" || name == "int16") return PLY_INT16;
+		if (name == "ushort" || name == "uint16") return PLY_UINT16;
+		if (name == "int" || name == "int32") return PLY_INT32;
+		if (name == "uint" || name == "uint32") return PLY_UINT32;
+		if (name == "float" || name == "float32") return PLY_FLOAT32;
+		if (name == "double" || name == "float64") return PLY_FLOAT64;
+		return PLY_NONE;
+	}
+
+	static size_t typeSize(PlyType type)
+	{
+		static const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+		return sizes[type];
+	}
+
+	static double readScalar(const char* p, PlyType type)
+	{
+		switch (type)
+		{
+		case PLY_INT8: return (int8_t)*p;
+		case PLY_UINT8: return (uint8_t)*p;
+		case PLY_INT16: { int16_t value; memcpy(&value, p, 2); return value; }
+		case PLY_UINT16: { uint16_t value; memcpy(&value, p, 2); return value; }
+		case PLY_INT32: { int32_t value; memcpy(&value, p, 4); return value; }
+		case PLY_UINT32: { uint32_t value; memcpy(&value, p, 4); return value; }
+		case PLY_FLOAT32: { float value; memcpy(&value, p, 4); return value; }
+		case PLY_FLOAT64: { double value; memcpy(&value, p, 8); return value; }
+		default: return 0;
+		}
+	}
+
+	struct PlyProperty
+	{
+		std::string name;
+		PlyType type;
+		PlyType countType;	// PLY_NONE unless a list
+	};
+
+	struct PlyElement
+	{
+		std::string name;
+		size_t count;
+		std::vector<PlyProperty> properties;
+
+		// bytes of one item, 0 if it has lists
+		size_t stride() const
+		{
+			size_t bytes = 0;
+			for (size_t i = 0; i < properties.size(); i++)
+			{
+				if (properties[i].countType != PLY_NONE)
+					return 0;
+				bytes += typeSize(properties[i].type);
+			}
+			return bytes;
+		}
+	};
+
+	static bool readHeader(const MappedFile& file, std::vector<PlyElement>& elements, const char*& body, std::string& error)
+	{
+		const char* p = file.data();
+		const char* end = file.end();
+		bool format = false;
+		for (int line = 0; p < end; line++)
+		{
+			const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+			if (lineEnd == NULL)
+				break;
+			std::istringstream fields(std::string(p, lineEnd));
+			p = lineEnd + 1;
+			std::string keyword;
+			fields >> keyword;
+			if (line == 0 && keyword != "ply")
+				break;
+			if (keyword == "format")
+			{
+				std::string name;
+				fields >> name;
+				if (name != "binary_little_endian")
+				{
+					error = "only binary_little_endian PLY is read, not " + name;
+					return false;
+				}
+				format = true;
+			}
+			else if (keyword == "element")
+			{
+				PlyElement element;
+				fields >> element.name >> element.count;
+				elements.push_back(element);
+			}
+			else if (keyword == "property" && !elements.empty())
+			{
+				PlyProperty property;
+				std::string type;
+				fields >> type;
+				property.countType = PLY_NONE;
+				if (type == "list")
+				{
+					std::string countType;
+					fields >> countType >> type;
+					property.countType = plyType(countType);
+					if (property.countType == PLY_NONE)
+						break;
+				}
+				property.type = plyType(type);
+				fields >> property.name;
+				if (property.type == PLY_NONE)
+					break;
+				elements.back().properties.push_back(property);
+			}
+			else if (keyword == "end_header")
+			{
+				if (!format || !littleEndian())
+					break;
+				body = p;
+				return true;
+			}
+		}
+		error = "not a binary PLY header, or a property type unknown";
+		return false;
+	}
+
+	// the vertex properties LoadPly keeps, by name
+	enum VertexField { FIELD_X, FIELD_Y, FIELD_Z, FIELD_NX, FIELD_NY, FIELD_NZ, FIELD_R, FIELD_G, FIELD_B,
+		FIELD_U, FIELD_V, FIELD_COUNT };
+
+	static int vertexField(const std::string& name)
+	{
+		static const char* names[] = { "x", "y", "z", "nx", "ny", "nz", "red", "green", "blue", "texture_u", "texture_v" };
+		for (int i = 0; i < FIELD_COUNT; i++)
+		{
+			if (name == names[i])
+				return i;
+		}
+		if (name == "s") return FIELD_U;
+		if (name == "t") return FIELD_V;
+		return -1;
+	}
+
+	static uint8_t colorOf(double value, PlyType type)
+	{
+		if (type == PLY_FLOAT32 || type == PLY_FLOAT64)
+			value *= 255;
+		return (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value + 0.5);
+	}
+
+	static bool readVertices(const PlyElement& element, const char* data, MeshData& mesh)
+	{
+		size_t stride = element.stride();
+		size_t offsets[FIELD_COUNT];
+		PlyType types[FIELD_COUNT];
+		for (int f = 0; f < FIELD_COUNT; f++)
+			types[f] = PLY_NONE;
+		size_t offset = 0;
+		for (size_t i = 0; i < element.properties.size(); i++)
+		{
+			int field = vertexField(element.properties[i].name);
+			if (field >= 0)
+			{
+				offsets[field] = offset;
+				types[field] = element.properties[i].type;
+			}
+			offset += typeSize(element.properties[i].type);
+		}
+		if (types[FIELD_X] == PLY_NONE || types[FIELD_Y] == PLY_NONE || types[FIELD_Z] == PLY_NONE)
+			return false;
+		bool normals = types[FIELD_NX] != PLY_NONE && types[FIELD_NY] != PLY_NONE && types[FIELD_NZ] != PLY_NONE;
+		bool colors = types[FIELD_R] != PLY_NONE && types[FIELD_G] != PLY_NONE && types[FIELD_B] != PLY_NONE;
+		bool uvs = types[FIELD_U] != PLY_NONE && types[FIELD_V] != PLY_NONE;
+
+		size_t count = element.count;
+		float* floats[FIELD_COUNT] = { NULL };
+		std::vector<float>* arrays[] = { &mesh.x, &mesh.y, &mesh.z, &mesh.nx, &mesh.ny, &mesh.nz, NULL, NULL, NULL, &mesh.u, &mesh.v };
+		for (int f = 0; f < FIELD_COUNT; f++)
+		{
+			bool wanted = f <= FIELD_Z || (normals && f <= FIELD_NZ) || (uvs && f >= FIELD_U);
+			if (arrays[f] != NULL && wanted)
+			{
+				arrays[f]->resize(count);
+				floats[f] = count ? &(*arrays[f])[0] : NULL;
+			}
+		}
+		if (colors)
+		{
+			mesh.r.resize(count);
+			mesh.g.resize(count);
+			mesh.b.resize(count);
+		}
+
+		size_t batches = (count + PLY_READ_BATCH - 1) / PLY_READ_BATCH;
+		ParallelFor(batches, 0, [&](size_t batch)
+		{
+			size_t first = batch * PLY_READ_BATCH;
+			size_t last = std::min(count, first + PLY_READ_BATCH);
+			for (int f = 0; f < FIELD_COUNT; f++)
+			{
+				if (floats[f] == NULL)
+					continue;
+				const char* p = data + first * stride + offsets[f];
+				if (types[f] == PLY_FLOAT32)
+				{
+					for (size_t i = first; i < last; i++, p += stride)
+						memcpy(&floats[f][i], p, 4);
+				}
+				else
+				{
+					for (size_t i = first; i < last; i++, p += stride)
+						floats[f][i] = (float)readScalar(p, types[f]);
+				}
+			}
+			if (colors)
+			{
+				uint8_t* channels[] = { &mesh.r[0], &mesh.g[0], &mesh.b[0] };
+				for (int c = 0; c < 3; c++)
+				{
+					const char* p = data + first * stride + offsets[FIELD_R + c];
+					for (size_t i = first; i < last; i++, p += stride)
+						channels[c][i] = colorOf(readScalar(p, types[FIELD_R + c]), types[FIELD_R + c]);
+				}
+			}
+		});
+		return true;
+	}
+
+	/********************************************************
+	*  @function :  LoadPly
+	*  @brief    :  read a binary little-endian PLY mesh or point cloud
+	*  @input    :  path, &mesh, &error
+	*  @return   :  false with error set if the file cannot be read,
+	*               has no x y z or ends early
+	*********************************************************/
+	bool LoadPly(const std::string& path, MeshData& mesh, std::string& error)
+	{
+		mesh.clear();
+		MappedFile file;
+		if (!file.open(path))
+		{
+			error = "cannot open " + path;
+			return false;
+		}
+		std::vector<PlyElement> elements;
+		const char* p = NULL;
+		if (!readHeader(file, elements, p, error))
+		{
+			error = path + ": " + error;
+			return false;
+		}
+
+		const char* end = file.end();
+		for (size_t e = 0; e < elements.size(); e++)
+		{
+			const PlyElement& element = elements[e];
+			size_t stride = element.stride();
+			if (stride > 0)
+			{
+				// fixed size items, e.g. the vertices
+				if ((size_t)(end - p) / stride < element.count)
+				{
+					error = path + ": ends within element " + element.name;
+					return false;
+				}
+				if (element.name == "vertex" && !readVertices(element, p, mesh))
+				{
+					error = path + ": vertices without x y z";
+					return false;
+				}
+				p += element.count * stride;
+				continue;
+			}
+
+			// items with lists are walked one at a time; the face list is
+			// fanned into triangles
+			bool faces = element.name == "face";
+			for (size_t i = 0; i < element.count; i++)
+			{
+				for (size_t k = 0; k < element.properties.size(); k++)
+				{
+					const PlyProperty& property = element.properties[k];
+					size_t size = typeSize(property.type);
+					if (property.countType == PLY_NONE)
+					{
+						if ((size_t)(end - p) < size)
+							p = NULL;
+						else
+							p += size;
+					}
+					else if ((size_t)(end - p) < typeSize(property.countType))
+						p = NULL;
+					else
+					{
+						size_t n = (size_t)readScalar(p, property.countType);
+						p += typeSize(property.countType);
+						if ((size_t)(end - p) / size < n)
+							p = NULL;
+						else
+						{
+							if (faces && (property.name == "vertex_indices" || property.name == "vertex_index"))
+							{
+								uint32_t first = n ? (uint32_t)readScalar(p, property.type) : 0;
+								for (size_t c = 1; c + 1 < n; c++)
+								{
+									mesh.indices.push_back(first);
+									mesh.indices.push_back((uint32_t)readScalar(p + c * size, property.type));
+									mesh.indices.push_back((uint32_t)readScalar(p + (c + 1) * size, property.type));
+								}
+							}
+							p += n * size;
+						}
+					}
+					if (p == NULL)
+					{
+						error = path + ": ends within element " + element.name;
+						return false;
+					}
+				}
+			}
+		}
+
+		for (size_t i = 0; i < mesh.indices.size(); i++)
+		{
+			if (mesh.indices[i] >= mesh.vertexCount())
+			{
+				error = path + ": face index out of range";
+				return false;
+			}
+		}
+		return true;
+	}
+}
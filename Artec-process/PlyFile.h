@@ -0,0 +1,82 @@
+/*!
+ * \brief Binary little-endian PLY for frames and fused meshes
+ *
+ * PlyWriter streams vertices and triangles to the file as they come,
+ * packed straight from the arrays into a write buffer. Vertices may be
+ * appended in any number of chunks, e.g. one frame at a time, but all
+ * of them before the first triangle; counts are patched into the header
+ * on close().
+ *
+ * LoadPly maps the file once and reads x y z, nx ny nz, red green blue
+ * and texture_u texture_v (or s t) of the vertex element in any of the
+ * PLY scalar types, and the faces of the face element, fanned into
+ * triangles. Other properties and elements are skipped. ASCII and
+ * big-endian files are refused.
+ */
+
+#ifndef __PLY_FILE_H__
+#define __PLY_FILE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "MeshData.h"
+
+namespace FrameIO
+{
+	// per-vertex arrays to write from; arrays of attributes the writer
+	// was not opened with may be NULL
+	struct VertexArrays
+	{
+		const float *x, *y, *z;
+		const float *nx, *ny, *nz;
+		const float *u, *v;
+		const uint8_t *r, *g, *b;
+
+		static VertexArrays of(const MeshData& mesh);
+	};
+
+	class PlyWriter
+	{
+	public:
+		enum Attributes { NORMALS = 1, COLORS = 2, UVS = 4 };
+
+		PlyWriter();
+		~PlyWriter();
+
+		// the attributes every vertex will have, NORMALS | COLORS | UVS
+		bool open(const std::string& path, unsigned attributes, std::string& error);
+		bool appendVertices(const VertexArrays& arrays, size_t count);
+		// count triangles; base is added to every index, for meshes whose
+		// vertices were appended after others
+		bool appendTriangles(const uint32_t* indices, size_t count, uint32_t base = 0);
+		bool close(std::string& error);
+
+		size_t vertexCount() const { return vertices_; }
+
+	private:
+		PlyWriter(const PlyWriter&);
+		PlyWriter& operator=(const PlyWriter&);
+
+		bool reserve(size_t bytes);
+		bool flush();
+
+		FILE* file_;
+		std::string path_;
+		unsigned attributes_;
+		size_t vertices_;
+		size_t triangles_;
+		long vertexCountAt_;	// where the counts are in the header
+		long faceCountAt_;
+		std::vector<char> buffer_;
+		size_t used_;
+		bool failed_;
+	};
+
+	// the attributes of mesh that are there
+	bool SavePly(const std::string& path, const MeshData& mesh, std::string& error);
+	bool LoadPly(const std::string& path, MeshData& mesh, std::string& error);
+}
+
+#endif // __PLY_FILE_H__
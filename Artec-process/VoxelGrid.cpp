@@ -0,0 +1,426 @@
+/********************************************************
+    * @file    : VoxelGrid.cpp
+    * @brief   : voxel-grid downsampling with radix-sorted cell keys
+*********************************************************/
+#include "VoxelGrid.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "Parallel.h"
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOXEL_GRID_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace FrameIO
+{
+	// points per job in every step
+	static const size_t VOXEL_CHUNK = 1 << 16;
+	// cells along an axis, so that three axes fit a 64-bit key
+	static const uint64_t VOXEL_MAX_CELLS = 1 << 21;
+	static const unsigned RADIX_BITS = 11;
+	static const unsigned RADIX_BUCKETS = 1 << RADIX_BITS;
+
+	struct VoxelGrid::Grid
+	{
+		float minX, minY, minZ;
+		float inverse;				// 1 / voxel size
+		float lastX, lastY, lastZ;	// highest cell along each axis
+		unsigned shiftY, shiftZ;	// of the y and z cell in the key
+		unsigned bits;				// used by keys
+		uint64_t invalid;			// key of dropped points, above all others
+	};
+
+	static inline size_t chunkCount(size_t count)
+	{
+		return (count + VOXEL_CHUNK - 1) / VOXEL_CHUNK;
+	}
+
+	static inline bool isFinite(float x, float y, float z)
+	{
+		return fabsf(x) <= FLT_MAX && fabsf(y) <= FLT_MAX && fabsf(z) <= FLT_MAX;
+	}
+
+	// bits holding 0 .. cells without all of them set, so that a key with
+	// every bit set is never a cell
+	static inline unsigned bitsFor(uint64_t cells)
+	{
+		unsigned bits = 0;
+		while ((1ULL << bits) <= cells)
+			bits++;
+		return bits;
+	}
+
+	VoxelGrid::VoxelGrid(float size, unsigned threads)
+		: size_(size), threads_(threads)
+	{
+	}
+
+	/********************************************************
+	*  @function :  makeGrid
+	*  @brief    :  bounds of the finite points and the key layout
+	*  @input    :  mesh, &grid, &error
+	*  @return   :  false if the grid does not fit a 64-bit key
+	*********************************************************/
+	bool VoxelGrid::makeGrid(const MeshData& mesh, Grid& grid, std::string& error)
+	{
+		size_t count = mesh.vertexCount();
+		size_t chunks = chunkCount(count);
+		std::vector<float> bounds(chunks * 6);
+		ParallelFor(chunks, threads_, [&](size_t c)
+		{
+			const float *x = &mesh.x[0], *y = &mesh.y[0], *z = &mesh.z[0];
+			size_t i = c * VOXEL_CHUNK, end = std::min(count, i + VOXEL_CHUNK);
+			float* b = &bounds[c * 6];
+			b[0] = b[1] = b[2] = FLT_MAX;
+			b[3] = b[4] = b[5] = -FLT_MAX;
+#ifdef VOXEL_GRID_SSE2
+			const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+			const __m128 largest = _mm_set1_ps(FLT_MAX);
+			__m128 low[3] = { largest, largest, largest };
+			__m128 high[3] = { _mm_set1_ps(-FLT_MAX), _mm_set1_ps(-FLT_MAX), _mm_set1_ps(-FLT_MAX) };
+			for (; i + 4 <= end; i += 4)
+			{
+				__m128 p[3] = { _mm_loadu_ps(x + i), _mm_loadu_ps(y + i), _mm_loadu_ps(z + i) };
+				// false for NaN and infinities
+				__m128 finite = _mm_and_ps(_mm_and_ps(
+					_mm_cmple_ps(_mm_and_ps(p[0], absMask), largest),
+					_mm_cmple_ps(_mm_and_ps(p[1], absMask), largest)),
+					_mm_cmple_ps(_mm_and_ps(p[2], absMask), largest));
+				for (int a = 0; a < 3; a++)
+				{
+					low[a] = _mm_min_ps(low[a], _mm_or_ps(_mm_and_ps(finite, p[a]), _mm_andnot_ps(finite, largest)));
+					high[a] = _mm_max_ps(high[a], _mm_or_ps(_mm_and_ps(finite, p[a]), _mm_andnot_ps(finite, _mm_set1_ps(-FLT_MAX))));
+				}
+			}
+			for (int a = 0; a < 3; a++)
+			{
+				float lanes[4];
+				_mm_storeu_ps(lanes, low[a]);
+				b[a] = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+				_mm_storeu_ps(lanes, high[a]);
+				b[3 + a] = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+			}
+#endif
+			for (; i < end; i++)
+			{
+				if (!isFinite(x[i], y[i], z[i]))
+					continue;
+				b[0] = std::min(b[0], x[i]); b[3] = std::max(b[3], x[i]);
+				b[1] = std::min(b[1], y[i]); b[4] = std::max(b[4], y[i]);
+				b[2] = std::min(b[2], z[i]); b[5] = std::max(b[5], z[i]);
+			}
+		});
+
+		float low[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, high[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (size_t c = 0; c < chunks; c++)
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				low[a] = std::min(low[a], bounds[c * 6 + a]);
+				high[a] = std::max(high[a], bounds[c * 6 + 3 + a]);
+			}
+		}
+		if (low[0] > high[0])
+		{
+			// no finite point: every key is the invalid one
+			low[0] = low[1] = low[2] = high[0] = high[1] = high[2] = 0;
+		}
+
+		uint64_t cells[3];
+		for (int a = 0; a < 3; a++)
+		{
+			double extent = ((double)high[a] - low[a]) / size_;
+			if (!(extent < VOXEL_MAX_CELLS - 1))
+			{
+				char text[128];
+				snprintf(text, sizeof(text), "voxel size %g is too small for an extent of %g", size_, (double)high[a] - low[a]);
+				error = text;
+				return false;
+			}
+			cells[a] = (uint64_t)extent + 1;
+		}
+		unsigned bitsX = bitsFor(cells[0]), bitsY = bitsFor(cells[1]), bitsZ = bitsFor(cells[2]);
+		grid.minX = low[0];
+		grid.minY = low[1];
+		grid.minZ = low[2];
+		grid.inverse = 1.0f / size_;
+		grid.lastX = (float)(cells[0] - 1);
+		grid.lastY = (float)(cells[1] - 1);
+		grid.lastZ = (float)(cells[2] - 1);
+		grid.shiftY = bitsX;
+		grid.shiftZ = bitsX + bitsY;
+		grid.bits = bitsX + bitsY + bitsZ;
+		grid.invalid = grid.bits >= 64 ? ~0ULL : (1ULL << grid.bits) - 1;
+		return true;
+	}
+
+	/********************************************************
+	*  @function :  quantize
+	*  @brief    :  the cell key of every point into keys_, its index
+	*               into order_
+	*  @input    :  mesh, grid
+	*  @return   :  none
+	*********************************************************/
+	void VoxelGrid::quantize(const MeshData& mesh, const Grid& grid)
+	{
+		size_t count = mesh.vertexCount();
+		keys_.resize(count);
+		order_.resize(count);
+		ParallelFor(chunkCount(count), threads_, [&](size_t c)
+		{
+			const float *x = &mesh.x[0], *y = &mesh.y[0], *z = &mesh.z[0];
+			uint64_t* keys = &keys_[0];
+			uint32_t* order = &order_[0];
+			size_t i = c * VOXEL_CHUNK, end = std::min(count, i + VOXEL_CHUNK);
+#ifdef VOXEL_GRID_SSE2
+			const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+			const __m128 largest = _mm_set1_ps(FLT_MAX);
+			const __m128 inverse = _mm_set1_ps(grid.inverse);
+			const __m128 minX = _mm_set1_ps(grid.minX), minY = _mm_set1_ps(grid.minY), minZ = _mm_set1_ps(grid.minZ);
+			const __m128 lastX = _mm_set1_ps(grid.lastX), lastY = _mm_set1_ps(grid.lastY), lastZ = _mm_set1_ps(grid.lastZ);
+			const __m128i shiftY = _mm_cvtsi32_si128((int)grid.shiftY), shiftZ = _mm_cvtsi32_si128((int)grid.shiftZ);
+			const __m128i invalid = _mm_set1_epi64x((long long)grid.invalid);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i four = _mm_set1_epi32(4);
+			__m128i index = _mm_add_epi32(_mm_set1_epi32((int)i), _mm_set_epi32(3, 2, 1, 0));
+			for (; i + 4 <= end; i += 4)
+			{
+				__m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i), pz = _mm_loadu_ps(z + i);
+				__m128 finite = _mm_and_ps(_mm_and_ps(
+					_mm_cmple_ps(_mm_and_ps(px, absMask), largest),
+					_mm_cmple_ps(_mm_and_ps(py, absMask), largest)),
+					_mm_cmple_ps(_mm_and_ps(pz, absMask), largest));
+				// finite points are at or above the minimum, so truncating
+				// is flooring; rounding may push the highest one cell up
+				__m128i cx = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(px, minX), inverse), lastX));
+				__m128i cy = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(py, minY), inverse), lastY));
+				__m128i cz = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(pz, minZ), inverse), lastZ));
+				__m128i low = _mm_or_si128(_mm_unpacklo_epi32(cx, zero), _mm_or_si128(
+					_mm_sll_epi64(_mm_unpacklo_epi32(cy, zero), shiftY),
+					_mm_sll_epi64(_mm_unpacklo_epi32(cz, zero), shiftZ)));
+				__m128i high = _mm_or_si128(_mm_unpackhi_epi32(cx, zero), _mm_or_si128(
+					_mm_sll_epi64(_mm_unpackhi_epi32(cy, zero), shiftY),
+					_mm_sll_epi64(_mm_unpackhi_epi32(cz, zero), shiftZ)));
+				__m128i kept = _mm_castps_si128(finite);
+				__m128i keptLow = _mm_unpacklo_epi32(kept, kept), keptHigh = _mm_unpackhi_epi32(kept, kept);
+				low = _mm_or_si128(_mm_and_si128(keptLow, low), _mm_andnot_si128(keptLow, invalid));
+				high = _mm_or_si128(_mm_and_si128(keptHigh, high), _mm_andnot_si128(keptHigh, invalid));
+				_mm_storeu_si128((__m128i*)(keys + i), low);
+				_mm_storeu_si128((__m128i*)(keys + i + 2), high);
+				_mm_storeu_si128((__m128i*)(order + i), index);
+				index = _mm_add_epi32(index, four);
+			}
+#endif
+			for (; i < end; i++)
+			{
+				order[i] = (uint32_t)i;
+				if (!isFinite(x[i], y[i], z[i]))
+				{
+					keys[i] = grid.invalid;
+					continue;
+				}
+				uint64_t cx = (uint64_t)std::min((x[i] - grid.minX) * grid.inverse, grid.lastX);
+				uint64_t cy = (uint64_t)std::min((y[i] - grid.minY) * grid.inverse, grid.lastY);
+				uint64_t cz = (uint64_t)std::min((z[i] - grid.minZ) * grid.inverse, grid.lastZ);
+				keys[i] = cx | cy << grid.shiftY | cz << grid.shiftZ;
+			}
+		});
+	}
+
+	/********************************************************
+	*  @function :  sort
+	*  @brief    :  LSD radix sort of keys_ with order_, 11 bits a pass;
+	*               each chunk counts its buckets, then scatters to the
+	*               offsets the counts give it, so the sort is stable.
+	*               Passes in which all keys share the digit are skipped
+	*  @input    :  bits used by the keys
+	*  @return   :  none
+	*********************************************************/
+	void VoxelGrid::sort(unsigned bits)
+	{
+		size_t count = keys_.size();
+		size_t chunks = chunkCount(count);
+		keysSwap_.resize(count);
+		orderSwap_.resize(count);
+		counts_.resize(chunks * RADIX_BUCKETS);
+		for (unsigned shift = 0; shift < bits; shift += RADIX_BITS)
+		{
+			ParallelFor(chunks, threads_, [&](size_t c)
+			{
+				size_t* buckets = &counts_[c * RADIX_BUCKETS];
+				std::fill(buckets, buckets + RADIX_BUCKETS, 0);
+				const uint64_t* keys = &keys_[0];
+				for (size_t i = c * VOXEL_CHUNK, end = std::min(count, i + VOXEL_CHUNK); i < end; i++)
+					buckets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+			});
+
+			// bucket by bucket, chunk by chunk: where each chunk's keys of
+			// each bucket start
+			size_t offset = 0;
+			bool trivial = false;
+			for (unsigned b = 0; b < RADIX_BUCKETS && !trivial; b++)
+			{
+				size_t start = offset;
+				for (size_t c = 0; c < chunks; c++)
+				{
+					size_t n = counts_[c * RADIX_BUCKETS + b];
+					counts_[c * RADIX_BUCKETS + b] = offset;
+					offset += n;
+				}
+				trivial = offset - start == count;
+			}
+			if (trivial)
+				continue;
+
+			ParallelFor(chunks, threads_, [&](size_t c)
+			{
+				size_t* next = &counts_[c * RADIX_BUCKETS];
+				const uint64_t* keys = &keys_[0];
+				const uint32_t* order = &order_[0];
+				uint64_t* keysOut = &keysSwap_[0];
+				uint32_t* orderOut = &orderSwap_[0];
+				for (size_t i = c * VOXEL_CHUNK, end = std::min(count, i + VOXEL_CHUNK); i < end; i++)
+				{
+					size_t to = next[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+					keysOut[to] = keys[i];
+					orderOut[to] = order[i];
+				}
+			});
+			keys_.swap(keysSwap_);
+			order_.swap(orderSwap_);
+		}
+	}
+
+	/********************************************************
+	*  @function :  reduce
+	*  @brief    :  one point per run of equal keys: centroid, mean
+	*               normal renormalized, mean colour rounded
+	*  @input    :  mesh, count of sorted keys that are cells, &cloud
+	*  @return   :  none
+	*********************************************************/
+	void VoxelGrid::reduce(const MeshData& mesh, size_t count, MeshData& cloud)
+	{
+		// chunks start at a cell, so no cell is split between two
+		size_t chunks = chunkCount(count);
+		std::vector<size_t> starts(chunks + 1, count);
+		for (size_t c = 0; c < chunks; c++)
+		{
+			size_t start = std::max(c * VOXEL_CHUNK, c > 0 ? starts[c - 1] : 0);
+			while (start > 0 && start < count && keys_[start] == keys_[start - 1])
+				start++;
+			starts[c] = start;
+		}
+
+		counts_.assign(chunks + 1, 0);
+		ParallelFor(chunks, threads_, [&](size_t c)
+		{
+			size_t cells = 0;
+			for (size_t i = starts[c]; i < starts[c + 1]; i++)
+				cells += i == starts[c] || keys_[i] != keys_[i - 1];
+			counts_[c + 1] = cells;
+		});
+		for (size_t c = 0; c < chunks; c++)
+			counts_[c + 1] += counts_[c];
+
+		size_t cells = counts_[chunks];
+		bool normals = mesh.hasNormals(), colors = mesh.hasColors();
+		cloud.x.resize(cells); cloud.y.resize(cells); cloud.z.resize(cells);
+		if (normals)
+		{
+			cloud.nx.resize(cells); cloud.ny.resize(cells); cloud.nz.resize(cells);
+		}
+		if (colors)
+		{
+			cloud.r.resize(cells); cloud.g.resize(cells); cloud.b.resize(cells);
+		}
+
+		ParallelFor(chunks, threads_, [&](size_t c)
+		{
+			const uint64_t* keys = &keys_[0];
+			const uint32_t* order = &order_[0];
+			size_t cell = counts_[c];
+			for (size_t i = starts[c], end = starts[c + 1]; i < end; cell++)
+			{
+				size_t last = i + 1;
+				while (last < end && keys[last] == keys[i])
+					last++;
+				// doubles keep the centroid exact for scans far from the origin
+				double sx = 0, sy = 0, sz = 0;
+				float nx = 0, ny = 0, nz = 0;
+				size_t r = 0, g = 0, b = 0;
+				for (size_t j = i; j < last; j++)
+				{
+					uint32_t p = order[j];
+					sx += mesh.x[p]; sy += mesh.y[p]; sz += mesh.z[p];
+					if (normals)
+					{
+						nx += mesh.nx[p]; ny += mesh.ny[p]; nz += mesh.nz[p];
+					}
+					if (colors)
+					{
+						r += mesh.r[p]; g += mesh.g[p]; b += mesh.b[p];
+					}
+				}
+				size_t n = last - i;
+				cloud.x[cell] = (float)(sx / n);
+				cloud.y[cell] = (float)(sy / n);
+				cloud.z[cell] = (float)(sz / n);
+				if (normals)
+				{
+					float length = sqrtf(nx * nx + ny * ny + nz * nz);
+					if (length > 0)
+					{
+						nx /= length; ny /= length; nz /= length;
+					}
+					cloud.nx[cell] = nx; cloud.ny[cell] = ny; cloud.nz[cell] = nz;
+				}
+				if (colors)
+				{
+					cloud.r[cell] = (uint8_t)((r + n / 2) / n);
+					cloud.g[cell] = (uint8_t)((g + n / 2) / n);
+					cloud.b[cell] = (uint8_t)((b + n / 2) / n);
+				}
+				i = last;
+			}
+		});
+	}
+
+	bool VoxelGrid::downsample(const MeshData& mesh, MeshData& cloud, std::string& error)
+	{
+		if (!(size_ > 0))
+		{
+			error = "voxel size must be positive";
+			return false;
+		}
+		if (mesh.vertexCount() > UINT32_MAX)
+		{
+			error = "too many points to downsample";
+			return false;
+		}
+		MeshData result;
+		if (mesh.vertexCount() > 0)
+		{
+			Grid grid;
+			if (!makeGrid(mesh, grid, error))
+				return false;
+			quantize(mesh, grid);
+			sort(grid.bits);
+			// dropped points sort last
+			size_t count = std::lower_bound(keys_.begin(), keys_.end(), grid.invalid) - keys_.begin();
+			reduce(mesh, count, result);
+		}
+		std::swap(cloud, result);
+		return true;
+	}
+
+	bool DownsampleVoxels(const MeshData& mesh, float size, MeshData& cloud, std::string& error, unsigned threads)
+	{
+		VoxelGrid grid(size, threads);
+		return grid.downsample(mesh, cloud, error);
+	}
+}
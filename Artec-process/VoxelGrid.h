@@ -0,0 +1,64 @@
+/*!
+ * \brief Voxel-grid downsampling of frames and point clouds
+ *
+ * The bounding box of the points is cut into cubes of the voxel size and
+ * every occupied cube becomes one point: the centroid of the points in
+ * it, with their normals averaged and renormalized and their colours
+ * averaged. The result is a point cloud; triangles, texture coordinates
+ * and the texture are not carried over. Points with a non-finite
+ * coordinate are dropped.
+ *
+ * Each point gets a 64-bit key made of its cell coordinates, computed
+ * four points at a time with SSE2 where available. Keys are radix sorted
+ * together with the point indices, so the points of a cell end up next
+ * to each other, and the cells are then reduced in one pass. All three
+ * steps run over chunks of points on several threads.
+ *
+ * A VoxelGrid keeps its sort buffers between calls; reusing one for
+ * every frame of a scan saves reallocating them.
+ */
+
+#ifndef __VOXEL_GRID_H__
+#define __VOXEL_GRID_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "MeshData.h"
+
+namespace FrameIO
+{
+	class VoxelGrid
+	{
+	public:
+		// size is the edge of a voxel, in the units of the points (mm for
+		// Artec frames); threads 0 for one per core
+		explicit VoxelGrid(float size, unsigned threads = 0);
+
+		float size() const { return size_; }
+		void setSize(float size) { size_ = size; }
+
+		// one point per occupied voxel of mesh into cloud, which may be
+		// mesh itself; fails if the voxel size is not positive or too
+		// small for the extent of the points (2^21 voxels along an axis)
+		bool downsample(const MeshData& mesh, MeshData& cloud, std::string& error);
+
+	private:
+		struct Grid;
+
+		bool makeGrid(const MeshData& mesh, Grid& grid, std::string& error);
+		void quantize(const MeshData& mesh, const Grid& grid);
+		void sort(unsigned bits);
+		void reduce(const MeshData& mesh, size_t count, MeshData& cloud);
+
+		float size_;
+		unsigned threads_;
+		std::vector<uint64_t> keys_, keysSwap_;
+		std::vector<uint32_t> order_, orderSwap_;
+		std::vector<size_t> counts_;	// per chunk, radix buckets or cells
+	};
+
+	bool DownsampleVoxels(const MeshData& mesh, float size, MeshData& cloud, std::string& error, unsigned threads = 0);
+}
+
+#endif // __VOXEL_GRID_H__
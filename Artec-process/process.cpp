@@ -6,6 +6,9 @@
     * @version : ver 1.0
     * @date    : 2017-12-25 
 *********************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
 
@@ -33,7 +36,10 @@
 #include <artec/sdk/scanning/IScanningProcedureBundle.h>
 #include <artec/sdk/algorithms/IAlgorithm.h>
 #include <artec/sdk/algorithms/Algorithms.h>
-#include "Directory.h"
+#include "FrameLoader.h"
+#include "ObjFile.h"
+#include "PlyFile.h"
+#include "VoxelGrid.h"
 namespace asdk {
 	using namespace artec::sdk::base;
 	using namespace artec::sdk::capturing;
@@ -44,6 +50,8 @@ using asdk::TRef;
 using namespace std;
 
 #define OUTPUT_DIR L"scans"
+// voxel edge for --downsample, in mm
+#define VOXEL_SIZE 1.0f
 
 // simple error log handling for SDK calls
 #define SDK_STRINGIFY(x) #x
@@ -136,9 +144,153 @@ void reportError(asdk::ErrorCode ec, const char *place)
 	std::wcerr << msg << " [error " << std::hex << ec << "] " << "at " << place << std::endl;
 }
 
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double fileMegabytes(const string &path)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+		return 0;
+	fseek(file, 0, SEEK_END);
+	double size = ftell(file) / 1048576.0;
+	fclose(file);
+	return size;
+}
+
+/********************************************************
+*  @function :  benchmarkFormats
+*  @brief    :  text OBJ against binary PLY on the frames of a scan
+*               directory: every frame is read as OBJ, then written and
+*               read back as each format; the copies are removed again
+*  @input    :  dir of frame-S..F...obj files
+*  @return   :  number of frames compared
+*********************************************************/
+int benchmarkFormats(const string &dir)
+{
+	std::vector<FrameIO::FrameFile> files = FrameIO::ListFrames(dir);
+	string objCopy = dir + "/benchmark-copy.obj";
+	string plyCopy = dir + "/benchmark-copy.ply";
+	double seconds[4] = { 0, 0, 0, 0 };	// OBJ write, OBJ read, PLY write, PLY read
+	double megabytes[2] = { 0, 0 };
+	size_t vertices = 0;
+	int frames = 0;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		if (files[i].path == objCopy)
+			continue;
+		FrameIO::MeshData mesh, back;
+		string error;
+		if (!FrameIO::LoadObj(files[i].path, mesh, error))
+		{
+			cout << error << endl;
+			continue;
+		}
+		mesh.texture.clear();	// the image is copied, not converted
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool ok = FrameIO::SaveObj(objCopy, mesh, error);
+		seconds[0] += secondsSince(start);
+		start = std::chrono::steady_clock::now();
+		ok = ok && FrameIO::LoadObj(objCopy, back, error);
+		seconds[1] += secondsSince(start);
+		start = std::chrono::steady_clock::now();
+		ok = ok && FrameIO::SavePly(plyCopy, mesh, error);
+		seconds[2] += secondsSince(start);
+		start = std::chrono::steady_clock::now();
+		ok = ok && FrameIO::LoadPly(plyCopy, back, error);
+		seconds[3] += secondsSince(start);
+		megabytes[0] += fileMegabytes(objCopy);
+		megabytes[1] += fileMegabytes(plyCopy);
+		remove(objCopy.c_str());
+		remove(plyCopy.c_str());
+		if (!ok)
+		{
+			cout << error << endl;
+			return frames;
+		}
+		vertices += mesh.vertexCount();
+		frames++;
+	}
+	if (frames == 0)
+	{
+		cout << "no frames in " << dir << endl;
+		return 0;
+	}
+	printf("%d frames, %lu vertices\n", frames, (unsigned long)vertices);
+	printf("format      MB   write ms  MB/s    read ms  MB/s\n");
+	const char *names[2] = { "obj", "ply" };
+	for (int f = 0; f < 2; f++)
+	{
+		double write = seconds[f * 2], read = seconds[f * 2 + 1];
+		printf("%-6s %8.1f %9.0f %6.0f %9.0f %6.0f\n", names[f], megabytes[f], write * 1000,
+			megabytes[f] / write, read * 1000, megabytes[f] / read);
+	}
+	return frames;
+}
+
+/********************************************************
+*  @function :  benchmarkVoxels
+*  @brief    :  voxel-grid downsampling of every frame of a scan
+*               directory, on one thread and on all of them
+*  @input    :  dir of frame-S..F...obj files, voxel size in mm
+*  @return   :  number of frames downsampled
+*********************************************************/
+int benchmarkVoxels(const string &dir, float size)
+{
+	std::vector<FrameIO::FrameFile> files = FrameIO::ListFrames(dir);
+	FrameIO::VoxelGrid single(size, 1), all(size);
+	double seconds[2] = { 0, 0 };	// one thread, all threads
+	size_t points = 0, cells = 0;
+	int frames = 0;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		FrameIO::MeshData mesh, cloud;
+		string error;
+		if (!FrameIO::LoadObj(files[i].path, mesh, error))
+		{
+			cout << error << endl;
+			continue;
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool ok = single.downsample(mesh, cloud, error);
+		seconds[0] += secondsSince(start);
+		start = std::chrono::steady_clock::now();
+		ok = ok && all.downsample(mesh, cloud, error);
+		seconds[1] += secondsSince(start);
+		if (!ok)
+		{
+			cout << error << endl;
+			return frames;
+		}
+		points += mesh.vertexCount();
+		cells += cloud.vertexCount();
+		frames++;
+	}
+	if (frames == 0)
+	{
+		cout << "no frames in " << dir << endl;
+		return 0;
+	}
+	printf("%d frames, %lu points to %lu at %g mm\n", frames, (unsigned long)points, (unsigned long)cells, size);
+	printf("threads      ms  Mpoints/s\n");
+	printf("%-7u %7.0f %10.1f\n", 1u, seconds[0] * 1000, points / seconds[0] / 1e6);
+	printf("%-7u %7.0f %10.1f\n", FrameIO::ThreadCount(0), seconds[1] * 1000, points / seconds[1] / 1e6);
+	return frames;
+}
+
 int main(int argc, char **argv)
 {
-	string path = "D:/Zhouxh-project/source code/artec/artec-sdk-samples-v2.0/samples/scanning-and-process/scans";
+	//--benchmark dir: compare frame formats on a scan directory and stop
+	if (argc > 2 && string(argv[1]) == "--benchmark")
+		return benchmarkFormats(argv[2]) > 0 ? 0 : 1;
+	//--downsample dir [mm]: time voxel-grid downsampling of its frames
+	if (argc > 2 && string(argv[1]) == "--downsample")
+		return benchmarkVoxels(argv[2], argc > 3 ? (float)atof(argv[3]) : VOXEL_SIZE) > 0 ? 0 : 1;
+
+	//the scan directory may be given, frame-S..F...obj files in it
+	string path = argc > 1 ? argv[1] : "D:/Zhouxh-project/source code/artec/artec-sdk-samples-v2.0/samples/scanning-and-process/scans";
 	//asdk::setOutputLevel(asdk::VerboseLevel_Info);
 	//// create workset for scanned data
 	//TRef<asdk::IModel> inputContainer;
@@ -151,36 +303,43 @@ int main(int argc, char **argv)
 
 	//asdk::AlgorithmWorkset workset = { inputContainer, outputContainer, 0, ctSource->getToken(), 0 };
 
-	vector< TRef<asdk::IFrameMesh> > frameMesh;
-	std::vector<std::string> filenames = Directory::GetListFiles(path, "*.obj");
-	if (filenames.size() == 1)
+	std::vector<FrameIO::FrameFile> files = FrameIO::ListFrames(path);
+	if (files.size() <= 1)
 	{
 		cout << "ǰֻɨһΣ޷кȡ" << endl;
+		return 0;
 	}
-	else
-	{
 
-		TRef<asdk::IFrameMesh> inputMesh;
-		for (int i=0;i<filenames.size();i++)
+	//frames are read a few at a time; each goes on to the outlier stage
+	//as soon as it and the frames before it are in, so only a window of
+	//frames is ever held
+	FrameIO::FrameLoader< TRef<asdk::IFrameMesh> > loader(files);
+	size_t processed = loader.run(
+		[](const FrameIO::FrameFile &file, TRef<asdk::IFrameMesh> &mesh, string &error)
 		{
-			string filePath = path + filenames[0];
-			std::wstring widestr = std::wstring(filePath.begin(), filePath.end());
-			const  wchar_t* widecstr = widestr.c_str();
-
-			artec::sdk::base::io::loadObjFrameFromFile(&inputMesh, widecstr);
-
-		}
-	}
-	for (int i = 0; i < frameMesh.size(); i++)
-	{
-		TRef<asdk::IFrameMesh> frameMeshTest(frameMesh[i]);
-
-		std::wstring pathFormat(OUTPUT_DIR L"\\frame-outliers-S%02dF%02d.obj");
-		std::vector<wchar_t> pathBuffer(pathFormat.size() + 1);
-		std::swprintf(pathBuffer.data(), pathBuffer.size(), pathFormat.c_str(), 0, 0);
-
-		asdk::io::saveObjFrameToFile(pathBuffer.data(), frameMeshTest);
-	}
+			std::wstring widestr = std::wstring(file.path.begin(), file.path.end());
+			asdk::ErrorCode ec = asdk::io::loadObjFrameFromFile(&mesh, widestr.c_str());
+			if (ec != asdk::ErrorCode_OK)
+			{
+				error = "cannot load, error " + std::to_string((int)ec);
+				return false;
+			}
+			return true;
+		},
+		[](size_t index, const FrameIO::FrameFile &file, TRef<asdk::IFrameMesh> &mesh)
+		{
+			//files not named by scan and frame are numbered in order
+			int scan = file.scan >= 0 ? file.scan : 0;
+			int frame = file.scan >= 0 ? file.frame : (int)index;
+			std::wstring pathFormat(OUTPUT_DIR L"\\frame-outliers-S%02dF%02d.obj");
+			std::vector<wchar_t> pathBuffer(pathFormat.size() + 16);
+			std::swprintf(pathBuffer.data(), pathBuffer.size(), pathFormat.c_str(), scan, frame);
+
+			asdk::io::saveObjFrameToFile(pathBuffer.data(), mesh);
+		});
+	for (size_t i = 0; i < loader.errors().size(); i++)
+		cout << loader.errors()[i] << endl;
+	cout << processed << " of " << files.size() << " frames processed" << endl;
 
 	return 0;
 }
\ No newline at end of file
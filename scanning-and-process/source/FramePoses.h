@@ -0,0 +1,162 @@
+/*!
+ * \brief Robot poses of captured frames, to seed registration
+ *
+ * win-ros writes frame_poses.txt into its campaign directory, one line
+ * per saved frame:
+ *   <obj file> x y z qx qy qz qw
+ * the goal pose of the end effector in the planning frame, in meters,
+ * at which the frame was captured. File names are relative to the
+ * directory win-ros runs in. A frame captured again later gets a new
+ * line, the last one counts.
+ *
+ * The scanner sits on the end effector at a fixed offset, the hand-eye
+ * calibration, given in the same "x y z qx qy qz qw" form. Where the
+ * scanner was is then pose * hand_eye, and Artec meshes are in
+ * millimeters.
+ */
+
+#ifndef __FRAME_POSES_H__
+#define __FRAME_POSES_H__
+
+#include <math.h>
+#include <stdio.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace FramePoses
+{
+	struct Pose
+	{
+		double x, y, z;
+		double qx, qy, qz, qw;
+	};
+
+	struct Frame
+	{
+		std::string file;
+		Pose pose;
+	};
+
+	static inline Pose Identity()
+	{
+		Pose pose = { 0, 0, 0, 0, 0, 0, 1 };
+		return pose;
+	}
+
+	static inline bool ParsePose(std::istream& in, Pose& pose)
+	{
+		if (!(in >> pose.x >> pose.y >> pose.z >> pose.qx >> pose.qy >> pose.qz >> pose.qw))
+			return false;
+		double norm = sqrt(pose.qx * pose.qx + pose.qy * pose.qy + pose.qz * pose.qz + pose.qw * pose.qw);
+		if (norm < 1e-6)
+			return false;
+		pose.qx /= norm;
+		pose.qy /= norm;
+		pose.qz /= norm;
+		pose.qw /= norm;
+		return true;
+	}
+
+	// frames in the order they were first captured, each with its last pose
+	static inline bool Load(const std::string& path, std::vector<Frame>& frames, std::string& error)
+	{
+		std::ifstream in(path.c_str());
+		if (!in.is_open())
+		{
+			error = "cannot open " + path;
+			return false;
+		}
+		frames.clear();
+		std::map<std::string, size_t> index;
+		std::string text;
+		for (int line = 1; std::getline(in, text); line++)
+		{
+			if (text.empty() || text[0] == '#')
+				continue;
+			std::istringstream fields(text);
+			Frame frame;
+			if (!(fields >> frame.file) || !ParsePose(fields, frame.pose))
+			{
+				std::ostringstream message;
+				message << path << " line " << line << ": file and pose expected";
+				error = message.str();
+				return false;
+			}
+			std::map<std::string, size_t>::iterator it = index.find(frame.file);
+			if (it != index.end())
+				frames[it->second].pose = frame.pose;
+			else
+			{
+				index[frame.file] = frames.size();
+				frames.push_back(frame);
+			}
+		}
+		return true;
+	}
+
+	// the first pose in a file of "x y z qx qy qz qw" lines
+	static inline bool LoadHandEye(const std::string& path, Pose& pose)
+	{
+		std::ifstream in(path.c_str());
+		std::string text;
+		while (std::getline(in, text))
+		{
+			if (text.empty() || text[0] == '#')
+				continue;
+			std::istringstream fields(text);
+			return ParsePose(fields, pose);
+		}
+		return false;
+	}
+
+	// row major 4x4 transform, translation in millimeters
+	static inline void ToMatrix(const Pose& pose, double m[16])
+	{
+		double x = pose.qx, y = pose.qy, z = pose.qz, w = pose.qw;
+		m[0] = 1 - 2 * (y * y + z * z); m[1] = 2 * (x * y - z * w);     m[2] = 2 * (x * z + y * w);     m[3] = pose.x * 1000;
+		m[4] = 2 * (x * y + z * w);     m[5] = 1 - 2 * (x * x + z * z); m[6] = 2 * (y * z - x * w);     m[7] = pose.y * 1000;
+		m[8] = 2 * (x * z - y * w);     m[9] = 2 * (y * z + x * w);     m[10] = 1 - 2 * (x * x + y * y); m[11] = pose.z * 1000;
+		m[12] = 0; m[13] = 0; m[14] = 0; m[15] = 1;
+	}
+
+	static inline void Multiply(const double a[16], const double b[16], double out[16])
+	{
+		for (int row = 0; row < 4; row++)
+			for (int col = 0; col < 4; col++)
+			{
+				double sum = 0;
+				for (int k = 0; k < 4; k++)
+					sum += a[row * 4 + k] * b[k * 4 + col];
+				out[row * 4 + col] = sum;
+			}
+	}
+
+	// where the scanner was when the frame was taken
+	static inline void ScannerTransform(const Pose& pose, const Pose& handEye, double m[16])
+	{
+		double robot[16], offset[16];
+		ToMatrix(pose, robot);
+		ToMatrix(handEye, offset);
+		Multiply(robot, offset, m);
+	}
+
+	// how far apart two transforms are: shift in millimeters, turn in degrees
+	static inline void Distance(const double a[16], const double b[16], double& shift, double& turn)
+	{
+		double dx = a[3] - b[3], dy = a[7] - b[7], dz = a[11] - b[11];
+		shift = sqrt(dx * dx + dy * dy + dz * dz);
+		// trace of a^T b
+		double trace = 0;
+		for (int row = 0; row < 3; row++)
+			for (int col = 0; col < 3; col++)
+				trace += a[row * 4 + col] * b[row * 4 + col];
+		double c = (trace - 1) / 2;
+		c = c > 1 ? 1 : (c < -1 ? -1 : c);
+		turn = acos(c) * 180 / 3.14159265358979323846;
+	}
+}
+
+#endif // __FRAME_POSES_H__
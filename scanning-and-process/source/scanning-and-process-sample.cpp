@@ -7,6 +7,8 @@
 *   Copyright:  Artec Group
 *
 ********************************************************************/
+#include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <string>
@@ -15,6 +17,7 @@
 #include <artec/sdk/base/Errors.h>
 
 #include <artec/sdk/base/TRef.h>
+#include <artec/sdk/base/Matrix.h>
 #include <artec/sdk/base/RefBase.h>
 #include <artec/sdk/base/IFrameMesh.h>
 #include <artec/sdk/base/ICompositeMesh.h>
@@ -34,6 +37,7 @@
 #include <artec/sdk/algorithms/Algorithms.h>
 #include "ScenePresenter.h"
 #include "Directory.h"
+#include "FramePoses.h"
 
 namespace asdk {
 	using namespace artec::sdk::base;
@@ -66,6 +70,12 @@ const int NumberOfFramesToCapture = 1;
 //#define SAVE_FUSION_MESH_ON
 #define SAVE_TEXTURED_MESH_ON
 
+// Frames loaded with --poses start where the robot held the scanner.
+// Registration only refines that; a frame it moves further than this
+// was aligned to the wrong place and is put back at its seed.
+#define SEED_MAX_SHIFT_MM 10.0
+#define SEED_MAX_TURN_DEG 5.0
+
 
 // simple error log handling for SDK calls
 #define SDK_STRINGIFY(x) #x
@@ -269,13 +279,95 @@ asdk::ErrorCode ScanningProcedureSample( asdk::AlgorithmWorkset& workset  )
 }
 
 
-// example of the post-scanning processing
-asdk::ErrorCode AlgorithmProcessingSample( asdk::AlgorithmWorkset& workset  )
+static asdk::Matrix4x4D toMatrix( const double m[16] )
+{
+    asdk::Matrix4x4D matrix = asdk::Matrix4x4D::identity();
+    for( int row = 0; row < 4; row++ )
+        for( int col = 0; col < 4; col++ )
+            matrix( row, col ) = m[row * 4 + col];
+    return matrix;
+}
+
+static void fromMatrix( const asdk::Matrix4x4D& matrix, double m[16] )
+{
+    for( int row = 0; row < 4; row++ )
+        for( int col = 0; col < 4; col++ )
+            m[row * 4 + col] = matrix( row, col );
+}
+
+// frames captured by win-ros, each in a scan of its own, placed where
+// the robot held the scanner when it was taken
+asdk::ErrorCode LoadSeededFrames( asdk::AlgorithmWorkset& workset, const std::string& posesPath,
+    const std::string& handEyePath, std::vector<asdk::Matrix4x4D>& seeds )
+{
+    std::vector<FramePoses::Frame> frames;
+    std::string error;
+    if( !FramePoses::Load( posesPath, frames, error ) )
+    {
+        std::wcout << error.c_str() << std::endl;
+        return asdk::ErrorCode_ArgumentInvalid;
+    }
+
+    FramePoses::Pose handEye = FramePoses::Identity();
+    if( handEyePath.empty() )
+    {
+        std::wcout << L"No hand-eye calibration given, the scanner is taken to be at the end effector" << std::endl;
+    }
+    else if( !FramePoses::LoadHandEye( handEyePath, handEye ) )
+    {
+        std::wcout << L"Cannot read the hand-eye calibration from " << handEyePath.c_str() << std::endl;
+        return asdk::ErrorCode_ArgumentInvalid;
+    }
+
+    std::wcout << L"Loading " << frames.size() << L" frames with their robot poses..." << std::endl;
+    for( size_t ix = 0; ix < frames.size(); ix++ )
+    {
+        std::wstring file( frames[ix].file.begin(), frames[ix].file.end() );
+        TRef<asdk::IFrameMesh> frameMesh;
+        if( asdk::io::Obj::load( &frameMesh, file.c_str() ) != asdk::ErrorCode_OK )
+        {
+            std::wcout << L"Cannot load '" << file << L"', skipped" << std::endl;
+            continue;
+        }
+
+        double m[16];
+        FramePoses::ScannerTransform( frames[ix].pose, handEye, m );
+        asdk::Matrix4x4D seed = toMatrix( m );
+
+        TRef<asdk::IScan> scan;
+        SAFE_SDK_CALL( asdk::createScan( &scan ) );
+        scan->add( frameMesh );
+        scan->setScanTransformation( seed );
+        workset.in->add( scan );
+        seeds.push_back( seed );
+    }
+    if( seeds.empty() )
+    {
+        std::wcout << L"No frames to process" << std::endl;
+        return asdk::ErrorCode_ArgumentInvalid;
+    }
+    std::wcout << L"OK" << std::endl;
+
+    return asdk::ErrorCode_OK;
+}
+
+
+// example of the post-scanning processing; seeds are the robot poses of
+// frames loaded with LoadSeededFrames(), NULL for a scan without them
+asdk::ErrorCode AlgorithmProcessingSample( asdk::AlgorithmWorkset& workset, const std::vector<asdk::Matrix4x4D>* seeds = NULL )
 {
     // get scanner type from the very first scan in workset
     asdk::ScannerType scannerType = (asdk::ScannerType)workset.in->getElement(0)->getScannerType();
 
-    // apply serial registration
+    // apply serial registration; seeded scans hold a single frame each,
+    // already placed, and go straight to the global registration
+    if( seeds )
+    {
+        std::wcout << L"Frames are placed by their robot poses, serial registration skipped" << std::endl;
+        // where serial registration would have left them for the swap below
+        std::swap( workset.in, workset.out );
+    }
+    else
     {
         std::wcout << L"Creating serial registration procedure..." << std::endl;
 
@@ -310,9 +402,36 @@ asdk::ErrorCode AlgorithmProcessingSample( asdk::AlgorithmWorkset& workset  )
         std::wcout << L"OK" << std::endl;
 
 
+        // from the robot poses this is a local refinement, without them
+        // it has to find the alignment from scratch
         std::wcout << L"Launching the global registration algorithm..." << std::endl;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         SAFE_SDK_CALL( asdk::executeJob( globalRegistration, &workset ) );
-        std::wcout << L"OK" << std::endl;
+        std::wcout << L"OK in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start ).count() << L" ms" << std::endl;
+    }
+
+    // a frame registered far from where the robot held the scanner
+    // converged to a wrong alignment, trust the robot instead
+    if( seeds )
+    {
+        int reset = 0;
+        for( int ix = 0; ix < workset.out->getSize() && ix < (int)seeds->size(); ix++ )
+        {
+            TRef<asdk::IScan> scan( workset.out->getElement( ix ) );
+            double refined[16], seed[16], shift, turn;
+            fromMatrix( scan->getScanTransformation(), refined );
+            fromMatrix( (*seeds)[ix], seed );
+            FramePoses::Distance( refined, seed, shift, turn );
+            if( shift > SEED_MAX_SHIFT_MM || turn > SEED_MAX_TURN_DEG )
+            {
+                std::wcout << L"Frame " << ix << L" moved " << shift << L" mm and " << turn
+                    << L" degrees from its robot pose, put back" << std::endl;
+                scan->setScanTransformation( (*seeds)[ix] );
+                reset++;
+            }
+        }
+        std::wcout << reset << L" of " << workset.out->getSize() << L" frames put back at their robot poses" << std::endl;
     }
     // prepare global registration output for outliers removal
     std::swap( workset.in, workset.out );
@@ -424,7 +543,13 @@ int main( int argc, char **argv )
     SAFE_SDK_CALL( asdk::createCancellationTokenSource( &ctSource ) );
 
 	asdk::AlgorithmWorkset workset = { inputContainer, outputContainer, 0, ctSource->getToken(), 0 };
-	asdk::ErrorCode errorCode = ScanningProcedureSample(workset);
+
+	//--poses frame_poses.txt [hand_eye.txt]: no scanning, process the
+	//frames a win-ros campaign captured, placed by their robot poses
+	bool seeded = argc > 2 && strcmp(argv[1], "--poses") == 0;
+	std::vector<asdk::Matrix4x4D> seeds;
+	asdk::ErrorCode errorCode = seeded ?
+		LoadSeededFrames(workset, argv[2], argc > 3 ? argv[3] : "", seeds) : ScanningProcedureSample(workset);
 	if (errorCode != asdk::ErrorCode_OK)
 	{
 		std::wcout << L"Finishing work on errors when scanning..." << std::endl;
@@ -436,7 +561,7 @@ int main( int argc, char **argv )
 	std::vector<std::string> filenames = Directory::GetListFiles(path, "*.obj");
 	TRef<artec::sdk::base::IScan> scan1;
 	SAFE_SDK_CALL(createScan(&scan1));
-	if (filenames.size() == 1)
+	if (!seeded && filenames.size() == 1)
 	{
 		cout << "ǰֻɨһΣ޷кȡ" << endl;
 		string filePath = filenames[0];
@@ -452,7 +577,7 @@ int main( int argc, char **argv )
 	//std::wcout << L"******************workset_out" << workset.out << std::endl;
 	//std::wcout << L"******************workset_progress" << workset.progress << std::endl;
 	//std::wcout << L"******************workset_threadsCount" << workset.threadsCount << std::endl;
-    errorCode = AlgorithmProcessingSample( workset );
+    errorCode = AlgorithmProcessingSample( workset, seeded ? &seeds : NULL );
     if( errorCode != asdk::ErrorCode_OK )
     {
         std::wcout << L"Finishing work on errors when processing..." << std::endl;
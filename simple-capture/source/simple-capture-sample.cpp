@@ -9,10 +9,19 @@
 ********************************************************************/
 
 #undef NDEBUG
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <iomanip>
 #include <string>
 #include <iostream>
 #include <time.h> 
+#include <stdio.h>
+#include <stdlib.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <artec/sdk/capturing/IFrameProcessor.h>
 #include <artec/sdk/capturing/IFrame.h>
 #include <artec/sdk/base/BaseSdkDefines.h>
@@ -49,6 +58,11 @@ namespace asdk {
 using asdk::TRef;
 using asdk::TArrayRef;
 
+#pragma comment(lib, "Ws2_32.lib")
+
+// resident mode: --serve [port [serial]], local TCP only
+#define DEFAULT_SERVE_PORT 11511
+
 ////**added by Minliang LIN for outlier alogrithm
 //#include <artec/sdk/base/AlgorithmWorkset.h>
 //#include <artec/sdk/algorithms/IAlgorithm.h>
@@ -67,21 +81,27 @@ using asdk::TArrayRef;
 //}
 ////**end
 
-int main(int argc, char **argv)
+//true if a scanner serial, narrow or wide, reads as wanted
+template<typename Char>
+bool sameSerial(const Char *serial, const char *wanted)
 {
-	//add time to file to avoid replace the same file
-	time_t currtime = time(NULL);
-	tm* p = localtime(&currtime);
-	char filename[100] = { 0 };
-
-	// The log verbosity level is set here. It is set to the most
-	// verbose value - Trace. If you have any problems working with 
-	// our examples, please do not hesitate to send us this extensive 
-	// information along with your questions. However, if you feel 
-	// comfortable with these Artec Scanning SDK code examples,
-	// we suggest you to set this level to asdk::VerboseLevel_Info.
-	asdk::setOutputLevel(asdk::VerboseLevel_Trace);
+	while (*wanted && (wchar_t)*serial == (wchar_t)*wanted)
+	{
+		serial++;
+		wanted++;
+	}
+	return *serial == 0 && *wanted == 0;
+}
 
+/********************************************************
+*  @function :  openScanner
+*  @brief    :  connect to the scanner with the given serial, or to the
+*               first scanner found
+*  @input    :  &scanner, serial or NULL
+*  @return   :  0, or the exit code of the failure
+*********************************************************/
+int openScanner(TRef<asdk::IScanner> &scanner, const char *serial = NULL)
+{
 	asdk::ErrorCode ec = asdk::ErrorCode_OK;
 
 	TRef<asdk::IArrayScannerId> scannersList;
@@ -104,14 +124,25 @@ int main(int argc, char **argv)
 
 	const asdk::ScannerId* idArray = scannersList->getPointer();
 
-	const asdk::ScannerId& defaultScanner = idArray[0]; // just take the first available scanner
+	int chosen = 0; // just take the first available scanner
+	if (serial)
+	{
+		//several scanners on one PC, each service drives its own
+		for (chosen = 0; chosen < scanner_count && !sameSerial(idArray[chosen].serial, serial); chosen++)
+			;
+		if (chosen == scanner_count)
+		{
+			std::wcout << L"No scanner " << serial << std::endl;
+			return 3;
+		}
+	}
+	const asdk::ScannerId& defaultScanner = idArray[chosen];
 
 	std::wcout
 		<< L"Connecting to " << asdk::getScannerTypeName(defaultScanner.type)
 		<< L" scanner " << defaultScanner.serial << L"... "
 		;
 
-	TRef<asdk::IScanner> scanner;
 	ec = asdk::createScanner(&scanner, &defaultScanner);
 
 	if (ec != asdk::ErrorCode_OK)
@@ -120,6 +151,316 @@ int main(int argc, char **argv)
 		return 2;
 	}
 	std::wcout << L"done" << std::endl;
+	return 0;
+}
+
+/********************************************************
+*  @function :  saveMesh
+*  @brief    :  save a mesh as OBJ under a narrow file name
+*  @input    :  filename, mesh
+*  @return   :  error code of the save
+*********************************************************/
+asdk::ErrorCode saveMesh(const char *filename, asdk::IFrameMesh *mesh)
+{
+	size_t len = strlen(filename) + 1;
+	size_t converted = 0;
+	std::vector<wchar_t> WStr(len);
+	mbstowcs_s(&converted, WStr.data(), len, filename, _TRUNCATE);
+
+	return asdk::io::Obj::save(WStr.data(), mesh); // save in text format
+}
+
+/*
+ * Resident capture service. The scanner and its frame processor are
+ * opened once and stay warm; a client on localhost sends one line per
+ * request and gets line replies:
+ *
+ *   CAPTURE <id>   ->  CAPTURED <id>            frame taken, robot may move
+ *                  ->  RECONSTRUCTING <id>      reconstruction started
+ *                  ->  RECONSTRUCTED <id>       mesh built, being saved
+ *                  ->  SAVED <id> <file>        reconstructed and saved
+ *                  or  FAILED <id> <error>
+ *   PING           ->  PONG
+ *   QUIT           ->  BYE, the service exits
+ *
+ * Reconstruction runs on a worker thread, so the next CAPTURE is served
+ * while the previous frame is still being reconstructed. The id becomes
+ * part of the mesh file name: up to MAX_CAPTURE_ID characters, no spaces
+ * or path separators.
+ */
+#define MAX_CAPTURE_ID 100
+
+static bool validCaptureId(const std::string &id)
+{
+	return !id.empty() && id.size() <= MAX_CAPTURE_ID && id.find_first_of(" \t/\\:") == std::string::npos;
+}
+
+struct CaptureJob
+{
+	std::string id;
+	TRef<asdk::IFrame> frame;
+};
+
+class CaptureService
+{
+public:
+	CaptureService(asdk::IScanner *scanner, asdk::IFrameProcessor *processor)
+		: scanner_(scanner), processor_(processor), client_(INVALID_SOCKET), busy_(false), stopping_(false)
+	{
+		worker_ = std::thread(&CaptureService::reconstructLoop, this);
+	}
+
+	~CaptureService()
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobs_mutex_);
+			stopping_ = true;
+		}
+		jobs_cv_.notify_all();
+		worker_.join();
+	}
+
+	//serve one client until it disconnects, returns false on QUIT
+	bool serve(SOCKET client)
+	{
+		client_ = client;
+		std::string line;
+		char buffer[256];
+		bool running = true;
+		while (running)
+		{
+			int got = recv(client, buffer, sizeof(buffer), 0);
+			if (got <= 0)
+				break;
+			for (int i = 0; i < got && running; i++)
+			{
+				if (buffer[i] == '\r')
+					continue;
+				if (buffer[i] != '\n')
+				{
+					line += buffer[i];
+					continue;
+				}
+				running = handle(line);
+				line.clear();
+			}
+		}
+		//wait for the frames of this client before it is forgotten
+		std::unique_lock<std::mutex> lock(jobs_mutex_);
+		jobs_cv_.wait(lock, [this] { return jobs_.empty() && !busy_; });
+		std::lock_guard<std::mutex> send_lock(send_mutex_);
+		client_ = INVALID_SOCKET;
+		return running;
+	}
+
+private:
+	bool handle(const std::string &line)
+	{
+		std::string command = line.substr(0, line.find(' '));
+		std::string id = line.size() > command.size() ? line.substr(command.size() + 1) : "";
+		if (command == "PING")
+		{
+			reply("PONG");
+		}
+		else if (command == "QUIT")
+		{
+			reply("BYE");
+			return false;
+		}
+		else if (command == "CAPTURE" && validCaptureId(id))
+		{
+			CaptureJob job;
+			job.id = id;
+			asdk::ErrorCode ec = scanner_->capture(&job.frame, true); // with texture
+			if (ec != asdk::ErrorCode_OK)
+			{
+				reply("FAILED " + id + " capture-" + std::to_string((int)ec));
+				return true;
+			}
+			reply("CAPTURED " + id);
+			std::lock_guard<std::mutex> lock(jobs_mutex_);
+			jobs_.push_back(job);
+			jobs_cv_.notify_all();
+		}
+		else
+		{
+			reply("ERROR " + line);
+		}
+		return true;
+	}
+
+	void reply(const std::string &text)
+	{
+		std::lock_guard<std::mutex> lock(send_mutex_);
+		if (client_ == INVALID_SOCKET)
+			return;
+		std::string message = text + "\n";
+		send(client_, message.c_str(), (int)message.size(), 0);
+	}
+
+	void reconstructLoop()
+	{
+		while (true)
+		{
+			CaptureJob job;
+			{
+				std::unique_lock<std::mutex> lock(jobs_mutex_);
+				jobs_cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+				if (jobs_.empty())
+					return;
+				job = jobs_.front();
+				jobs_.pop_front();
+				busy_ = true;
+			}
+
+			//the frames before it were waited for until now
+			reply("RECONSTRUCTING " + job.id);
+			TRef<asdk::IFrameMesh> mesh;
+			asdk::ErrorCode ec = processor_->reconstructAndTexturizeMesh(&mesh, job.frame);
+			if (ec == asdk::ErrorCode_OK)
+			{
+				reply("RECONSTRUCTED " + job.id);
+				//ʱpose idļֹϴļ
+				time_t currtime = time(NULL);
+				tm* p = localtime(&currtime);
+				char filename[160] = { 0 };
+				snprintf(filename, sizeof(filename), "%d%02d%02d%02d%02d%02d-%s.obj", p->tm_year + 1900, p->tm_mon + 1, p->tm_mday, p->tm_hour, p->tm_min, p->tm_sec, job.id.c_str());
+				ec = saveMesh(filename, mesh);
+				//the client may run in another directory
+				char fullpath[_MAX_PATH];
+				if (_fullpath(fullpath, filename, _MAX_PATH) == NULL)
+					strcpy(fullpath, filename);
+				if (ec == asdk::ErrorCode_OK)
+					reply("SAVED " + job.id + " " + fullpath);
+			}
+			if (ec != asdk::ErrorCode_OK)
+				reply("FAILED " + job.id + " reconstruct-" + std::to_string((int)ec));
+
+			{
+				std::lock_guard<std::mutex> lock(jobs_mutex_);
+				busy_ = false;
+			}
+			jobs_cv_.notify_all();
+		}
+	}
+
+	asdk::IScanner *scanner_;
+	asdk::IFrameProcessor *processor_;
+	SOCKET client_;
+	std::mutex send_mutex_;
+
+	std::deque<CaptureJob> jobs_;
+	std::mutex jobs_mutex_;
+	std::condition_variable jobs_cv_;
+	bool busy_;
+	bool stopping_;
+	std::thread worker_;
+};
+
+/********************************************************
+*  @function :  serve
+*  @brief    :  resident mode, open the scanner once and serve capture
+*               requests on localhost until QUIT
+*  @input    :  port, serial of the scanner or NULL for the first one
+*  @return   :  exit code
+*********************************************************/
+int serve(int port, const char *serial)
+{
+	TRef<asdk::IScanner> scanner;
+	int result = openScanner(scanner, serial);
+	if (result != 0)
+		return result;
+
+	TRef<asdk::IFrameProcessor> processor;
+	if (scanner->createFrameProcessor(&processor) != asdk::ErrorCode_OK)
+	{
+		std::wcout << L"Could not create frame processor" << std::endl;
+		return 2;
+	}
+	processor->setSensitivity(0.9f);
+
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		std::wcout << L"Could not initialize windows socket" << std::endl;
+		return 4;
+	}
+	SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in address = { 0 };
+	address.sin_family = AF_INET;
+	address.sin_port = htons((u_short)port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (listener == INVALID_SOCKET ||
+		bind(listener, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+		listen(listener, 1) == SOCKET_ERROR)
+	{
+		std::wcout << L"Could not listen on port " << port << std::endl;
+		WSACleanup();
+		return 4;
+	}
+	std::wcout << L"Capture service listening on port " << port << std::endl;
+
+	{
+		CaptureService service(scanner, processor);
+		bool running = true;
+		while (running)
+		{
+			SOCKET client = accept(listener, NULL, NULL);
+			if (client == INVALID_SOCKET)
+				break;
+			//requests are small and latency matters
+			BOOL nodelay = TRUE;
+			setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+			running = service.serve(client);
+			closesocket(client);
+		}
+	}
+
+	closesocket(listener);
+	WSACleanup();
+	processor = NULL;
+	scanner = NULL;
+	std::wcout << L"Scanner released" << std::endl;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "--serve") == 0)
+	{
+		asdk::setOutputLevel(asdk::VerboseLevel_Info);
+		return serve(argc > 2 ? atoi(argv[2]) : DEFAULT_SERVE_PORT, argc > 3 ? argv[3] : NULL);
+	}
+
+	//--capture file [serial]: one frame from that scanner into that file,
+	//the exit code tells whether it was saved
+	const char *output = NULL, *serial = NULL;
+	if (argc > 2 && strcmp(argv[1], "--capture") == 0)
+	{
+		output = argv[2];
+		serial = argc > 3 ? argv[3] : NULL;
+	}
+	bool saved = false;
+
+	//add time to file to avoid replace the same file
+	time_t currtime = time(NULL);
+	tm* p = localtime(&currtime);
+	char filename[_MAX_PATH] = { 0 };
+
+	// The log verbosity level is set here. It is set to the most
+	// verbose value - Trace. If you have any problems working with 
+	// our examples, please do not hesitate to send us this extensive 
+	// information along with your questions. However, if you feel 
+	// comfortable with these Artec Scanning SDK code examples,
+	// we suggest you to set this level to asdk::VerboseLevel_Info.
+	asdk::setOutputLevel(asdk::VerboseLevel_Trace);
+
+	asdk::ErrorCode ec = asdk::ErrorCode_OK;
+
+	TRef<asdk::IScanner> scanner;
+	int result = openScanner(scanner, serial);
+	if (result != 0)
+		return result;
 
 	std::wcout << L"Capturing frame... ";
 
@@ -167,16 +508,13 @@ int main(int argc, char **argv)
 				asdk::Point3F point = pointsNormals[0];
 				ASDK_UNUSED(point);
 				//ʱļֹεʱϴļ
-				sprintf(filename, "%d%02d%02d%02d%02d%02d.obj", p->tm_year + 1900, p->tm_mon + 1, p->tm_mday, p->tm_hour, p->tm_min, p->tm_sec);
+				if (output)
+					snprintf(filename, sizeof(filename), "%s", output);
+				else
+					sprintf(filename, "%d%02d%02d%02d%02d%02d.obj", p->tm_year + 1900, p->tm_mon + 1, p->tm_mday, p->tm_hour, p->tm_min, p->tm_sec);
 				std::wcout << filename << std::endl;
-				char *CStr = filename;
-				size_t len = strlen(CStr) + 1;
-				size_t converted = 0;
-				wchar_t *WStr;
-				WStr = (wchar_t*)malloc(len * sizeof(wchar_t));
-				mbstowcs_s(&converted, WStr, len, CStr, _TRUNCATE);
-
-				ec = asdk::io::Obj::save(WStr, mesh); // save in text format
+				ec = saveMesh(filename, mesh);
+				saved = ec == asdk::ErrorCode_OK;
 				std::wcout << L"Captured mesh saved to disk" << std::endl;
 			}
 			else
@@ -189,5 +527,5 @@ int main(int argc, char **argv)
 
 	scanner = NULL;
 	std::wcout << L"Scanner released" << std::endl;
-	return 0;
+	return output && !saved ? 5 : 0;
 }
@@ -0,0 +1,301 @@
+/**
+\file      LinuxSerial.cpp
+\brief     rosserial Hardware backend for a termios serial port (USB-serial)
+*/
+
+#include "LinuxSerial.h"
+#include <string>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+
+#define DEFAULT_BAUD 57600
+// receive ring, sized to take a full USB-serial driver buffer in one read()
+#define RX_RING_SIZE 8192
+// transmit backlog, large enough for the biggest rosserial frame
+#define TX_BACKLOG_SIZE (64 * 1024 + 16)
+
+using std::string;
+
+
+class LinuxSerialImpl
+{
+
+public:
+
+  LinuxSerialImpl () : fd (-1), baud (DEFAULT_BAUD),
+    rx_head (0), rx_tail (0), tx_len (0)
+  { }
+
+  void setBaud (long b)
+  {
+    baud = b;
+  }
+
+  void init (char *port_name)
+  {
+    // split off the baud rate if given; stable device names such as
+    // /dev/serial/by-path/... contain colons of their own
+    string name (port_name);
+    size_t c = name.find_last_of (':');
+    if (c != string::npos && c + 1 < name.size () &&
+        name.find_first_not_of ("0123456789", c + 1) == string::npos)
+    {
+      baud = atol (name.substr (c + 1).c_str ());
+      name = name.substr (0, c);
+    }
+
+    speed_t speed = baud_constant (baud);
+    if (speed == 0)
+    {
+      std::cerr << "Unsupported baud rate " << baud << std::endl;
+      return;
+    }
+
+    fd = open (name.c_str (), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+    {
+      std::cerr << "Could not open " << name << " (" << strerror (errno) << ")" << std::endl;
+      return;
+    }
+
+    struct termios tio;
+    if (tcgetattr (fd, &tio) < 0)
+    {
+      std::cerr << "Could not read port settings (" << strerror (errno) << ")" << std::endl;
+      close (fd);
+      fd = -1;
+      return;
+    }
+    cfmakeraw (&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    // return whatever the driver holds, never wait for more
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed (&tio, speed);
+    cfsetospeed (&tio, speed);
+    if (tcsetattr (fd, TCSANOW, &tio) < 0)
+    {
+      std::cerr << "Could not configure port (" << strerror (errno) << ")" << std::endl;
+      close (fd);
+      fd = -1;
+      return;
+    }
+    tcflush (fd, TCIOFLUSH);
+  }
+
+  int read ()
+  {
+    if (rx_head == rx_tail)
+    {
+      flush_backlog ();
+      if (!fill ())
+        return -1;
+    }
+    unsigned char data = rx_ring[rx_tail];
+    rx_tail = (rx_tail + 1) % RX_RING_SIZE;
+    return data;
+  }
+
+  void write (const unsigned char *data, int length)
+  {
+    if (fd < 0)
+      return;
+
+    // keep frames in order: nothing goes out directly while a backlog exists
+    flush_backlog ();
+    int written = 0;
+    if (tx_len == 0)
+    {
+      written = ::write (fd, data, length);
+      if (written < 0)
+      {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+          std::cerr << "Write failed (" << strerror (errno) << ")" << std::endl;
+          return;
+        }
+        written = 0;
+      }
+    }
+
+    int rest = length - written;
+    if (rest > 0)
+    {
+      // only ever drop whole frames, a partial one would desync the peer;
+      // a frame that went out in part always fits since the backlog was empty
+      if (tx_len + rest > TX_BACKLOG_SIZE)
+      {
+        std::cerr << "Transmit backlog full, frame dropped" << std::endl;
+        return;
+      }
+      memcpy (tx_backlog + tx_len, data + written, rest);
+      tx_len += rest;
+    }
+  }
+
+  bool wait (unsigned long timeout_ms)
+  {
+    if (rx_head != rx_tail)
+      return true;
+    if (fd < 0)
+    {
+      usleep (timeout_ms * 1000);
+      return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll (&pfd, 1, (int) timeout_ms) > 0;
+  }
+
+  unsigned long time ()
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+  }
+
+  int pending ()
+  {
+    return tx_len;
+  }
+
+protected:
+        /**
+	* Read as much as the driver has buffered into the contiguous free
+	* space of the receive ring.
+	* @returns true if at least one byte was received
+	*/
+  bool fill ()
+  {
+    if (fd < 0)
+      return false;
+
+    // ring is empty here, so restart at the front for the largest read;
+    // one slot stays unused so that a full ring does not look empty
+    rx_head = rx_tail = 0;
+    int result = ::read (fd, rx_ring, RX_RING_SIZE - 1);
+    if (result < 0)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        std::cerr << "Read failed (" << strerror (errno) << ")" << std::endl;
+      }
+      return false;
+    }
+    if (result == 0)
+      return false;
+    rx_head = result;
+    return true;
+  }
+
+        /**
+	* Push as much of the transmit backlog as the driver accepts.
+	*/
+  void flush_backlog ()
+  {
+    if (tx_len == 0 || fd < 0)
+      return;
+    int written = ::write (fd, tx_backlog, tx_len);
+    if (written <= 0)
+      return;
+    memmove (tx_backlog, tx_backlog + written, tx_len - written);
+    tx_len -= written;
+  }
+
+        /**
+	* Map a numeric baud rate onto the termios speed constant.
+	* @returns the constant, or 0 if the rate is not supported
+	*/
+  static speed_t baud_constant (long b)
+  {
+    switch (b)
+    {
+      case 9600: return B9600;
+      case 19200: return B19200;
+      case 38400: return B38400;
+      case 57600: return B57600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+#ifdef B460800
+      case 460800: return B460800;
+#endif
+#ifdef B921600
+      case 921600: return B921600;
+#endif
+#ifdef B1000000
+      case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+      case 2000000: return B2000000;
+#endif
+#ifdef B3000000
+      case 3000000: return B3000000;
+#endif
+#ifdef B4000000
+      case 4000000: return B4000000;
+#endif
+      default: return 0;
+    }
+  }
+
+private:
+  int fd;
+  long baud;
+
+  unsigned char rx_ring[RX_RING_SIZE];
+  int rx_head;
+  int rx_tail;
+
+  unsigned char tx_backlog[TX_BACKLOG_SIZE];
+  int tx_len;
+};
+
+LinuxSerial::LinuxSerial ()
+{
+  impl = new LinuxSerialImpl ();
+}
+
+void LinuxSerial::setBaud (long baud)
+{
+  impl->setBaud (baud);
+}
+
+void LinuxSerial::init (char *port_name)
+{
+  impl->init (port_name);
+}
+
+int LinuxSerial::read ()
+{
+  return impl->read ();
+}
+
+void LinuxSerial::write (const unsigned char *data, int length)
+{
+  impl->write (data, length);
+}
+
+unsigned long LinuxSerial::time ()
+{
+  return impl->time ();
+}
+
+bool LinuxSerial::wait (unsigned long timeout_ms)
+{
+  return impl->wait (timeout_ms);
+}
+
+int LinuxSerial::pending ()
+{
+  return impl->pending ();
+}
@@ -0,0 +1,49 @@
+/**
+\file      LinuxSerial.h
+\brief     rosserial Hardware backend for a termios serial port (USB-serial)
+
+The port is opened raw and non-blocking with VMIN = 0 / VTIME = 0, so a
+read never stalls spinOnce(). Instead of one read() system call per byte,
+the backend drains everything the driver has buffered into a receive ring
+in one call and hands the NodeHandle frame parser single bytes from memory.
+Writes are non-blocking too: what the driver cannot take right away is kept
+in a transmit backlog and pushed out on the next read() or write().
+
+The port name accepts an optional baud rate suffix, "/dev/ttyUSB0:115200";
+otherwise the rate set with setBaud() (default 57600, like rosserial) is
+used.
+*/
+
+#ifndef ROS_LINUX_SERIAL_H_
+#define ROS_LINUX_SERIAL_H_
+
+// forward declaration of the implementation class, see WindowsSocket.h
+class LinuxSerialImpl;
+
+class LinuxSerial
+{
+public:
+  LinuxSerial ();
+
+  /* must be called before init() */
+  void setBaud (long baud);
+
+  void init (char *port_name);
+
+  int read ();
+
+  void write (const unsigned char *data, int length);
+
+  unsigned long time ();
+
+  /* block until data can be read or timeout_ms have passed */
+  bool wait (unsigned long timeout_ms);
+
+  /* bytes still waiting in the transmit backlog */
+  int pending ();
+
+private:
+    LinuxSerialImpl * impl;
+};
+
+#endif
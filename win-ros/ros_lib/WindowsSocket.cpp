@@ -26,11 +26,64 @@ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSI
 #include "WindowsSocket.h"
 #include <string>
 #include <iostream>
+#ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
 #pragma comment(lib, "Ws2_32.lib")
 
+#define SEND_FLAGS 0
+#else
+// the same calls on BSD sockets, for simulated campaigns off Windows
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+typedef int SOCKET;
+typedef unsigned long u_long;
+struct WSADATA { };
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define MAKEWORD(low, high) ((low) | ((high) << 8))
+#define ZeroMemory(p, size) memset ((p), 0, (size))
+#define closesocket close
+// a dropped link must not raise SIGPIPE
+#define SEND_FLAGS MSG_NOSIGNAL
+
+static int WSAStartup (int, WSADATA *) { return 0; }
+static void WSACleanup () { }
+static int WSAGetLastError () { return errno; }
+static void Sleep (unsigned long ms) { usleep (ms * 1000); }
+
+static int ioctlsocket (SOCKET s, long command, u_long *value)
+{
+  int flag = (int) *value;
+  return ioctl (s, command, &flag);
+}
+
+struct SYSTEMTIME { unsigned long wHour, wMinute, wSecond, wMilliseconds; };
+
+static void GetSystemTime (SYSTEMTIME *st)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_REALTIME, &now);
+  struct tm utc;
+  gmtime_r (&now.tv_sec, &utc);
+  st->wHour = utc.tm_hour;
+  st->wMinute = utc.tm_min;
+  st->wSecond = utc.tm_sec;
+  st->wMilliseconds = now.tv_nsec / 1000000;
+}
+#endif
+
 #define DEFAULT_PORT "11411"
 
 using std::string;
@@ -48,6 +101,14 @@ public:
 
   void init (char *server_hostname)
   {
+    // init again to reconnect: let go of the old connection first
+    if (INVALID_SOCKET != mySocket)
+    {
+      closesocket (mySocket);
+      mySocket = INVALID_SOCKET;
+      WSACleanup ();
+    }
+
     WSADATA wsaData;
     int result = WSAStartup (MAKEWORD (2, 2), &wsaData);
     if (result)
@@ -98,15 +159,41 @@ public:
 
   void write (const unsigned char *data, int length)
   {
-    int result = send (mySocket, (const char *) data, length, 0);
+    int result = send (mySocket, (const char *) data, length, SEND_FLAGS);
     if (SOCKET_ERROR == result)
     {
       std::cerr << "Send failed with error " << WSAGetLastError () << std::endl;
       closesocket (mySocket);
+      mySocket = INVALID_SOCKET;
       WSACleanup ();
     }
   }
 
+  bool wait (unsigned long timeout_ms)
+  {
+    if (INVALID_SOCKET == mySocket)
+    {
+      // not connected, nothing to wait for but the timeout
+      Sleep (timeout_ms);
+      return false;
+    }
+    fd_set readable;
+    FD_ZERO (&readable);
+    FD_SET (mySocket, &readable);
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    // the first argument only matters to BSD sockets
+    int result = select ((int) mySocket + 1, &readable, NULL, NULL, &tv);
+    if (SOCKET_ERROR == result)
+    {
+      // no usable socket, still honour the timeout rather than spin
+      Sleep (timeout_ms);
+      return false;
+    }
+    return result > 0;
+  }
+
   unsigned long time ()
   {
     SYSTEMTIME st_now;
@@ -222,3 +309,8 @@ unsigned long WindowsSocket::time ()
 {
   return impl->time ();
 }
+
+bool WindowsSocket::wait (unsigned long timeout_ms)
+{
+  return impl->wait (timeout_ms);
+}
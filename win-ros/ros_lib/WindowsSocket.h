@@ -44,6 +44,9 @@ public:
 
   unsigned long time ();
 
+  /* block until data can be read or timeout_ms have passed */
+  bool wait (unsigned long timeout_ms);
+
 private:
     WindowsSocketImpl * impl;
 };
@@ -0,0 +1,319 @@
+/**
+\file      WindowsUdpSocket.cpp
+\brief     rosserial Hardware backend that carries one frame per UDP datagram
+*/
+
+#include "WindowsUdpSocket.h"
+#include <stdint.h>
+#include <string>
+#include <iostream>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#pragma comment(lib, "Ws2_32.lib")
+
+#define DEFAULT_PORT "11411"
+
+// sequence header in front of every datagram
+#define SEQ_HEADER_SIZE 4
+// largest UDP payload over IPv4
+#define MAX_DATAGRAM_SIZE 65507
+// a jump further back than this means the peer restarted its counter
+#define SEQ_RESTART_WINDOW 1024
+
+using std::string;
+
+
+class WindowsUdpSocketImpl
+{
+
+public:
+
+  WindowsUdpSocketImpl () : mySocket (INVALID_SOCKET),
+    tx_seq (0), rx_seq (0), rx_synced (false),
+    rx_pos (0), rx_len (0),
+    rx_received (0), rx_dropped (0), rx_gaps (0)
+  { }
+
+  void init (char *server_hostname)
+  {
+    WSADATA wsaData;
+    int result = WSAStartup (MAKEWORD (2, 2), &wsaData);
+    if (result)
+    {
+      std::cerr << "Could not initialize windows socket (" << result << ")" << std::endl;
+      return;
+    }
+
+    struct addrinfo *servers = get_server_addr (server_hostname);
+
+    if (NULL == servers)
+    {
+      WSACleanup ();
+      return;
+    }
+
+    connect_to_server (servers);
+
+    freeaddrinfo (servers);
+
+    if (INVALID_SOCKET == mySocket)
+    {
+      std::cerr << "Could not open datagram socket to server" << std::endl;
+      WSACleanup ();
+    }
+  }
+
+  int read ()
+  {
+    while (rx_pos >= rx_len)
+    {
+      if (!receive_datagram ())
+        return -1;
+    }
+    return rx_buffer[rx_pos++];
+  }
+
+  void write (const unsigned char *data, int length)
+  {
+    unsigned char header[SEQ_HEADER_SIZE];
+    uint32_t seq = tx_seq++;
+    header[0] = (unsigned char) (seq & 0xff);
+    header[1] = (unsigned char) ((seq >> 8) & 0xff);
+    header[2] = (unsigned char) ((seq >> 16) & 0xff);
+    header[3] = (unsigned char) ((seq >> 24) & 0xff);
+
+    if (length + SEQ_HEADER_SIZE > MAX_DATAGRAM_SIZE)
+    {
+      std::cerr << "Frame of " << length << " bytes does not fit in a datagram" << std::endl;
+      return;
+    }
+
+    // gather header and frame into one datagram without copying the frame
+    WSABUF buffers[2];
+    buffers[0].buf = (char *) header;
+    buffers[0].len = SEQ_HEADER_SIZE;
+    buffers[1].buf = (char *) data;
+    buffers[1].len = length;
+    DWORD sent = 0;
+    int result = WSASend (mySocket, buffers, 2, &sent, 0, NULL, NULL);
+    if (SOCKET_ERROR == result && WSAEWOULDBLOCK != WSAGetLastError ())
+    {
+      // a lost datagram is the receiver's gap to count, keep the socket
+      std::cerr << "Send failed with error " << WSAGetLastError () << std::endl;
+    }
+  }
+
+  bool wait (unsigned long timeout_ms)
+  {
+    if (rx_pos < rx_len)
+      return true;
+    fd_set readable;
+    FD_ZERO (&readable);
+    FD_SET (mySocket, &readable);
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    int result = select (0, &readable, NULL, NULL, &tv);
+    if (SOCKET_ERROR == result)
+    {
+      // no usable socket, still honour the timeout rather than spin
+      Sleep (timeout_ms);
+      return false;
+    }
+    return result > 0;
+  }
+
+  unsigned long time ()
+  {
+    return GetTickCount ();
+  }
+
+  unsigned long received () { return rx_received; }
+  unsigned long dropped () { return rx_dropped; }
+  unsigned long gaps () { return rx_gaps; }
+
+protected:
+        /**
+	* Pull the next datagram off the socket and run it through the
+	* sequence check. Late and duplicate datagrams are consumed and
+	* dropped, so the caller simply tries again.
+	* @returns true if rx_buffer now holds frame bytes to hand out
+	*/
+  bool receive_datagram ()
+  {
+    int result = recv (mySocket, (char *) rx_buffer, sizeof (rx_buffer), 0);
+    if (result == SOCKET_ERROR)
+    {
+      int error = WSAGetLastError ();
+      // WSAECONNRESET is an ICMP port unreachable from an earlier send
+      if (WSAEWOULDBLOCK != error && WSAECONNRESET != error)
+      {
+        std::cerr << "Failed to receive data from server " << error << std::endl;
+      }
+      return false;
+    }
+    if (result <= SEQ_HEADER_SIZE)
+    {
+      // runt datagram, nothing to parse
+      rx_pos = rx_len = 0;
+      return true;
+    }
+
+    uint32_t seq = (uint32_t) rx_buffer[0] |
+                   ((uint32_t) rx_buffer[1] << 8) |
+                   ((uint32_t) rx_buffer[2] << 16) |
+                   ((uint32_t) rx_buffer[3] << 24);
+
+    if (rx_synced)
+    {
+      int32_t delta = (int32_t) (seq - rx_seq);
+      if (delta <= 0 && delta > -SEQ_RESTART_WINDOW)
+      {
+        rx_dropped++;
+        rx_pos = rx_len = 0;
+        return true;
+      }
+      if (delta > 1)
+        rx_gaps += delta - 1;
+    }
+    rx_synced = true;
+    rx_seq = seq;
+    rx_received++;
+    rx_pos = SEQ_HEADER_SIZE;
+    rx_len = result;
+    return true;
+  }
+
+        /**
+	* Helper to get the addrinfo for the server based on a string hostname.
+	* @param hostname the hostname to send to. Understands "host:port"
+	* @returns pointer to addrinfo from getaddrinfo or NULL on error
+	*/
+  struct addrinfo *get_server_addr (const string & hostname)
+  {
+    int result;
+    struct addrinfo *ai_output = NULL;
+    struct addrinfo ai_input;
+
+    // split off the port number if given
+    int c = hostname.find_last_of (':');
+    string host = hostname.substr (0, c);
+    string port = (c < 0) ? DEFAULT_PORT : hostname.substr (c + 1);
+
+    ZeroMemory (&ai_input, sizeof (ai_input));
+    ai_input.ai_family = AF_UNSPEC;
+    ai_input.ai_socktype = SOCK_DGRAM;
+    ai_input.ai_protocol = IPPROTO_UDP;
+
+    result = getaddrinfo (host.c_str (), port.c_str (), &ai_input, &ai_output);
+    if (result != 0)
+    {
+      std::cerr << "Could not resolve server address (" << result << ")" << std::endl;
+      return NULL;
+    }
+    return ai_output;
+  }
+
+        /**
+	* Helper to bind the datagram socket to the server address, so that
+	* send() has a default destination and recv() only sees that peer.
+	* @param server address of the server, linked list
+	*/
+  void connect_to_server (struct addrinfo *servers)
+  {
+    int result;
+    for (struct addrinfo * ptr = servers; ptr != NULL; ptr = ptr->ai_next)
+    {
+      mySocket = socket (ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+      if (INVALID_SOCKET == mySocket)
+      {
+        std::cerr << "Could not create socket " << WSAGetLastError ();
+        return;
+      }
+
+      result = connect (mySocket, ptr->ai_addr, (int) ptr->ai_addrlen);
+      if (SOCKET_ERROR == result)
+      {
+        closesocket (mySocket);
+        mySocket = INVALID_SOCKET;
+      }
+      else
+      {
+        break;
+      }
+    }
+    if (INVALID_SOCKET == mySocket)
+      return;
+
+    // disable blocking
+    u_long iMode = 1;
+    result = ioctlsocket (mySocket, FIONBIO, &iMode);
+    if (result)
+    {
+      std::cerr << "Could not make socket nonblocking " << result << std::endl;
+      closesocket (mySocket);
+      mySocket = INVALID_SOCKET;
+    }
+  }
+
+private:
+  SOCKET mySocket;
+
+  uint32_t tx_seq;
+  uint32_t rx_seq;
+  bool rx_synced;
+
+  unsigned char rx_buffer[MAX_DATAGRAM_SIZE];
+  int rx_pos;
+  int rx_len;
+
+  unsigned long rx_received;
+  unsigned long rx_dropped;
+  unsigned long rx_gaps;
+};
+
+WindowsUdpSocket::WindowsUdpSocket ()
+{
+  impl = new WindowsUdpSocketImpl ();
+}
+
+void WindowsUdpSocket::init (char *server_hostname)
+{
+  impl->init (server_hostname);
+}
+
+int WindowsUdpSocket::read ()
+{
+  return impl->read ();
+}
+
+void WindowsUdpSocket::write (const unsigned char *data, int length)
+{
+  impl->write (data, length);
+}
+
+unsigned long WindowsUdpSocket::time ()
+{
+  return impl->time ();
+}
+
+bool WindowsUdpSocket::wait (unsigned long timeout_ms)
+{
+  return impl->wait (timeout_ms);
+}
+
+unsigned long WindowsUdpSocket::received ()
+{
+  return impl->received ();
+}
+
+unsigned long WindowsUdpSocket::dropped ()
+{
+  return impl->dropped ();
+}
+
+unsigned long WindowsUdpSocket::gaps ()
+{
+  return impl->gaps ();
+}
@@ -0,0 +1,56 @@
+/**
+\file      WindowsUdpSocket.h
+\brief     rosserial Hardware backend that carries one frame per UDP datagram
+
+Meant for high-rate, freshest-value traffic (JointState, RobotStateRTMsg,
+TF at 125-500 Hz) where TCP head-of-line blocking only adds latency and a
+stale sample is worthless. Every write() from the NodeHandle becomes one
+datagram, prefixed with a 32 bit little-endian sequence number:
+
+  [seq0 seq1 seq2 seq3][0xff ver lenL lenH lenChk topicL topicH ... chk]
+
+On receive, datagrams that are late or duplicated (sequence number not
+newer than the last accepted one) are dropped before they reach the frame
+parser, and holes in the sequence are counted as gaps. A large backwards
+jump is treated as a restart of the peer and resynchronises the counter.
+
+The ROS side needs a matching endpoint speaking the same framing (a
+rosserial UDP relay); the default port is the rosserial TCP port, 11411.
+*/
+
+#ifndef ROS_WINDOWS_UDP_SOCKET_H_
+#define ROS_WINDOWS_UDP_SOCKET_H_
+
+// forward declaration of the implementation class, see WindowsSocket.h
+class WindowsUdpSocketImpl;
+
+class WindowsUdpSocket
+{
+public:
+  WindowsUdpSocket ();
+
+  void init (char *server_hostname);
+
+  int read ();
+
+  void write (const unsigned char *data, int length);
+
+  unsigned long time ();
+
+  /* block until data can be read or timeout_ms have passed */
+  bool wait (unsigned long timeout_ms);
+
+  /* datagrams accepted and handed to the frame parser */
+  unsigned long received ();
+
+  /* datagrams dropped because they were late or duplicated */
+  unsigned long dropped ();
+
+  /* datagrams the peer sent that never arrived */
+  unsigned long gaps ();
+
+private:
+    WindowsUdpSocketImpl * impl;
+};
+
+#endif
@@ -0,0 +1,343 @@
+/*
+ * Action client for rosserial, modelled on actionlib::SimpleActionClient.
+ *
+ * Talks the actionlib wire protocol over five topics below the action
+ * namespace: goal and cancel are published, status, feedback and result
+ * are subscribed. Every goal carries its own goal id, so status, feedback
+ * and result messages that belong to other clients of the same server,
+ * or to an earlier goal of this one, are ignored.
+ *
+ * The client tracks one goal at a time: sending a new goal stops tracking
+ * the previous one (it is not cancelled). A goal that was tracked in the
+ * server status and disappears from it before it reached a terminal state
+ * is reported as LOST, the same way actionlib does.
+ *
+ * Usage, e.g. for MoveIt:
+ *
+ *   actionlib::SimpleActionClient<moveit_msgs::MoveGroupAction> move("move_group");
+ *   move.registerWith(nh);
+ *   move.waitForServer(5000);
+ *   move.sendGoal(goal);
+ *   if( move.waitForResult(60000) && move.getState() == actionlib_msgs::GoalStatus::SUCCEEDED )
+ *     ...
+ *
+ * Results can be large (MoveGroupResult carries the planned and executed
+ * trajectories), so the node handle needs an INPUT_SIZE to match.
+ */
+
+#ifndef _ROS_ACTIONLIB_SIMPLE_ACTION_CLIENT_H_
+#define _ROS_ACTIONLIB_SIMPLE_ACTION_CLIENT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "ros/node_handle.h"
+#include "actionlib_msgs/GoalID.h"
+#include "actionlib_msgs/GoalStatus.h"
+#include "actionlib_msgs/GoalStatusArray.h"
+
+/* longest waitForResult() and waitForServer() park between spins, in milliseconds */
+#define ACTION_WAIT_SLICE 20
+/* how long a terminal status may go without its result, in milliseconds */
+#define ACTION_RESULT_GRACE 2000
+
+namespace actionlib {
+
+  using actionlib_msgs::GoalStatus;
+
+  template<typename ActionSpec>
+  class SimpleActionClient
+  {
+    public:
+      typedef decltype(((ActionSpec*)0)->action_goal) ActionGoal;
+      typedef decltype(((ActionSpec*)0)->action_result) ActionResult;
+      typedef decltype(((ActionSpec*)0)->action_feedback) ActionFeedback;
+      typedef decltype(((ActionGoal*)0)->goal) Goal;
+      typedef decltype(((ActionResult*)0)->result) Result;
+      typedef decltype(((ActionFeedback*)0)->feedback) Feedback;
+
+      typedef void(*DoneCallback)(uint8_t state, const Result & result);
+      typedef void(*ActiveCallback)();
+      typedef void(*FeedbackCallback)(const Feedback & feedback);
+
+      SimpleActionClient(const char * name) :
+        goal_topic_(std::string(name) + "/goal"),
+        cancel_topic_(std::string(name) + "/cancel"),
+        status_topic_(std::string(name) + "/status"),
+        feedback_topic_(std::string(name) + "/feedback"),
+        result_topic_(std::string(name) + "/result"),
+        goal_pub_(goal_topic_.c_str(), &action_goal_),
+        cancel_pub_(cancel_topic_.c_str(), &cancel_),
+        status_sub_(status_topic_.c_str(), &SimpleActionClient::statusCallback, this),
+        feedback_sub_(feedback_topic_.c_str(), &SimpleActionClient::feedbackCallback, this),
+        result_sub_(result_topic_.c_str(), this),
+        nh_(0),
+        goals_sent_(0),
+        server_seen_(false),
+        tracking_(false),
+        seen_in_status_(false),
+        terminal_seen_(false),
+        terminal_since_(0),
+        done_(false),
+        state_(GoalStatus::LOST),
+        done_cb_(0),
+        active_cb_(0),
+        feedback_cb_(0)
+      {
+        goal_id_[0] = '\0';
+        snprintf(id_prefix_, sizeof(id_prefix_), "%s", name);
+      }
+
+      /* Advertise and subscribe the action topics on a node handle */
+      template<typename NodeHandleT>
+      bool registerWith(NodeHandleT & nh){
+        nh_ = &nh;
+        return nh.advertise(goal_pub_) && nh.advertise(cancel_pub_) &&
+               nh.subscribe(status_sub_) && nh.subscribe(feedback_sub_) &&
+               nh.subscribe(result_sub_);
+      }
+
+      /* Spin until connected and the server has published its status.
+       * timeout_ms = 0 waits forever. */
+      bool waitForServer(uint32_t timeout_ms = 0){
+        return spinUntil(&SimpleActionClient::serverReady, timeout_ms);
+      }
+
+      bool isServerConnected(){ return nh_ && nh_->connected() && server_seen_; }
+
+      /* Send a goal and start tracking it. Returns false when the link is
+       * down, in which case nothing is tracked. */
+      bool sendGoal(const Goal & goal, DoneCallback done_cb = 0,
+                    ActiveCallback active_cb = 0, FeedbackCallback feedback_cb = 0){
+        tracking_ = false;
+        if( !nh_ || !nh_->connected() )
+          return false;
+
+        uint32_t now = nh_->time();
+        snprintf(goal_id_, sizeof(goal_id_), "%s-%lu-%lu", id_prefix_,
+                 (unsigned long) now, (unsigned long) ++goals_sent_);
+        action_goal_.goal_id.id = goal_id_;
+        action_goal_.goal_id.stamp = ros::Time();   /* the server stamps it */
+        action_goal_.goal = goal;
+        if( goal_pub_.publish(&action_goal_) <= 0 )
+          return false;
+        nh_->flush();
+
+        done_cb_ = done_cb;
+        active_cb_ = active_cb;
+        feedback_cb_ = feedback_cb;
+        state_ = GoalStatus::PENDING;
+        seen_in_status_ = false;
+        terminal_seen_ = false;
+        done_ = false;
+        result_raw_.clear();
+        tracking_ = true;
+        return true;
+      }
+
+      /* Ask the server to cancel the tracked goal */
+      void cancelGoal(){
+        if( !tracking_ || !nh_ || !nh_->connected() )
+          return;
+        cancel_.id = goal_id_;
+        cancel_.stamp = ros::Time();
+        cancel_pub_.publish(&cancel_);
+        nh_->flush();
+      }
+
+      /* Ask the server to cancel every goal, from any client */
+      void cancelAllGoals(){
+        if( !nh_ || !nh_->connected() )
+          return;
+        cancel_.id = "";
+        cancel_.stamp = ros::Time();
+        cancel_pub_.publish(&cancel_);
+        nh_->flush();
+      }
+
+      /* Stop tracking the goal without cancelling it */
+      void stopTrackingGoal(){ tracking_ = false; }
+
+      /* Spin until the tracked goal reached a terminal state and its
+       * result arrived. timeout_ms = 0 waits forever. Returns false on
+       * timeout or when no goal is tracked. */
+      bool waitForResult(uint32_t timeout_ms = 0){
+        if( !tracking_ )
+          return false;
+        return spinUntil(&SimpleActionClient::isDone, timeout_ms);
+      }
+
+      /* GoalStatus value of the tracked goal, LOST if none is tracked */
+      uint8_t getState(){ return tracking_ ? state_ : (uint8_t) GoalStatus::LOST; }
+
+      bool isDone(){ return tracking_ && done_; }
+
+      const char * getGoalId(){ return goal_id_; }
+
+      /* The result of the tracked goal, valid until the next goal is sent.
+       * Empty if the goal finished without its result arriving. */
+      const Result & getResult(){
+        return result_raw_.empty() ? no_result_.result : action_result_.result;
+      }
+
+    private:
+      /* The result subscriber keeps a copy of the serialized message, since
+       * the receive buffer is reused long before the caller reads it.
+       * deserialize() rewrites strings in place, so the copy is taken first. */
+      class ResultSubscriber : public ros::Subscriber_ {
+        public:
+          ResultSubscriber(const char * topic_name, SimpleActionClient * client) : client_(client) {
+            topic_ = topic_name;
+          }
+          virtual void receive(unsigned char * data, int length){
+            raw.assign(data, data + length);
+            callback(data);
+          }
+          virtual void callback(unsigned char * data){
+            msg.deserialize(data);
+            client_->resultCallback(msg, raw);
+          }
+          virtual const char * getMsgType(){ return msg.getType(); }
+          virtual const char * getMsgMD5(){ return msg.getMD5(); }
+          virtual int getEndpointType(){ return rosserial_msgs::TopicInfo::ID_SUBSCRIBER; }
+
+          ActionResult msg;
+          std::vector<unsigned char> raw;
+
+        private:
+          SimpleActionClient * client_;
+      };
+
+      static bool terminal(uint8_t state){
+        return state == GoalStatus::PREEMPTED || state == GoalStatus::SUCCEEDED ||
+               state == GoalStatus::ABORTED || state == GoalStatus::REJECTED ||
+               state == GoalStatus::RECALLED || state == GoalStatus::LOST;
+      }
+
+      bool ours(const actionlib_msgs::GoalID & id){
+        return tracking_ && id.id && strcmp(id.id, goal_id_) == 0;
+      }
+
+      void setState(uint8_t state){
+        if( state == state_ )
+          return;
+        uint8_t previous = state_;
+        state_ = state;
+        if( state == GoalStatus::ACTIVE && previous == GoalStatus::PENDING && active_cb_ )
+          active_cb_();
+      }
+
+      void finish(){
+        done_ = true;
+        if( done_cb_ )
+          done_cb_(state_, getResult());
+      }
+
+      void statusCallback(const actionlib_msgs::GoalStatusArray & status){
+        server_seen_ = true;
+        if( !tracking_ || done_ )
+          return;
+        for(int i = 0; i < status.status_list_length; i++){
+          if( !ours(status.status_list[i].goal_id) )
+            continue;
+          seen_in_status_ = true;
+          uint8_t state = status.status_list[i].status;
+          if( !terminal(state) ){
+            setState(state);
+            return;
+          }
+          /* a terminal state is final once the result is in; if the result
+           * never comes (e.g. too large for the input buffer), give up
+           * waiting for it after a grace period */
+          if( state_ == GoalStatus::PENDING )
+            setState(GoalStatus::ACTIVE);
+          uint32_t now = nh_->time();
+          if( !terminal_seen_ ){
+            terminal_seen_ = true;
+            terminal_since_ = now;
+          }else if( (uint32_t)(now - terminal_since_) >= ACTION_RESULT_GRACE ){
+            state_ = state;
+            finish();
+          }
+          return;
+        }
+        if( seen_in_status_ && !terminal(state_) ){
+          state_ = GoalStatus::LOST;
+          finish();
+        }
+      }
+
+      void feedbackCallback(const ActionFeedback & feedback){
+        if( !ours(feedback.status.goal_id) || done_ )
+          return;
+        setState(feedback.status.status);
+        if( feedback_cb_ )
+          feedback_cb_(feedback.feedback);
+      }
+
+      void resultCallback(const ActionResult & result, std::vector<unsigned char> & raw){
+        if( !ours(result.status.goal_id) || done_ )
+          return;
+        result_raw_.swap(raw);
+        action_result_.deserialize(&result_raw_[0]);
+        setState(result.status.status);
+        finish();
+      }
+
+      bool serverReady(){ return isServerConnected(); }
+
+      bool spinUntil(bool (SimpleActionClient::*condition)(), uint32_t timeout_ms){
+        if( !nh_ )
+          return false;
+        uint32_t start = nh_->time();
+        while( true ){
+          nh_->spinOnce();
+          if( (this->*condition)() )
+            return true;
+          if( timeout_ms > 0 && (uint32_t)(nh_->time() - start) >= timeout_ms )
+            return false;
+          nh_->wait(ACTION_WAIT_SLICE);
+        }
+      }
+
+      std::string goal_topic_;
+      std::string cancel_topic_;
+      std::string status_topic_;
+      std::string feedback_topic_;
+      std::string result_topic_;
+
+      ActionGoal action_goal_;
+      ActionResult action_result_;
+      ActionResult no_result_;
+      actionlib_msgs::GoalID cancel_;
+
+      ros::Publisher goal_pub_;
+      ros::Publisher cancel_pub_;
+      ros::Subscriber<actionlib_msgs::GoalStatusArray, SimpleActionClient> status_sub_;
+      ros::Subscriber<ActionFeedback, SimpleActionClient> feedback_sub_;
+      ResultSubscriber result_sub_;
+
+      ros::NodeHandleBase_ * nh_;
+      char id_prefix_[32];
+      char goal_id_[64];
+      unsigned long goals_sent_;
+      bool server_seen_;
+      bool tracking_;
+      bool seen_in_status_;
+      bool terminal_seen_;
+      uint32_t terminal_since_;
+      bool done_;
+      uint8_t state_;
+      std::vector<unsigned char> result_raw_;
+
+      DoneCallback done_cb_;
+      ActiveCallback active_cb_;
+      FeedbackCallback feedback_cb_;
+  };
+
+}
+
+#endif
@@ -27,11 +27,17 @@ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSI
 #define _ROS_H_
 
 #include "WindowsSocket.h"
+#include "WindowsUdpSocket.h"
+#include "LinuxSerial.h"
 #include "ros/node_handle.h"
 
 namespace ros
 {
 typedef NodeHandle_<WindowsSocket> NodeHandle;
+// freshest-value traffic: late/duplicate frames are dropped, not retried
+typedef NodeHandle_<WindowsUdpSocket> UdpNodeHandle;
+// USB-serial link to the controller, build LinuxSerial.cpp on Linux only
+typedef NodeHandle_<LinuxSerial> SerialNodeHandle;
 }
 
 #endif
@@ -36,6 +36,13 @@
 #define ROS_NODE_HANDLE_H_
 
 #include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "std_msgs/Time.h"
 #include "rosserial_msgs/TopicInfo.h"
@@ -68,6 +75,9 @@
 
 #define MSG_TIMEOUT 20  //20 milliseconds to recieve all of message data
 
+#define PARAM_TIMEOUT 1000    //milliseconds without a parameter answer before giving up
+#define PARAM_WAIT_SLICE 20   //longest getParam() parks between spins
+
 #include "msg.h"
 
 namespace ros {
@@ -75,8 +85,12 @@ namespace ros {
   class NodeHandleBase_{
     public:
       virtual int publish(int id, const Msg* msg)=0;
+      virtual int publishSerialized(int id, const uint8_t* data, int length)=0;
       virtual int spinOnce()=0;
       virtual bool connected()=0;
+      virtual unsigned long time()=0;
+      virtual void flush()=0;
+      virtual void wait(uint32_t timeout_ms)=0;
     };
 }
 
@@ -109,6 +123,17 @@ namespace ros {
       uint8_t message_in[INPUT_SIZE];
       uint8_t message_out[OUTPUT_SIZE];
 
+      /* frames waiting to go out together, see setCoalescing() */
+      uint8_t message_batch[OUTPUT_SIZE];
+      int batch_length_;
+      uint32_t batch_start_;
+      uint32_t coalesce_window_;
+      int coalesce_bytes_;
+
+      /* link statistics: frames framed and hardware writes issued */
+      unsigned long frames_sent_;
+      unsigned long writes_;
+
       Publisher * publishers[MAX_PUBLISHERS];
       Subscriber_ * subscribers[MAX_SUBSCRIBERS];
 
@@ -116,7 +141,10 @@ namespace ros {
        * Setup Functions
        */
     public:
-      NodeHandle_() : configured_(false) {
+      NodeHandle_() : batch_length_(0), batch_start_(0),
+                      coalesce_window_(0), coalesce_bytes_(OUTPUT_SIZE),
+                      frames_sent_(0), writes_(0),
+                      configured_(false) {
 
         for(unsigned int i=0; i< MAX_PUBLISHERS; i++)
 	   publishers[i] = 0;
@@ -136,6 +164,8 @@ namespace ros {
         req_param_resp.floats = NULL;
         req_param_resp.ints_length = 0;
         req_param_resp.ints = NULL;
+        param_activity_ = 0;
+        param_batch_ = false;
       }
 
       Hardware* getHardware(){
@@ -261,12 +291,12 @@ namespace ros {
                 syncTime(message_in);
               }else if (topic_ == TopicInfo::ID_PARAMETER_REQUEST){
                   req_param_resp.deserialize(message_in);
-                  param_recieved= true;
+                  receiveParam();
               }else if(topic_ == TopicInfo::ID_TX_STOP){
                   configured_ = false;
               }else{
                 if(subscribers[topic_-100])
-                  subscribers[topic_-100]->callback( message_in );
+                  subscribers[topic_-100]->receive( message_in, index_ );
               }
             }
           }
@@ -278,6 +308,21 @@ namespace ros {
           last_sync_time = c_time;
         }
 
+        /* give up on parameter answers that stopped coming */
+        expireParams(c_time);
+
+        /* send a coalesced batch whose window has expired */
+        if( batch_length_ > 0 && (hardware_.time() - batch_start_) >= coalesce_window_ )
+          flush();
+
+        /* run queued callbacks and drain queued publishers */
+        for(int i = 0; i < MAX_SUBSCRIBERS; i++)
+          if(subscribers[i])
+            subscribers[i]->dispatch();
+        for(int i = 0; i < MAX_PUBLISHERS; i++)
+          if(publishers[i])
+            publishers[i]->spin(c_time);
+
         return 0;
       }
 
@@ -287,6 +332,18 @@ namespace ros {
         return configured_;
       };
 
+      /* Milliseconds from the hardware clock */
+      virtual unsigned long time() {
+        return hardware_.time();
+      };
+
+      /* Park until the hardware has data or timeout_ms have passed, instead
+       * of burning a core in a spinOnce() loop. Pending output goes first. */
+      virtual void wait(uint32_t timeout_ms) {
+        flush();
+        hardware_.wait(timeout_ms);
+      };
+
       /********************************************************************
        * Time functions
        */
@@ -341,6 +398,7 @@ namespace ros {
             publishers[i] = &p;
             p.id_ = i+100+MAX_SUBSCRIBERS;
             p.nh_ = this;
+            p.reserve(OUTPUT_SIZE);
             return true;
           }
         }
@@ -348,8 +406,8 @@ namespace ros {
       }
 
       /* Register a new subscriber */
-      template<typename MsgT>
-      bool subscribe(Subscriber< MsgT> & s){
+      template<typename SubscriberT>
+      bool subscribe(SubscriberT & s){
         for(int i = 0; i < MAX_SUBSCRIBERS; i++){
           if(subscribers[i] == 0){ // empty slot
             subscribers[i] = (Subscriber_*) &s;
@@ -417,6 +475,19 @@ namespace ros {
           }
         }
         configured_ = true;
+
+        /* the bridge started over: cached parameters may be stale */
+        invalidateParams();
+        prefetchParams();
+
+        for(i = 0; i < MAX_SUBSCRIBERS; i++)
+          if(subscribers[i] != 0)
+            subscribers[i]->negotiated();
+
+        /* latched topics get their last value on every (re)connect */
+        for(i = 0; i < MAX_PUBLISHERS; i++)
+          if(publishers[i] != 0)
+            publishers[i]->relatch();
       }
 
       virtual int publish(int id, const Msg * msg)
@@ -427,6 +498,30 @@ namespace ros {
         /* serialize message */
         uint16_t l = msg->serialize(message_out+7);
 
+        return writeFrame(id, l);
+      }
+
+      /* Publish a message that was serialized earlier, e.g. by a queued
+       * or latched Publisher */
+      virtual int publishSerialized(int id, const uint8_t * data, int length)
+      {
+        if(id >= 100 && !configured_)
+          return 0;
+
+        if( length + 8 > OUTPUT_SIZE ){
+          logerror("Message from device dropped: message larger than buffer.");
+          return -1;
+        }
+        memcpy(message_out+7, data, length);
+
+        return writeFrame(id, (uint16_t)length);
+      }
+
+    private:
+      /* Put header and checksum around the l bytes of payload that are
+       * already in message_out+7, and send the frame */
+      int writeFrame(int id, uint16_t l)
+      {
         /* setup the header */
         message_out[0] = 0xff;
         message_out[1] = PROTOCOL_VER;
@@ -444,7 +539,23 @@ namespace ros {
         message_out[l++] = 255 - (chk%256);
 
         if( l <= OUTPUT_SIZE ){
-          hardware_.write(message_out, l);
+          frames_sent_++;
+          /* system frames (time sync, topic negotiation, logging) and
+           * anything too big to share a write go out right away */
+          if( coalesce_window_ == 0 || id < 100 || l > coalesce_bytes_ ){
+            flush();
+            hardware_.write(message_out, l);
+            writes_++;
+            return l;
+          }
+          if( batch_length_ + l > coalesce_bytes_ )
+            flush();
+          if( batch_length_ == 0 )
+            batch_start_ = hardware_.time();
+          memcpy(message_batch + batch_length_, message_out, l);
+          batch_length_ += l;
+          if( batch_length_ == coalesce_bytes_ )
+            flush();
           return l;
         }else{
           logerror("Message from device dropped: message larger than buffer.");
@@ -452,6 +563,36 @@ namespace ros {
         }
       }
 
+    public:
+
+      /********************************************************************
+       * Small-frame coalescing
+       */
+
+      /* Opt in to coalescing: topic frames published within window_ms of
+       * the first one in a batch, or until max_bytes are collected, go to
+       * the hardware in a single write. A window of 0 turns it off and
+       * every frame is written on its own (the default). */
+      void setCoalescing(uint32_t window_ms, int max_bytes = OUTPUT_SIZE)
+      {
+        flush();
+        coalesce_window_ = window_ms;
+        coalesce_bytes_ = (max_bytes > 0 && max_bytes < OUTPUT_SIZE) ? max_bytes : OUTPUT_SIZE;
+      }
+
+      /* Write out the pending batch now, for latency-critical topics */
+      virtual void flush()
+      {
+        if( batch_length_ == 0 )
+          return;
+        hardware_.write(message_batch, batch_length_);
+        writes_++;
+        batch_length_ = 0;
+      }
+
+      unsigned long getFramesSent(){ return frames_sent_; }
+      unsigned long getWrites(){ return writes_; }
+
       /********************************************************************
        * Logging
        */
@@ -486,53 +627,155 @@ namespace ros {
        */
 
     private:
-      bool param_recieved;
+      /* deep copy of one parameter server answer */
+      struct CachedParam {
+        std::vector<int32_t> ints;
+        std::vector<float> floats;
+        std::vector<std::string> strings;
+      };
+
       rosserial_msgs::RequestParamResponse req_param_resp;
+      std::map<std::string, CachedParam> param_cache_;
+      std::deque<std::string> param_pending_;   /* asked for, in order */
+      std::map<std::string, CachedParam> param_batch_answers_;  /* of a prefetch so far */
+      std::vector<std::string> param_declared_;
+      uint32_t param_activity_;                 /* last request or answer */
+      bool param_batch_;                        /* pending came from a prefetch */
+
+      /* Answers carry no name; the bridge answers in request order. The
+       * bridge does not answer names it does not know, which shifts every
+       * later answer, so the answers of a prefetch are held aside and only
+       * cached once every name of it has been answered. */
+      void receiveParam(){
+        if( param_pending_.empty() )
+          return;                               /* stray answer to a request we gave up on */
+        CachedParam & p = param_batch_ ? param_batch_answers_[param_pending_.front()]
+                                       : param_cache_[param_pending_.front()];
+        p.ints.assign(req_param_resp.ints, req_param_resp.ints + req_param_resp.ints_length);
+        p.floats.assign(req_param_resp.floats, req_param_resp.floats + req_param_resp.floats_length);
+        p.strings.assign(req_param_resp.strings, req_param_resp.strings + req_param_resp.strings_length);
+        param_pending_.pop_front();
+        param_activity_ = hardware_.time();
+        if( param_batch_ && param_pending_.empty() ){
+          typename std::map<std::string, CachedParam>::iterator it;
+          for( it = param_batch_answers_.begin(); it != param_batch_answers_.end(); ++it ){
+            CachedParam & cached = param_cache_[it->first];
+            cached.ints.swap(it->second.ints);
+            cached.floats.swap(it->second.floats);
+            cached.strings.swap(it->second.strings);
+          }
+          param_batch_answers_.clear();
+          param_batch_ = false;
+        }
+      }
+
+      /* If answers stop coming, the request is given up; of a prefetch,
+       * nothing received can be trusted and each name is fetched on its
+       * own instead. */
+      void expireParams(uint32_t c_time){
+        if( param_pending_.empty() || (uint32_t)(c_time - param_activity_) < PARAM_TIMEOUT )
+          return;
+        param_batch_answers_.clear();
+        param_pending_.clear();
+        param_batch_ = false;
+      }
 
-      bool requestParam(const char * name, int time_out =  1000){
-        param_recieved = false;
+      void sendParamRequest(const char * name){
         rosserial_msgs::RequestParamRequest req;
         req.name  = (char*)name;
         publish(TopicInfo::ID_PARAMETER_REQUEST, &req);
-        uint16_t end_time = hardware_.time() + time_out;
-        while(!param_recieved ){
+        param_pending_.push_back(name);
+        param_activity_ = hardware_.time();
+      }
+
+      /* A prefetch in flight has the bridge's answers lined up, so a
+       * request of its own is only sent once the prefetch is cached or
+       * given up; time_out counts from then. */
+      const CachedParam * requestParam(const char * name, int time_out =  1000){
+        bool asked = false;
+        uint32_t start = 0;
+        while( true ){
+          typename std::map<std::string, CachedParam>::iterator it = param_cache_.find(name);
+          if( it != param_cache_.end() )
+            return &it->second;
+          if( !asked && !param_batch_ ){
+            param_pending_.clear();             /* an abandoned single request */
+            sendParamRequest(name);
+            asked = true;
+            start = hardware_.time();
+          }
+          if( asked && (uint32_t)(hardware_.time() - start) >= (uint32_t)time_out )
+            break;
+          wait(PARAM_WAIT_SLICE);
           spinOnce();
-          if (hardware_.time() > end_time) return false;
         }
-        return true;
+        if( !param_batch_ )
+          param_pending_.clear();               /* a late answer must not land on the next name */
+        return NULL;
       }
 
     public:
+      /* Parameters to fetch in one pipelined batch on every (re)connect.
+       * Later getParam() calls for them are served from the cache. The
+       * names should exist on the parameter server; if one does not, the
+       * batch is discarded and each name is fetched on its own instead. */
+      void declareParams(const char * const * names, int count){
+        for(int i = 0; i < count; i++)
+          param_declared_.push_back(names[i]);
+        if( configured_ )
+          prefetchParams();
+      }
+
+      /* Send requests for all declared parameters not cached yet */
+      void prefetchParams(){
+        if( !param_pending_.empty() && !param_batch_ )
+          param_pending_.clear();
+        param_batch_ = true;
+        for(size_t i = 0; i < param_declared_.size(); i++){
+          const std::string & name = param_declared_[i];
+          if( param_cache_.count(name) == 0 &&
+              std::find(param_pending_.begin(), param_pending_.end(), name) == param_pending_.end() )
+            sendParamRequest(name.c_str());
+        }
+        if( param_pending_.empty() )
+          param_batch_ = false;
+      }
+
+      /* Forget all cached values, e.g. after changing them on the server */
+      void invalidateParams(){
+        param_cache_.clear();
+        param_batch_answers_.clear();
+        param_pending_.clear();
+        param_batch_ = false;
+      }
+
       bool getParam(const char* name, int* param, int length =1){
-        if (requestParam(name) ){
-          if (length == req_param_resp.ints_length){
-            //copy it over
-            for(int i=0; i<length; i++)
-              param[i] = req_param_resp.ints[i];
-            return true;
-          }
+        const CachedParam * p = requestParam(name);
+        if( p && length == (int)p->ints.size() ){
+          //copy it over
+          for(int i=0; i<length; i++)
+            param[i] = p->ints[i];
+          return true;
         }
         return false;
       }
       bool getParam(const char* name, float* param, int length=1){
-        if (requestParam(name) ){
-          if (length == req_param_resp.floats_length){
-            //copy it over
-            for(int i=0; i<length; i++)
-              param[i] = req_param_resp.floats[i];
-            return true;
-          }
+        const CachedParam * p = requestParam(name);
+        if( p && length == (int)p->floats.size() ){
+          //copy it over
+          for(int i=0; i<length; i++)
+            param[i] = p->floats[i];
+          return true;
         }
         return false;
       }
       bool getParam(const char* name, char** param, int length=1){
-        if (requestParam(name) ){
-          if (length == req_param_resp.strings_length){
-            //copy it over
-            for(int i=0; i<length; i++)
-              strcpy(param[i],req_param_resp.strings[i]);
-            return true;
-          }
+        const CachedParam * p = requestParam(name);
+        if( p && length == (int)p->strings.size() ){
+          //copy it over
+          for(int i=0; i<length; i++)
+            strcpy(param[i], p->strings[i].c_str());
+          return true;
         }
         return false;
       }
@@ -35,8 +35,12 @@
 #ifndef _ROS_PUBLISHER_H_
 #define _ROS_PUBLISHER_H_
 
+#include <string.h>
+#include <vector>
+
 #include "rosserial_msgs/TopicInfo.h"
 #include "node_handle.h"
+#include "qos.h"
 
 namespace ros {
 
@@ -47,11 +51,91 @@ namespace ros {
       Publisher( const char * topic_name, Msg * msg, int endpoint=rosserial_msgs::TopicInfo::ID_PUBLISHER) :
         topic_(topic_name), 
         msg_(msg),
-        endpoint_(endpoint) {};
+        endpoint_(endpoint),
+        buffer_size_(0),
+        head_(0),
+        count_(0),
+        dropped_(0),
+        latched_length_(0),
+        last_sent_(0),
+        sent_once_(false) {};
+
+      /* Set the quality of service for this topic, see qos.h */
+      void setQoS( const QoS & qos ){
+        qos_ = qos;
+        if( qos_.min_period > 0 && qos_.depth < 1 )
+          qos_.depth = 1;     /* rate limiting needs somewhere to park messages */
+        head_ = count_ = 0;
+        allocate();
+      }
+      const QoS & getQoS() const { return qos_; }
+
+      int publish( const Msg * msg ){
+        if( qos_.depth == 0 && !qos_.latch )
+          return nh_->publish(id_, msg);
 
-      int publish( const Msg * msg ) { return nh_->publish(id_, msg); };
+        uint8_t * data;
+        if( qos_.depth > 0 ){
+          int slot;
+          if( count_ == qos_.depth ){       /* keep last: overwrite the oldest */
+            slot = head_;
+            head_ = (head_ + 1) % qos_.depth;
+            dropped_++;
+          }else{
+            slot = (head_ + count_) % qos_.depth;
+            count_++;
+          }
+          data = &queue_[slot * buffer_size_];
+          lengths_[slot] = msg->serialize(data);
+          if( qos_.latch ){
+            latched_length_ = lengths_[slot];
+            memcpy(&latched_[0], data, latched_length_);
+          }
+          spin(nh_->time());
+          return lengths_[slot];
+        }
+
+        latched_length_ = msg->serialize(&latched_[0]);
+        return nh_->publishSerialized(id_, &latched_[0], latched_length_);
+      };
       int getEndpointType(){ return endpoint_; }
 
+      /* Push out a coalesced batch holding this topic right away */
+      void flush(){ nh_->flush(); }
+
+      /* Messages lost to the keep-last queue since start */
+      unsigned long getDropped(){ return dropped_; }
+
+      /* Called by the NodeHandle when advertising, buffer_size is the
+       * largest serialized message it can frame. */
+      void reserve( int buffer_size ){
+        buffer_size_ = buffer_size;
+        allocate();
+      }
+
+      /* Called by the NodeHandle from spinOnce(), sends what the queue
+       * and rate limit allow. A publisher holding messages of its own
+       * may send them here too. */
+      virtual void spin( uint32_t now ){
+        while( count_ > 0 && nh_->connected() ){
+          if( qos_.min_period > 0 && sent_once_ && (now - last_sent_) < qos_.min_period )
+            return;
+          nh_->publishSerialized(id_, &queue_[head_ * buffer_size_], lengths_[head_]);
+          head_ = (head_ + 1) % qos_.depth;
+          count_--;
+          last_sent_ = now;
+          sent_once_ = true;
+        }
+      }
+
+      /* Called by the NodeHandle after the topics were negotiated. A
+       * message still queued is newer than or equal to the latched one,
+       * so the latched value only goes out when the queue is empty. */
+      void relatch(){
+        if( qos_.latch && latched_length_ > 0 && count_ == 0 )
+          nh_->publishSerialized(id_, &latched_[0], latched_length_);
+      }
+
       const char * topic_;
       Msg *msg_;
       // id_ and no_ are set by NodeHandle when we advertise 
@@ -59,7 +143,28 @@ namespace ros {
       NodeHandleBase_* nh_;
 
     private:
+      void allocate(){
+        if( buffer_size_ == 0 )
+          return;
+        queue_.resize(qos_.depth * buffer_size_);
+        lengths_.resize(qos_.depth);
+        if( qos_.latch )
+          latched_.resize(buffer_size_);
+      }
+
       int endpoint_;
+
+      QoS qos_;
+      int buffer_size_;
+      std::vector<uint8_t> queue_;
+      std::vector<int> lengths_;
+      int head_;
+      int count_;
+      unsigned long dropped_;
+      std::vector<uint8_t> latched_;
+      int latched_length_;
+      uint32_t last_sent_;
+      bool sent_once_;
   };
 
 }
@@ -0,0 +1,38 @@
+/*
+ * Per-topic quality of service for rosserial publishers and subscribers.
+ *
+ * By default a Publisher writes every message straight to the link and a
+ * Subscriber runs its callback on the receive buffer, which keeps the
+ * original rosserial behaviour. Setting a QoS on a topic turns on:
+ *
+ *  - depth:      a keep-last-N queue of serialized messages. A burst larger
+ *                than the queue drops the oldest entries instead of flooding
+ *                the link (publisher) or overwriting a message while its
+ *                callback still runs (subscriber).
+ *  - latch:      publishers only. The last published value is kept and sent
+ *                again every time the topics are (re)negotiated, so a single
+ *                publish() survives a connect or reconnect.
+ *  - min_period: publishers only. Minimum time in milliseconds between two
+ *                messages on the link; what is published faster is queued
+ *                and thinned out to the newest entries.
+ */
+
+#ifndef _ROS_QOS_H_
+#define _ROS_QOS_H_
+
+#include <stdint.h>
+
+namespace ros {
+
+  struct QoS
+  {
+    QoS() : depth(0), latch(false), min_period(0) {}
+
+    int depth;
+    bool latch;
+    uint32_t min_period;
+  };
+
+}
+
+#endif
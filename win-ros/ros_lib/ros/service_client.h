@@ -35,37 +35,149 @@
 #ifndef _ROS_SERVICE_CLIENT_H_
 #define _ROS_SERVICE_CLIENT_H_
 
+#include <stdint.h>
+
 #include "rosserial_msgs/TopicInfo.h"
 
 #include "publisher.h"
 #include "subscriber.h"
 
+/* default deadline for a blocking call(), in milliseconds */
+#define SERVICE_CALL_TIMEOUT 10000
+/* longest a waiting call parks before spinning again, in milliseconds */
+#define SERVICE_WAIT_SLICE  20
+/* quiet time after which the calls of an out of step line are given up
+ * for lost, in milliseconds */
+#define SERVICE_DRAIN_TIMEOUT 1000
+
 namespace ros {
 
-  template<typename MReq , typename MRes>
+  /* Outcome of a service call */
+  enum CallStatus {
+    CALL_PENDING,     /* request sent, waiting for the response */
+    CALL_SUCCEEDED,   /* response received */
+    CALL_TIMED_OUT,   /* deadline passed before the response came */
+    CALL_FAILED       /* not connected, too many calls in flight, the line
+                         is out of step, or the session was renegotiated
+                         while waiting */
+  };
+
+  /*
+   * rosserial service responses carry no request id; the bridge serves a
+   * client's requests one after the other and answers them in order. So
+   * calls are matched first in, first out. A call that times out keeps
+   * its place in line, and its late response is swallowed instead of
+   * being handed to the next call. Everything in flight is failed when
+   * the topics are renegotiated, because the bridge has started over.
+   *
+   * Nothing tells a slow response from a lost one (the bridge sends none
+   * when the service raises). So once the oldest call passes its
+   * deadline the line is out of step: the calls behind it are failed,
+   * since the next response may be theirs or the lost one's, and new
+   * calls are refused. The line is back in step when every call in it
+   * has been answered, or after SERVICE_DRAIN_TIMEOUT without a response,
+   * when the rest are taken as lost. A response that comes later still
+   * lands on the wrong call; deadlines should leave room for the slowest
+   * answer of the service.
+   */
+  template<typename MReq , typename MRes, int MAX_PENDING=16>
   class ServiceClient : public Subscriber_  {
     public:
+      /* Handle on one call, cheap to copy */
+      class Future {
+        public:
+          Future() : client_(0), seq_(0) {}
+
+          CallStatus status() const { return client_ ? client_->status(seq_) : CALL_FAILED; }
+          bool ready() const { return status() != CALL_PENDING; }
+
+          /* Spin the node handle until the call is no longer pending */
+          CallStatus wait() { return client_ ? client_->wait(seq_) : CALL_FAILED; }
+
+        private:
+          friend class ServiceClient;
+          Future(ServiceClient * client, uint32_t seq) : client_(client), seq_(seq) {}
+
+          ServiceClient * client_;
+          uint32_t seq_;
+      };
+
       ServiceClient(const char* topic_name) : 
-        pub(topic_name, &req, rosserial_msgs::TopicInfo::ID_SERVICE_CLIENT + rosserial_msgs::TopicInfo::ID_PUBLISHER)
+        pub(topic_name, &req, rosserial_msgs::TopicInfo::ID_SERVICE_CLIENT + rosserial_msgs::TopicInfo::ID_PUBLISHER),
+        next_(0),
+        oldest_(0),
+        out_of_step_(false),
+        quiet_since_(0)
       {
         this->topic_ = topic_name;
-        this->waiting = true;
       }
 
-      virtual void call(const MReq & request, MRes & response)
+      /* Send a request without waiting. response must stay valid until
+       * the call is no longer pending. Up to MAX_PENDING calls may be in
+       * flight; none are taken while the line is out of step. */
+      Future callAsync(const MReq & request, MRes & response, uint32_t timeout = SERVICE_CALL_TIMEOUT)
+      {
+        if(!pub.nh_->connected())
+          return Future();
+        checkStep();
+        if(out_of_step_ || next_ - oldest_ >= (uint32_t)MAX_PENDING)
+          return Future();
+        Call & c = calls_[next_ % MAX_PENDING];
+        c.seq = next_;
+        c.response = &response;
+        c.start = pub.nh_->time();
+        c.timeout = timeout;
+        c.status = CALL_PENDING;
+        if(pub.publish(&request) <= 0){
+          c.status = CALL_FAILED;         /* never sent, keep it out of line */
+          return Future();
+        }
+        return Future(this, next_++);
+      }
+
+      /* Send a request and park in the event loop until the response
+       * arrives or the deadline passes. */
+      virtual bool call(const MReq & request, MRes & response, uint32_t timeout = SERVICE_CALL_TIMEOUT)
       {
-        if(!pub.nh_->connected()) return;
-        ret = &response;
-        waiting = true;
-        pub.publish(&request);
-        while(waiting && pub.nh_->connected())
-          if(pub.nh_->spinOnce() < 0) break;
+        return callAsync(request, response, timeout).wait() == CALL_SUCCEEDED;
       }
 
+      /* Calls sent and not answered yet, timed out ones included */
+      int pending(){ checkStep(); return next_ - oldest_; }
+
+      /* True while calls are refused after a lost or late response */
+      bool outOfStep(){ checkStep(); return out_of_step_; }
+
       // these refer to the subscriber
       virtual void callback(unsigned char *data){
-        ret->deserialize(data);
-        waiting = false;
+        if(oldest_ == next_){
+          resp.deserialize(data);         /* nobody is waiting for this one */
+          return;
+        }
+        Call & c = calls_[oldest_ % MAX_PENDING];
+        if(out_of_step_){
+          resp.deserialize(data);         /* cannot tell whose it is */
+          quiet_since_ = pub.nh_->time();
+          oldest_++;
+          checkStep();
+          return;
+        }
+        if(c.status == CALL_PENDING){
+          c.response->deserialize(data);
+          c.status = CALL_SUCCEEDED;
+        }else{
+          resp.deserialize(data);         /* late answer to a timed out call */
+        }
+        oldest_++;
+      }
+      virtual void negotiated(){
+        for(uint32_t seq = oldest_; seq != next_; seq++){
+          Call & c = calls_[seq % MAX_PENDING];
+          if(c.status == CALL_PENDING)
+            c.status = CALL_FAILED;
+        }
+        oldest_ = next_;
+        out_of_step_ = false;
       }
       virtual const char * getMsgType(){ return this->resp.getType(); }
       virtual const char * getMsgMD5(){ return this->resp.getMD5(); }
@@ -73,9 +185,68 @@ namespace ros {
 
       MReq req;
       MRes resp;
-      MRes * ret;
-      bool waiting;
       Publisher pub;
+
+    private:
+      struct Call {
+        Call() : seq(0), response(0), start(0), timeout(0), status(CALL_FAILED) {}
+        uint32_t seq;
+        MRes * response;
+        uint32_t start;
+        uint32_t timeout;
+        CallStatus status;
+      };
+
+      /* Put the line out of step when its oldest call has timed out, and
+       * back in step once it has drained */
+      void checkStep(){
+        uint32_t now = pub.nh_->time();
+        if(!out_of_step_){
+          if(oldest_ == next_)
+            return;
+          Call & c = calls_[oldest_ % MAX_PENDING];
+          if((uint32_t)(now - c.start) < c.timeout)
+            return;
+          if(c.status == CALL_PENDING)
+            c.status = CALL_TIMED_OUT;
+          for(uint32_t seq = oldest_ + 1; seq != next_; seq++){
+            Call & behind = calls_[seq % MAX_PENDING];
+            if(behind.status == CALL_PENDING)
+              behind.status = CALL_FAILED;
+          }
+          out_of_step_ = true;
+          quiet_since_ = now;
+        }
+        if(oldest_ == next_ || (uint32_t)(now - quiet_since_) >= SERVICE_DRAIN_TIMEOUT){
+          oldest_ = next_;                /* the rest are lost */
+          out_of_step_ = false;
+        }
+      }
+
+      CallStatus status(uint32_t seq){
+        checkStep();
+        Call & c = calls_[seq % MAX_PENDING];
+        if(c.seq != seq)
+          return CALL_FAILED;             /* slot reused, result long gone */
+        if(c.status == CALL_PENDING && (uint32_t)(pub.nh_->time() - c.start) >= c.timeout)
+          c.status = CALL_TIMED_OUT;
+        return c.status;
+      }
+
+      CallStatus wait(uint32_t seq){
+        while(status(seq) == CALL_PENDING){
+          pub.nh_->spinOnce();
+          if(status(seq) == CALL_PENDING)
+            pub.nh_->wait(SERVICE_WAIT_SLICE);
+        }
+        return status(seq);
+      }
+
+      Call calls_[MAX_PENDING];
+      uint32_t next_;
+      uint32_t oldest_;
+      bool out_of_step_;
+      uint32_t quiet_since_;              /* last response while out of step */
   };
 
 }
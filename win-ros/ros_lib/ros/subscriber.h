@@ -35,7 +35,10 @@
 #ifndef ROS_SUBSCRIBER_H_
 #define ROS_SUBSCRIBER_H_
 
+#include <vector>
+
 #include "rosserial_msgs/TopicInfo.h"
+#include "qos.h"
 
 namespace ros {
 
@@ -43,6 +46,8 @@ namespace ros {
   class Subscriber_
   {
     public:
+      Subscriber_() : head_(0), count_(0), dropped_(0) {}
+
       virtual void callback(unsigned char *data)=0;
       virtual int getEndpointType()=0;
 
@@ -52,12 +57,96 @@ namespace ros {
       virtual const char * getMsgType()=0;
       virtual const char * getMsgMD5()=0;
       const char * topic_;
+
+      /* Set the quality of service for this topic, only depth applies */
+      void setQoS(const QoS & qos){
+        qos_ = qos;
+        slots_.assign(qos_.depth > 0 ? qos_.depth : 0, std::vector<unsigned char>());
+        head_ = count_ = 0;
+      }
+
+      /* Called by the NodeHandle for every message on this topic. Without
+       * a queue the callback runs right away on the receive buffer. */
+      virtual void receive(unsigned char *data, int length){
+        if( qos_.depth <= 0 ){
+          callback(data);
+          return;
+        }
+        int slot;
+        if( count_ == qos_.depth ){         /* keep last: overwrite the oldest */
+          slot = head_;
+          head_ = (head_ + 1) % qos_.depth;
+          dropped_++;
+        }else{
+          slot = (head_ + count_) % qos_.depth;
+          count_++;
+        }
+        slots_[slot].assign(data, data + length);
+      }
+
+      /* Called by the NodeHandle at the end of spinOnce(), runs the queued
+       * callbacks oldest first. Each message is taken out of its slot
+       * before the callback runs, so a callback that spins again cannot
+       * have its data overwritten. */
+      void dispatch(){
+        while( count_ > 0 ){
+          std::vector<unsigned char> data;
+          data.swap(slots_[head_]);
+          head_ = (head_ + 1) % qos_.depth;
+          count_--;
+          callback(data.data());
+        }
+      }
+
+      /* Called by the NodeHandle after the topics were (re)negotiated */
+      virtual void negotiated(){}
+
+      /* Messages lost to the keep-last queue since start */
+      unsigned long getDropped(){ return dropped_; }
+
+    private:
+      QoS qos_;
+      std::vector< std::vector<unsigned char> > slots_;
+      int head_;
+      int count_;
+      unsigned long dropped_;
   };
 
 
-  /* Actual subscriber, templated on message type. */
-  template<typename MsgT>
+  /* Actual subscriber, templated on message type. The callback is a
+   * member function of ObjT, or a free function for ObjT = void. */
+  template<typename MsgT, typename ObjT=void>
   class Subscriber: public Subscriber_{
+    public:
+      typedef void(ObjT::*CallbackT)(const MsgT&);
+      MsgT msg;
+
+      Subscriber(const char * topic_name, CallbackT cb, ObjT* obj, int endpoint=rosserial_msgs::TopicInfo::ID_SUBSCRIBER) :
+        cb_(cb),
+        obj_(obj),
+        endpoint_(endpoint)
+      {
+        topic_ = topic_name;
+      };
+
+      virtual void callback(unsigned char* data){
+        msg.deserialize(data);
+        (obj_->*cb_)(msg);
+      }
+
+      virtual const char * getMsgType(){ return this->msg.getType(); }
+      virtual const char * getMsgMD5(){ return this->msg.getMD5(); }
+      virtual int getEndpointType(){ return endpoint_; }
+
+    private:
+      CallbackT cb_;
+      ObjT* obj_;
+      int endpoint_;
+  };
+
+  /* Subscriber with a free function callback */
+  template<typename MsgT>
+  class Subscriber<MsgT, void>: public Subscriber_{
     public:
       typedef void(*CallbackT)(const MsgT&);
       MsgT msg;
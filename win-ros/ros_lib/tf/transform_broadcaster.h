@@ -35,34 +35,237 @@
 #ifndef ROS_TRANSFORM_BROADCASTER_H_
 #define ROS_TRANSFORM_BROADCASTER_H_
 
+#include <string.h>
 #include "tfMessage.h"
 
 namespace tf
 {
 
+  /* Publishes transforms on /tf.
+   *
+   * sendTransform() publishes one transform as it is. sendTransforms()
+   * packs many into as few tfMessages as the output buffer of the node
+   * handle takes, so a tick broadcasting the scanner, turntable and
+   * fixture costs one frame instead of three. add() collects the
+   * transforms of a tick and sends them when a transform with a later
+   * stamp starts the next tick or the batch is full, or once they have
+   * waited the max delay: the next add() or spinOnce() of the node
+   * handle sends them then, so the last tick of a burst is not held
+   * back. flush() sends the rest at once.
+   *
+   * A transform that has not changed since its frame was last sent is
+   * skipped by sendTransforms() and add(), until the keepalive period
+   * has passed: listeners do not extrapolate, so each frame still needs
+   * a fresh stamp now and then. Frames are told apart by child frame id;
+   * the first MAX_FRAMES frames are tracked, the rest always sent.
+   *
+   * Transforms are copied, the frame id strings are not: they must stay
+   * valid until the transform is sent. */
   class TransformBroadcaster
   {
     public:
-      TransformBroadcaster() : publisher_("/tf", &internal_msg) {}
+      enum { MAX_BATCH = 16, MAX_FRAMES = 16, MAX_NAME = 64 };
 
-      void init(ros::NodeHandle &nh)
+      TransformBroadcaster() :
+        publisher_(this, "/tf", &internal_msg),
+        nh_(0),
+        max_bytes_(512 - 8),
+        max_delay_(100),
+        pending_length_(0),
+        queued_at_(0),
+        frame_count_(0)
       {
+        keepalive_.sec = 1;
+        keepalive_.nsec = 0;
+      }
+
+      /* the batches are sized to the output buffer of nh */
+      template<class Hardware, int MAX_SUBSCRIBERS, int MAX_PUBLISHERS, int INPUT_SIZE, int OUTPUT_SIZE>
+      void init(ros::NodeHandle_<Hardware, MAX_SUBSCRIBERS, MAX_PUBLISHERS, INPUT_SIZE, OUTPUT_SIZE> &nh)
+      {
+        max_bytes_ = OUTPUT_SIZE - 8;
+        nh_ = &nh;
         nh.advertise(publisher_);
       }
 
+      /* add() holds a tick at most this many milliseconds */
+      void setMaxDelay(uint32_t ms){ max_delay_ = ms; }
+
+      /* a frame that has not changed is sent again after this long */
+      void setKeepalive(const ros::Duration & keepalive){ keepalive_ = keepalive; }
+
       void sendTransform(geometry_msgs::TransformStamped &transform)
       {
         internal_msg.transforms_length = 1;
         internal_msg.transforms = &transform;
-        publisher_.publish(&internal_msg);
+        if( publisher_.publish(&internal_msg) > 0 )
+          remember(transform);
+      }
+
+      /* publish the transforms that changed or are due for a keepalive,
+       * as few messages as possible; returns how many were sent */
+      int sendTransforms(const geometry_msgs::TransformStamped * transforms, int count)
+      {
+        int sent = 0;
+        for(int i = 0; i < count; i++){
+          if( !due(transforms[i]) )
+            continue;
+          if( pending_length_ == MAX_BATCH || !fits(transforms[i]) )
+            sent += flush();
+          pending_[pending_length_++] = transforms[i];
+        }
+        return sent + flush();
+      }
+
+      /* queue a transform of the current tick; a later stamp or an
+       * expired max delay sends the previous tick first */
+      void add(const geometry_msgs::TransformStamped & transform)
+      {
+        if( !due(transform) )
+          return;
+        if( nh_ )
+          expire(nh_->time());
+        if( pending_length_ > 0 && later(transform.header.stamp, pending_[0].header.stamp) )
+          flush();
+        if( pending_length_ == MAX_BATCH || !fits(transform) )
+          flush();
+        if( pending_length_ == 0 && nh_ )
+          queued_at_ = nh_->time();
+        pending_[pending_length_++] = transform;
+      }
+
+      /* send what add() queued; returns how many were sent, 0 if the
+       * publish failed */
+      int flush()
+      {
+        if( pending_length_ == 0 )
+          return 0;
+        internal_msg.transforms_length = pending_length_;
+        internal_msg.transforms = pending_;
+        /* not sent, not skipped next time */
+        int sent = 0;
+        if( publisher_.publish(&internal_msg) > 0 ){
+          for(int i = 0; i < pending_length_; i++)
+            remember(pending_[i]);
+          sent = pending_length_;
+        }
+        pending_length_ = 0;
+        return sent;
       }
 
     private:
+      /* /tf, spun by the node handle: sends a tick held too long */
+      class TickPublisher : public ros::Publisher {
+        public:
+          TickPublisher(TransformBroadcaster * owner, const char * topic, ros::Msg * msg) :
+            ros::Publisher(topic, msg), owner_(owner) {}
+          virtual void spin(uint32_t now){
+            ros::Publisher::spin(now);
+            owner_->expire(now);
+          }
+        private:
+          TransformBroadcaster * owner_;
+      };
+
+      struct Frame {
+        char child[MAX_NAME];
+        char parent[MAX_NAME];
+        ros::Time sent;
+        double values[7];
+      };
+
+      void expire(uint32_t now){
+        if( pending_length_ > 0 && now - queued_at_ >= max_delay_ )
+          flush();
+      }
+
+      static void values(const geometry_msgs::TransformStamped & t, double v[7]){
+        v[0] = t.transform.translation.x;
+        v[1] = t.transform.translation.y;
+        v[2] = t.transform.translation.z;
+        v[3] = t.transform.rotation.x;
+        v[4] = t.transform.rotation.y;
+        v[5] = t.transform.rotation.z;
+        v[6] = t.transform.rotation.w;
+      }
+
+      static int64_t nsec(const ros::Time & t){
+        return (int64_t)t.sec * 1000000000LL + t.nsec;
+      }
+
+      static bool later(const ros::Time & a, const ros::Time & b){
+        return nsec(a) > nsec(b);
+      }
+
+      static int length(const char * s){ return s ? (int)strlen(s) : 0; }
+
+      /* serialized size of one transform: header, child id, 7 doubles */
+      static int bytes(const geometry_msgs::TransformStamped & t){
+        return 16 + length(t.header.frame_id) + 4 + length(t.child_frame_id) + 56;
+      }
+
+      bool fits(const geometry_msgs::TransformStamped & transform) const {
+        int total = 4 + bytes(transform);
+        for(int i = 0; i < pending_length_; i++)
+          total += bytes(pending_[i]);
+        return pending_length_ == 0 || total <= max_bytes_;
+      }
+
+      Frame * find(const char * child){
+        if( child == 0 )
+          return 0;
+        for(int i = 0; i < frame_count_; i++)
+          if( strcmp(frames_[i].child, child) == 0 )
+            return &frames_[i];
+        return 0;
+      }
+
+      /* changed since it was last sent, or sent too long ago */
+      bool due(const geometry_msgs::TransformStamped & transform){
+        Frame * frame = find(transform.child_frame_id);
+        if( frame == 0 )
+          return true;
+        const char * parent = transform.header.frame_id;
+        if( strcmp(frame->parent, parent ? parent : "") != 0 )
+          return true;
+        double v[7];
+        values(transform, v);
+        if( memcmp(v, frame->values, sizeof(v)) != 0 )
+          return true;
+        int64_t keepalive = (int64_t)keepalive_.sec * 1000000000LL + keepalive_.nsec;
+        return nsec(transform.header.stamp) - nsec(frame->sent) >= keepalive;
+      }
+
+      void remember(const geometry_msgs::TransformStamped & transform){
+        const char * parent = transform.header.frame_id ? transform.header.frame_id : "";
+        if( strlen(parent) >= MAX_NAME )
+          return;
+        Frame * frame = find(transform.child_frame_id);
+        if( frame == 0 ){
+          if( frame_count_ == MAX_FRAMES || transform.child_frame_id == 0 ||
+              strlen(transform.child_frame_id) >= MAX_NAME )
+            return;
+          frame = &frames_[frame_count_++];
+          strcpy(frame->child, transform.child_frame_id);
+        }
+        strcpy(frame->parent, parent);
+        frame->sent = transform.header.stamp;
+        values(transform, frame->values);
+      }
+
       tf::tfMessage internal_msg;
-      ros::Publisher publisher_;
+      TickPublisher publisher_;
+      ros::NodeHandleBase_ * nh_;
+      int max_bytes_;
+      uint32_t max_delay_;
+      ros::Duration keepalive_;
+      geometry_msgs::TransformStamped pending_[MAX_BATCH];
+      int pending_length_;
+      uint32_t queued_at_;  /* when the first of pending_ was queued */
+      Frame frames_[MAX_FRAMES];
+      int frame_count_;
   };
 
 }
 
 #endif
-
@@ -0,0 +1,448 @@
+/*
+ * Receive side of tf for rosserial: keeps the recent history of every
+ * frame and answers where one frame was relative to another at a given
+ * time, e.g. the scanner relative to the robot base when a frame was
+ * captured.
+ *
+ * Each frame has one parent, set by the first transform naming it as
+ * child, and a ring of the last CAPACITY transforms to that parent in
+ * time order. A lookup walks both frames up to their common ancestor,
+ * interpolates every edge at the requested time (linear for the
+ * translation, slerp for the rotation) and composes the chain. Time
+ * zero asks for the latest time all edges of the chain have data for,
+ * as in tf. Times outside the history of an edge are not extrapolated.
+ *
+ * Transforms come in on the thread that spins the node handle, the only
+ * writer. Lookups may come from any number of other threads at once and
+ * never take a lock: each ring slot carries a sequence number that is
+ * odd while the slot is written, and a reader that saw it change copies
+ * the slot again. A reader that falls so far behind that the slots it
+ * was reading were recycled gets LOOKUP_PAST, as if it had asked too
+ * late.
+ *
+ * Usage:
+ *
+ *   tf::TransformBuffer<> buffer;
+ *   buffer.registerWith(nh);
+ *   ...
+ *   geometry_msgs::Transform scanner;
+ *   if( buffer.lookup("base_link", "scanner", capture_time, scanner) == tf::LOOKUP_OK )
+ *     ...
+ *
+ * /tf carries every moving link of the robot, often at 50 Hz or more, so
+ * subscribing to it costs link bandwidth. Frames beyond MAX_FRAMES and
+ * transforms older than the newest one of their frame are dropped and
+ * counted.
+ */
+
+#ifndef ROS_TRANSFORM_BUFFER_H_
+#define ROS_TRANSFORM_BUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+#include "ros/node_handle.h"
+#include "tfMessage.h"
+
+namespace tf
+{
+
+  /* Outcome of a lookup */
+  enum LookupStatus {
+    LOOKUP_OK,
+    LOOKUP_UNKNOWN_FRAME,   /* no transform has named the frame yet */
+    LOOKUP_NOT_CONNECTED,   /* the frames are in different trees */
+    LOOKUP_PAST,            /* before the oldest transform kept */
+    LOOKUP_FUTURE           /* after the newest transform received */
+  };
+
+  template<int MAX_FRAMES=32, int CAPACITY=128, int MAX_NAME=64>
+  class TransformBuffer
+  {
+    public:
+      TransformBuffer(const char * topic = "/tf") :
+        sub_(topic, &TransformBuffer::callback, this),
+        frame_count_(0),
+        dropped_(0)
+      {
+        for(int i = 0; i < MAX_FRAMES; i++){
+          names_[i][0] = '\0';
+          parent_[i] = -1;
+          written_[i].store(0, std::memory_order_relaxed);
+        }
+      }
+
+      template<typename NodeHandleT>
+      bool registerWith(NodeHandleT & nh){
+        return nh.subscribe(sub_);
+      }
+
+      /* Add one transform; from the writer thread only */
+      void insert(const geometry_msgs::TransformStamped & transform){
+        int child = writerFrame(transform.child_frame_id);
+        int parent = writerFrame(transform.header.frame_id);
+        if( child < 0 || parent < 0 || child == parent ){
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        if( parent_[child] < 0 )
+          parent_[child] = parent;      /* published with the frame count */
+        else if( parent_[child] != parent ){
+          dropped_.fetch_add(1, std::memory_order_relaxed);   /* reparented */
+          return;
+        }
+
+        int64_t stamp = toNsec(transform.header.stamp);
+        uint64_t written = written_[child].load(std::memory_order_relaxed);
+        uint64_t index = written;
+        if( written > 0 ){
+          int64_t newest = slots_[child][(written - 1) % CAPACITY].stamp.load(std::memory_order_relaxed);
+          if( stamp < newest ){
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+          }
+          if( stamp == newest )
+            index = written - 1;        /* a repeat replaces the newest */
+        }
+
+        const geometry_msgs::Vector3 & t = transform.transform.translation;
+        const geometry_msgs::Quaternion & q = transform.transform.rotation;
+        double values[7] = { t.x, t.y, t.z, q.x, q.y, q.z, q.w };
+        normalize(values + 3);
+        Slot & slot = slots_[child][index % CAPACITY];
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.stamp.store(stamp, std::memory_order_relaxed);
+        for(int i = 0; i < 7; i++)
+          slot.values[i].store(values[i], std::memory_order_relaxed);
+        slot.seq.store(seq + 2, std::memory_order_release);
+        if( index == written )
+          written_[child].store(written + 1, std::memory_order_release);
+      }
+
+      /* Where source was in target at time: maps source coordinates to
+       * target coordinates. Time zero is the latest common time; stamp,
+       * if given, gets the time the answer is for. */
+      LookupStatus lookup(const char * target, const char * source, const ros::Time & time,
+                          geometry_msgs::Transform & out, ros::Time * stamp_out = 0) const {
+        int target_frame = findFrame(target);
+        int source_frame = findFrame(source);
+        if( target_frame < 0 || source_frame < 0 )
+          return LOOKUP_UNKNOWN_FRAME;
+
+        /* both chains up to the root; the common ancestor ends them */
+        int source_chain[MAX_FRAMES], target_chain[MAX_FRAMES];
+        int source_length = chain(source_frame, source_chain);
+        int target_length = chain(target_frame, target_chain);
+        if( source_chain[source_length - 1] != target_chain[target_length - 1] )
+          return LOOKUP_NOT_CONNECTED;
+        while( source_length > 0 && target_length > 0 &&
+               source_chain[source_length - 1] == target_chain[target_length - 1] ){
+          source_length--;
+          target_length--;
+        }
+
+        int64_t stamp = toNsec(time);
+        if( stamp == 0 ){
+          LookupStatus status = latestCommon(source_chain, source_length, target_chain, target_length, stamp);
+          if( status != LOOKUP_OK )
+            return status;
+        }
+
+        /* edges of the chains map each frame into its parent */
+        Transform up_source = Transform::identity();
+        for(int i = source_length - 1; i >= 0; i--){
+          Transform edge;
+          LookupStatus status = sample(source_chain[i], stamp, edge);
+          if( status != LOOKUP_OK )
+            return status;
+          up_source = up_source * edge;
+        }
+        Transform up_target = Transform::identity();
+        for(int i = target_length - 1; i >= 0; i--){
+          Transform edge;
+          LookupStatus status = sample(target_chain[i], stamp, edge);
+          if( status != LOOKUP_OK )
+            return status;
+          up_target = up_target * edge;
+        }
+        Transform result = up_target.inverse() * up_source;
+        out.translation.x = result.t[0];
+        out.translation.y = result.t[1];
+        out.translation.z = result.t[2];
+        out.rotation.x = result.q[0];
+        out.rotation.y = result.q[1];
+        out.rotation.z = result.q[2];
+        out.rotation.w = result.q[3];
+        if( stamp_out ){
+          stamp_out->sec = (uint32_t)(stamp / 1000000000LL);
+          stamp_out->nsec = (uint32_t)(stamp % 1000000000LL);
+        }
+        return LOOKUP_OK;
+      }
+
+      bool knows(const char * frame) const { return findFrame(frame) >= 0; }
+
+      /* transforms dropped: unknown frames, too many frames, reparented
+       * or out of order */
+      uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+      struct Slot {
+        Slot() : seq(0), stamp(0) {
+          for(int i = 0; i < 7; i++)
+            values[i].store(0, std::memory_order_relaxed);
+        }
+        std::atomic<uint32_t> seq;
+        std::atomic<int64_t> stamp;
+        std::atomic<double> values[7];   /* x y z qx qy qz qw */
+      };
+
+      /* rigid transform, rotation as a unit quaternion x y z w */
+      struct Transform {
+        double t[3];
+        double q[4];
+
+        static Transform identity(){
+          Transform r = { { 0, 0, 0 }, { 0, 0, 0, 1 } };
+          return r;
+        }
+
+        void rotate(const double v[3], double out[3]) const {
+          /* v + 2 q x (q x v + w v) */
+          double cx = q[1] * v[2] - q[2] * v[1] + q[3] * v[0];
+          double cy = q[2] * v[0] - q[0] * v[2] + q[3] * v[1];
+          double cz = q[0] * v[1] - q[1] * v[0] + q[3] * v[2];
+          out[0] = v[0] + 2 * (q[1] * cz - q[2] * cy);
+          out[1] = v[1] + 2 * (q[2] * cx - q[0] * cz);
+          out[2] = v[2] + 2 * (q[0] * cy - q[1] * cx);
+        }
+
+        Transform operator*(const Transform & b) const {
+          Transform r;
+          rotate(b.t, r.t);
+          for(int i = 0; i < 3; i++)
+            r.t[i] += t[i];
+          r.q[0] = q[3] * b.q[0] + q[0] * b.q[3] + q[1] * b.q[2] - q[2] * b.q[1];
+          r.q[1] = q[3] * b.q[1] - q[0] * b.q[2] + q[1] * b.q[3] + q[2] * b.q[0];
+          r.q[2] = q[3] * b.q[2] + q[0] * b.q[1] - q[1] * b.q[0] + q[2] * b.q[3];
+          r.q[3] = q[3] * b.q[3] - q[0] * b.q[0] - q[1] * b.q[1] - q[2] * b.q[2];
+          return r;
+        }
+
+        Transform inverse() const {
+          Transform r;
+          r.q[0] = -q[0];
+          r.q[1] = -q[1];
+          r.q[2] = -q[2];
+          r.q[3] = q[3];
+          r.t[0] = 0;
+          r.t[1] = 0;
+          r.t[2] = 0;
+          double back[3];
+          r.rotate(t, back);
+          for(int i = 0; i < 3; i++)
+            r.t[i] = -back[i];
+          return r;
+        }
+      };
+
+      static int64_t toNsec(const ros::Time & time){
+        return (int64_t)time.sec * 1000000000LL + time.nsec;
+      }
+
+      static void normalize(double q[4]){
+        double norm = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        if( norm < 1e-12 ){
+          q[0] = q[1] = q[2] = 0;
+          q[3] = 1;
+          return;
+        }
+        for(int i = 0; i < 4; i++)
+          q[i] /= norm;
+      }
+
+      void callback(const tf::tfMessage & msg){
+        for(int i = 0; i < msg.transforms_length; i++)
+          insert(msg.transforms[i]);
+      }
+
+      int findFrame(const char * name) const {
+        if( name == 0 )
+          return -1;
+        if( name[0] == '/' )
+          name++;                       /* "/base_link" is "base_link" */
+        int count = frame_count_.load(std::memory_order_acquire);
+        for(int i = 0; i < count; i++)
+          if( strcmp(names_[i], name) == 0 )
+            return i;
+        return -1;
+      }
+
+      /* the frame, added if new; the name and parent are set before the
+       * count makes it visible */
+      int writerFrame(const char * name){
+        int frame = findFrame(name);
+        if( frame >= 0 || name == 0 || name[0] == '\0' )
+          return frame;
+        if( name[0] == '/' )
+          name++;
+        int count = frame_count_.load(std::memory_order_relaxed);
+        if( count >= MAX_FRAMES || strlen(name) >= (size_t)MAX_NAME )
+          return -1;
+        strcpy(names_[count], name);
+        parent_[count] = -1;
+        frame_count_.store(count + 1, std::memory_order_release);
+        return count;
+      }
+
+      /* frame, its parent, ... up to the root; returns the length */
+      int chain(int frame, int * frames) const {
+        int length = 0;
+        while( frame >= 0 && length < MAX_FRAMES ){
+          frames[length++] = frame;
+          frame = parentOf(frame);
+        }
+        return length;
+      }
+
+      /* a parent set after a reader saw the frame may be missed, the
+       * frame then looks like a root until the next lookup */
+      int parentOf(int frame) const {
+        if( written_[frame].load(std::memory_order_acquire) == 0 )
+          return -1;
+        return parent_[frame];
+      }
+
+      bool copySlot(int frame, uint64_t index, int64_t & stamp, double values[7]) const {
+        const Slot & slot = slots_[frame][index % CAPACITY];
+        for(int attempt = 0; attempt < 4; attempt++){
+          uint32_t before = slot.seq.load(std::memory_order_acquire);
+          if( before & 1 )
+            continue;
+          stamp = slot.stamp.load(std::memory_order_relaxed);
+          for(int i = 0; i < 7; i++)
+            values[i] = slot.values[i].load(std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if( slot.seq.load(std::memory_order_relaxed) == before )
+            return true;
+        }
+        return false;
+      }
+
+      int64_t stampAt(int frame, uint64_t index, bool & ok) const {
+        int64_t stamp;
+        double values[7];
+        ok = copySlot(frame, index, stamp, values);
+        return stamp;
+      }
+
+      /* the newest time every edge of both chains has data for */
+      LookupStatus latestCommon(const int * a, int a_length, const int * b, int b_length, int64_t & stamp) const {
+        stamp = INT64_MAX;
+        for(int k = 0; k < a_length + b_length; k++){
+          int frame = k < a_length ? a[k] : b[k - a_length];
+          uint64_t written = written_[frame].load(std::memory_order_acquire);
+          bool ok;
+          int64_t newest = stampAt(frame, written - 1, ok);
+          if( !ok )
+            return LOOKUP_PAST;
+          if( newest < stamp )
+            stamp = newest;
+        }
+        if( stamp == INT64_MAX )
+          stamp = 0;                      /* same frame, nothing to interpolate */
+        return LOOKUP_OK;
+      }
+
+      /* the edge from frame to its parent at stamp, interpolated between
+       * the two transforms around it */
+      LookupStatus sample(int frame, int64_t stamp, Transform & out) const {
+        uint64_t written = written_[frame].load(std::memory_order_acquire);
+        uint64_t oldest = written > CAPACITY ? written - CAPACITY : 0;
+        bool ok;
+        /* a slot or two above the oldest, it may be recycled meanwhile */
+        uint64_t low = oldest + (written - oldest > 2 ? 1 : 0);
+        uint64_t high = written - 1;
+        int64_t newest = stampAt(frame, high, ok);
+        if( !ok || stamp > newest )
+          return ok ? LOOKUP_FUTURE : LOOKUP_PAST;
+        if( stampAt(frame, low, ok) > stamp || !ok )
+          return LOOKUP_PAST;
+
+        /* the last slot at or before stamp */
+        while( low < high ){
+          uint64_t middle = low + (high - low + 1) / 2;
+          int64_t at = stampAt(frame, middle, ok);
+          if( !ok )
+            return LOOKUP_PAST;
+          if( at <= stamp )
+            low = middle;
+          else
+            high = middle - 1;
+        }
+
+        int64_t a_stamp, b_stamp;
+        double a[7], b[7];
+        if( !copySlot(frame, low, a_stamp, a) || a_stamp > stamp )
+          return LOOKUP_PAST;
+        if( a_stamp == stamp || low + 1 >= written ){
+          toTransform(a, out);
+          return LOOKUP_OK;
+        }
+        if( !copySlot(frame, low + 1, b_stamp, b) || b_stamp < stamp )
+          return LOOKUP_PAST;
+
+        double f = (double)(stamp - a_stamp) / (double)(b_stamp - a_stamp);
+        double mixed[7];
+        for(int i = 0; i < 3; i++)
+          mixed[i] = a[i] + (b[i] - a[i]) * f;
+        slerp(a + 3, b + 3, f, mixed + 3);
+        toTransform(mixed, out);
+        return LOOKUP_OK;
+      }
+
+      static void toTransform(const double values[7], Transform & out){
+        for(int i = 0; i < 3; i++)
+          out.t[i] = values[i];
+        for(int i = 0; i < 4; i++)
+          out.q[i] = values[3 + i];
+      }
+
+      static void slerp(const double * a, const double * b, double f, double * out){
+        double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+        double sign = 1;
+        if( dot < 0 ){                    /* the short way round */
+          dot = -dot;
+          sign = -1;
+        }
+        double wa, wb;
+        if( dot > 0.9995 ){               /* nearly the same, lerp is exact enough */
+          wa = 1 - f;
+          wb = f;
+        }else{
+          double angle = acos(dot);
+          double s = sin(angle);
+          wa = sin((1 - f) * angle) / s;
+          wb = sin(f * angle) / s;
+        }
+        for(int i = 0; i < 4; i++)
+          out[i] = wa * a[i] + sign * wb * b[i];
+        normalize(out);
+      }
+
+      ros::Subscriber<tf::tfMessage, TransformBuffer> sub_;
+      char names_[MAX_FRAMES][MAX_NAME];
+      int parent_[MAX_FRAMES];
+      std::atomic<int> frame_count_;
+      std::atomic<uint64_t> written_[MAX_FRAMES];
+      Slot slots_[MAX_FRAMES][CAPACITY];
+      std::atomic<uint32_t> dropped_;
+  };
+
+}
+
+#endif
@@ -5,12 +5,33 @@
 #include <iostream>
 #include <cstddef>
 #include <windows.h> 
+//win-ros.exe reconnects and resumes by itself with --supervise, so it is
+//only started again when it crashes or gives up, with a growing delay
+#define RELAUNCH_DELAY_MIN 1000
+#define RELAUNCH_DELAY_MAX 60000
+//a run this long resets the delay
+#define RELAUNCH_STABLE_TIME 600000
+
 int main(int argc, char ** argv)
 {
+	std::string sprPath = "D://Zhouxh-project/Visual Studio 2012/Projects/win-ros/x64/Release/win-ros.exe";
+	std::string command = "\"" + sprPath + "\" --supervise";
+	for (int i = 1; i < argc; i++)
+		command += std::string(" ") + argv[i];
+
+	DWORD delay = RELAUNCH_DELAY_MIN;
 	while (1)
 	{
-		std::string sprPath = "D://Zhouxh-project/Visual Studio 2012/Projects/win-ros/x64/Release/win-ros.exe";
-		system(sprPath.c_str());
+		DWORD start = GetTickCount();
+		int code = system(command.c_str());
+		if (code == 0)
+			break;	//every pose finished
+
+		if (GetTickCount() - start > RELAUNCH_STABLE_TIME)
+			delay = RELAUNCH_DELAY_MIN;
+		printf("win-ros exited with %d, starting it again in %lu ms\n", code, (unsigned long)delay);
+		Sleep(delay);
+		delay = delay * 2 > RELAUNCH_DELAY_MAX ? RELAUNCH_DELAY_MAX : delay * 2;
 	}
 
 	return 0;
@@ -0,0 +1,222 @@
+/********************************************************
+* @file    : campaign_journal.cpp
+* @brief   : append-only record of the poses a campaign has finished
+*********************************************************/
+#include "stdafx.h"
+#include "campaign_journal.h"
+
+#include <string.h>
+#include <fstream>
+
+#ifdef _WIN32
+#include <io.h>
+#define fsync_file(f) _commit(_fileno(f))
+#define truncate_file(f, size) _chsize_s(_fileno(f), size)
+#else
+#include <unistd.h>
+#define fsync_file(f) fsync(fileno(f))
+#define truncate_file(f, size) ftruncate(fileno(f), size)
+#endif
+
+CampaignJournal::CampaignJournal()
+	: file_(NULL), appended_count_(0), synced_count_(0), stop_(false)
+{
+}
+
+CampaignJournal::~CampaignJournal()
+{
+	close();
+}
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/********************************************************
+*  @function :  fingerprint
+*  @brief    :  hash every pose with its line and add the hashes up, so
+*               the order of the poses does not matter
+*  @input    :  &poses
+*  @return   :  fingerprint
+*********************************************************/
+uint64_t CampaignJournal::fingerprint(const PoseSet &poses)
+{
+	uint64_t sum = poses.size();
+	for (size_t i = 0; i < poses.size(); i++)
+	{
+		double v[7] = { poses.x[i], poses.y[i], poses.z[i], poses.qx[i], poses.qy[i], poses.qz[i], poses.qw[i] };
+		uint64_t hash = fnv1a(&poses.line[i], sizeof(poses.line[i]), 14695981039346656037ULL);
+		sum += fnv1a(v, sizeof(v), hash);
+	}
+	return sum;
+}
+
+/********************************************************
+*  @function :  open
+*  @brief    :  pick up the journal of this plan, or start a new one
+*  @input    :  path, plan fingerprint, count of poses
+*  @return   :  true if the journal can be written
+*********************************************************/
+bool CampaignJournal::open(const char *path, uint64_t plan, size_t count)
+{
+	close();
+	records_.clear();
+	size_t valid = 0;
+	bool resumed = load(path, plan, count, valid);
+	if (!resumed)
+	{
+		std::string old = std::string(path) + ".old";
+		remove(old.c_str());
+		rename(path, old.c_str());
+	}
+
+	file_ = fopen(path, "ab");
+	if (file_ == NULL)
+		return false;
+	if (!resumed)
+		fprintf(file_, "# autoscan journal %d %016llx %u\n", JOURNAL_VERSION,
+			(unsigned long long)plan, (unsigned int)count);
+	else
+		truncate_file(file_, valid);	//drop a line torn by a crash
+	fflush(file_);
+	fsync_file(file_);
+
+	stop_ = false;
+	appended_count_ = synced_count_ = 0;
+	writer_ = std::thread(&CampaignJournal::writeLoop, this);
+	return true;
+}
+
+bool CampaignJournal::load(const char *path, uint64_t plan, size_t count, size_t &valid)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in.is_open())
+		return false;
+
+	std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	size_t start = 0;
+	bool header = false;
+	while (start < text.size())
+	{
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos)
+			break;	//torn by a crash
+		std::string line = text.substr(start, end - start);
+		start = valid = end + 1;
+
+		if (!header)
+		{
+			int version = 0;
+			unsigned long long journal_plan = 0;
+			unsigned int journal_count = 0;
+			if (sscanf(line.c_str(), "# autoscan journal %d %llx %u", &version, &journal_plan, &journal_count) != 3 ||
+				version != JOURNAL_VERSION || journal_plan != plan || journal_count != count)
+				return false;
+			header = true;
+			continue;
+		}
+
+		char kind[8];
+		unsigned int pose_line;
+		int used = 0;
+		if (sscanf(line.c_str(), "%7s %u %n", kind, &pose_line, &used) < 2 || used == 0)
+			continue;
+		Record record;
+		record.done = strcmp(kind, "done") == 0;
+		if (!record.done && strcmp(kind, "skip") != 0)
+			continue;
+		record.detail = line.substr(used);
+		records_[pose_line] = record;
+	}
+	return header;
+}
+
+bool CampaignJournal::finished(uint32_t line) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return records_.count(line) != 0;
+}
+
+size_t CampaignJournal::doneCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t done = 0;
+	for (std::map<uint32_t, Record>::const_iterator it = records_.begin(); it != records_.end(); ++it)
+		done += it->second.done ? 1 : 0;
+	return done;
+}
+
+void CampaignJournal::done(uint32_t line, const std::string &artifact)
+{
+	append(line, true, artifact.empty() ? "-" : artifact);
+}
+
+void CampaignJournal::skipped(uint32_t line, int status)
+{
+	append(line, false, std::to_string(status));
+}
+
+void CampaignJournal::append(uint32_t line, bool done, const std::string &detail)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Record &record = records_[line];
+	record.done = done;
+	record.detail = detail;
+	if (file_ == NULL)
+		return;
+	pending_.push_back(std::string(done ? "done " : "skip ") + std::to_string(line) + " " + detail + "\n");
+	appended_count_++;
+	queued_.notify_one();
+}
+
+//write and sync whatever is queued, one sync per round
+void CampaignJournal::writeLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		queued_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+		if (pending_.empty())
+			break;	//stopped and drained
+
+		std::deque<std::string> batch;
+		batch.swap(pending_);
+		uint64_t count = appended_count_;
+		lock.unlock();
+		for (size_t i = 0; i < batch.size(); i++)
+			fwrite(batch[i].data(), 1, batch[i].size(), file_);
+		fflush(file_);
+		fsync_file(file_);
+		lock.lock();
+		synced_count_ = count;
+		synced_.notify_all();
+	}
+}
+
+void CampaignJournal::sync()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	uint64_t target = appended_count_;
+	synced_.wait(lock, [this, target] { return synced_count_ >= target || !writer_.joinable(); });
+}
+
+void CampaignJournal::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+		queued_.notify_one();
+	}
+	if (writer_.joinable())
+		writer_.join();
+	if (file_)
+		fclose(file_);
+	file_ = NULL;
+}
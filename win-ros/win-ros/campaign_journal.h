@@ -0,0 +1,77 @@
+/********************************************************
+* @file    : campaign_journal.h
+* @brief   : append-only record of the poses a campaign has finished
+* @details : One text line per finished pose, after a header that names
+*            the pose set it belongs to:
+*              # autoscan journal 1 <plan> <poses>
+*              done <line> <artifact>
+*              skip <line> <status>
+*            Poses are known by their line in the pose file, so a
+*            campaign reordered by --optimize still resumes. done means
+*            scanned and saved, skip means the robot cannot reach the
+*            pose; a pose cut short by a crash or a lost link has no
+*            record and is run again. Records go to disk on a writer
+*            thread, which syncs everything queued since its last sync in
+*            one go, so the campaign never waits for the disk.
+*            A line torn by a crash is ignored when the journal is read.
+*********************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "pose_loader.h"
+
+#define JOURNAL_VERSION 1
+
+class CampaignJournal
+{
+public:
+	CampaignJournal();
+	~CampaignJournal();
+
+	//identifies a pose set, whatever order its poses are in
+	static uint64_t fingerprint(const PoseSet &poses);
+
+	//read the journal at path if it belongs to this plan, otherwise keep
+	//it as path.old and start a new one
+	bool open(const char *path, uint64_t plan, size_t count);
+
+	bool finished(uint32_t line) const;
+	size_t finishedCount() const { return records_.size(); }
+	size_t doneCount() const;
+
+	void done(uint32_t line, const std::string &artifact);
+	void skipped(uint32_t line, int status);
+
+	//wait until every record so far is on disk
+	void sync();
+	void close();
+
+private:
+	struct Record
+	{
+		bool done;
+		std::string detail;	//artifact of done, status of skip
+	};
+
+	bool load(const char *path, uint64_t plan, size_t count, size_t &valid);
+	void append(uint32_t line, bool done, const std::string &detail);
+	void writeLoop();
+
+	std::map<uint32_t, Record> records_;
+	FILE *file_;
+	std::thread writer_;
+	mutable std::mutex mutex_;
+	std::condition_variable queued_;
+	std::condition_variable synced_;
+	std::deque<std::string> pending_;
+	uint64_t appended_count_;
+	uint64_t synced_count_;
+	bool stop_;
+};
@@ -0,0 +1,167 @@
+/********************************************************
+* @file    : campaign_scheduler.cpp
+* @brief   : pipelined scan campaign: robot motion, capture, processing
+*********************************************************/
+#include "stdafx.h"
+#include "campaign_scheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+CampaignScheduler::CampaignScheduler(MoveStage move, CaptureStage capture, ProcessStage process,
+	size_t process_queue_depth)
+	: move_(move), capture_(capture), process_(process),
+	process_queue_depth_(process_queue_depth), wall_(0),
+	capture_queue_(NULL), process_queue_(NULL), released_(false)
+{
+	stages_[0].name = "motion";
+	stages_[1].name = "capture";
+	stages_[2].name = "processing";
+	for (int i = 0; i < 3; i++)
+	{
+		stages_[i].busy = 0;
+		stages_[i].items = 0;
+	}
+}
+
+double CampaignScheduler::now() const
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+}
+
+/********************************************************
+*  @function :  run
+*  @brief    :  drive all poses through the three stages, returns when
+*               the last pose is processed
+*  @input    :  count of poses
+*  @return   :  null
+*********************************************************/
+void CampaignScheduler::run(size_t count)
+{
+	BoundedQueue<size_t> capture_queue(1);
+	BoundedQueue<Capture> process_queue(process_queue_depth_);
+	capture_queue_ = &capture_queue;
+	process_queue_ = &process_queue;
+
+	timings_.assign(count, PoseTiming());
+	for (size_t i = 0; i < count; i++)
+	{
+		PoseTiming &t = timings_[i];
+		t.index = i;
+		t.move_start = t.moved = t.captured = t.processed = -1;
+		t.ok = false;
+	}
+	start_ = std::chrono::steady_clock::now();
+
+	std::thread capture_thread(&CampaignScheduler::captureLoop, this);
+	std::thread process_thread(&CampaignScheduler::processLoop, this);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		PoseTiming &t = timings_[i];
+		t.move_start = now();
+		bool arrived = move_(i);
+		t.moved = now();
+		stages_[0].busy += t.moved - t.move_start;
+		stages_[0].items++;
+		if (!arrived)
+			continue;
+
+		//hand the pose to the scanner and hold still until it is done
+		{
+			std::lock_guard<std::mutex> lock(released_mutex_);
+			released_ = false;
+		}
+		capture_queue.push(i);
+		std::unique_lock<std::mutex> lock(released_mutex_);
+		released_cv_.wait(lock, [this] { return released_; });
+	}
+
+	capture_queue.close();
+	capture_thread.join();
+	process_queue.close();
+	process_thread.join();
+	wall_ = now();
+	capture_queue_ = NULL;
+	process_queue_ = NULL;
+}
+
+void CampaignScheduler::captureLoop()
+{
+	size_t index;
+	while (capture_queue_->pop(index))
+	{
+		PoseTiming &t = timings_[index];
+		double start = now();
+		Capture c;
+		c.index = index;
+		bool captured = capture_(index, c.handoff);
+		t.captured = now();
+		stages_[1].busy += t.captured - start;
+		stages_[1].items++;
+
+		//the robot may move on while this pose is processed
+		{
+			std::lock_guard<std::mutex> lock(released_mutex_);
+			released_ = true;
+		}
+		released_cv_.notify_one();
+
+		if (captured)
+			process_queue_->push(c);
+	}
+}
+
+void CampaignScheduler::processLoop()
+{
+	Capture c;
+	while (process_queue_->pop(c))
+	{
+		PoseTiming &t = timings_[c.index];
+		double start = now();
+		t.ok = process_(c.index, c.handoff);
+		t.processed = now();
+		stages_[2].busy += t.processed - start;
+		stages_[2].items++;
+	}
+}
+
+/********************************************************
+*  @function :  report
+*  @brief    :  print per-stage utilization and the cycle time per pose
+*  @input    :  out
+*  @return   :  null
+*********************************************************/
+void CampaignScheduler::report(FILE *out) const
+{
+	fprintf(out, "campaign: %u poses in %.1f s\n", (unsigned int)timings_.size(), wall_ / 1000.0);
+	for (int i = 0; i < 3; i++)
+	{
+		fprintf(out, "  %-10s %4u poses  busy %8.1f s  utilization %5.1f%%\n", stages_[i].name,
+			(unsigned int)stages_[i].items, stages_[i].busy / 1000.0,
+			wall_ > 0 ? 100.0 * stages_[i].busy / wall_ : 0.0);
+	}
+
+	//cycle time: from the start of the move to the end of the last stage it reached
+	std::vector<double> cycles;
+	for (size_t i = 0; i < timings_.size(); i++)
+	{
+		const PoseTiming &t = timings_[i];
+		double end = std::max(std::max(t.moved, t.captured), t.processed);
+		double cycle = end - t.move_start;
+		cycles.push_back(cycle);
+		fprintf(out, "  pose %3u  move %7.1f  capture %7.1f  process %7.1f  cycle %7.1f ms  %s\n",
+			(unsigned int)t.index, t.moved - t.move_start,
+			t.captured >= 0 ? t.captured - t.moved : 0.0,
+			t.processed >= 0 ? t.processed - t.captured : 0.0,
+			cycle, t.ok ? "ok" : "failed");
+	}
+	if (!cycles.empty())
+	{
+		double sum = 0;
+		for (size_t i = 0; i < cycles.size(); i++)
+			sum += cycles[i];
+		fprintf(out, "  mean cycle %.1f ms, one pose every %.1f ms\n",
+			sum / cycles.size(), wall_ / cycles.size());
+	}
+}
@@ -0,0 +1,191 @@
+/********************************************************
+* @file    : campaign_scheduler.h
+* @brief   : pipelined scan campaign: robot motion, capture, processing
+* @details : The three stages of a scan run on their own threads and hand
+*            poses on through bounded queues. The robot holds still
+*            while the scanner captures, so pose N+1 is only approached
+*            once the capture at pose N is done, but the reconstruction
+*            and saving of pose N overlap with that move. A full
+*            processing queue holds the scanner back, which in turn
+*            holds the robot back, so a slow stage never piles up work.
+*********************************************************/
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/********************************************************
+*  @class    :  BoundedQueue
+*  @brief    :  blocking FIFO with a fixed capacity; close() wakes every
+*               waiter and makes pop() fail once the queue is drained
+*********************************************************/
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1), closed_(false) {}
+
+	//blocks while full, returns false if the queue was closed
+	bool push(const T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+		if (closed_)
+			return false;
+		items_.push_back(item);
+		not_empty_.notify_one();
+		return true;
+	}
+
+	//blocks while empty, returns false once closed and drained
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+		if (items_.empty())
+			return false;
+		item = items_.front();
+		items_.pop_front();
+		not_full_.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+		not_empty_.notify_all();
+		not_full_.notify_all();
+	}
+
+private:
+	size_t capacity_;
+	bool closed_;
+	std::deque<T> items_;
+	std::mutex mutex_;
+	std::condition_variable not_empty_;
+	std::condition_variable not_full_;
+};
+
+/********************************************************
+*  @class    :  Semaphore
+*  @brief    :  counting semaphore; acquire() blocks while all slots are
+*               taken, a limit of 0 means no limit. Slots may be released
+*               by another thread than the one that took them.
+*********************************************************/
+class Semaphore
+{
+public:
+	explicit Semaphore(size_t limit = 0) : limit_(limit), taken_(0) {}
+
+	void setLimit(size_t limit)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		limit_ = limit;
+		freed_.notify_all();
+	}
+
+	void acquire()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		freed_.wait(lock, [this] { return limit_ == 0 || taken_ < limit_; });
+		taken_++;
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (taken_ > 0)
+			taken_--;
+		freed_.notify_one();
+	}
+
+private:
+	size_t limit_;
+	size_t taken_;
+	std::mutex mutex_;
+	std::condition_variable freed_;
+};
+
+//time one pose spent in the pipeline, in milliseconds from campaign start
+struct PoseTiming
+{
+	size_t index;
+	double move_start;
+	double moved;		//robot arrived (or gave up)
+	double captured;	//scanner done, robot released
+	double processed;	//reconstructed and saved
+	bool ok;		//made it through all three stages
+};
+
+//what the capture stage of a pose hands on to its processing stage
+struct CaptureHandoff
+{
+	CaptureHandoff() : kind(0) {}
+
+	std::string data;	//e.g. a mesh file, or an id to wait for
+	int kind;		//how the capture was made, up to the stages
+};
+
+struct StageStats
+{
+	const char *name;
+	double busy;		//milliseconds spent working
+	size_t items;
+};
+
+class CampaignScheduler
+{
+public:
+	//stage callbacks; each returns false if the pose failed in that stage
+	typedef std::function<bool(size_t index)> MoveStage;
+	typedef std::function<bool(size_t index, CaptureHandoff &capture)> CaptureStage;
+	typedef std::function<bool(size_t index, const CaptureHandoff &capture)> ProcessStage;
+
+	CampaignScheduler(MoveStage move, CaptureStage capture, ProcessStage process,
+		size_t process_queue_depth = 2);
+
+	//run the campaign over poses 0..count-1. The motion stage runs on
+	//the calling thread, so a non thread safe robot link stays on it.
+	void run(size_t count);
+
+	void report(FILE *out) const;
+
+	const std::vector<PoseTiming> &timings() const { return timings_; }
+	const StageStats &stage(int i) const { return stages_[i]; }
+	double wallTime() const { return wall_; }
+
+private:
+	struct Capture
+	{
+		size_t index;
+		CaptureHandoff handoff;
+	};
+
+	double now() const;
+	void captureLoop();
+	void processLoop();
+
+	MoveStage move_;
+	CaptureStage capture_;
+	ProcessStage process_;
+	size_t process_queue_depth_;
+
+	std::chrono::steady_clock::time_point start_;
+	std::vector<PoseTiming> timings_;
+	StageStats stages_[3];
+	double wall_;
+
+	//robot -> scanner: one pose at a time, released when the capture ends
+	BoundedQueue<size_t> *capture_queue_;
+	BoundedQueue<Capture> *process_queue_;
+	std::mutex released_mutex_;
+	std::condition_variable released_cv_;
+	bool released_;
+};
@@ -0,0 +1,332 @@
+/********************************************************
+* @file    : capture_client.cpp
+* @brief   : client of the resident capture service
+*********************************************************/
+#include "stdafx.h"
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include "capture_client.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#define SEND_FLAGS 0
+#else
+//BSD sockets under their winsock names
+typedef int SOCKET;
+typedef int BOOL;
+typedef unsigned short u_short;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define TRUE 1
+#define SD_BOTH SHUT_RDWR
+#define closesocket close
+#define SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+#define SOCK ((SOCKET)socket_)
+
+CaptureClient::CaptureClient() : socket_((uintptr_t)INVALID_SOCKET), connected_(false)
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+}
+
+CaptureClient::~CaptureClient()
+{
+	disconnect();
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+/********************************************************
+*  @function :  connect
+*  @brief    :  connect to the service on localhost, retrying until the
+*               timeout since a service that was just started may not be
+*               listening yet
+*  @input    :  port, timeout_ms
+*  @return   :  true if connected
+*********************************************************/
+bool CaptureClient::connect(int port, unsigned long timeout_ms)
+{
+	disconnect();
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons((u_short)port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while (true)
+	{
+		SOCKET s = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (s == INVALID_SOCKET)
+			return false;
+		if (::connect(s, (sockaddr*)&address, sizeof(address)) != SOCKET_ERROR)
+		{
+			BOOL nodelay = TRUE;
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+			socket_ = (uintptr_t)s;
+			break;
+		}
+		closesocket(s);
+		if (std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(timeout_ms))
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		connected_ = true;
+		replies_.clear();
+	}
+	reader_ = std::thread(&CaptureClient::readLoop, this);
+	return true;
+}
+
+/********************************************************
+*  @function :  startServer
+*  @brief    :  launch the capture sample in resident mode, in the
+*               working directory of this process, and connect to it
+*  @input    :  exe, port, timeout_ms for the scanner to come up,
+*               serial of the scanner, empty for the first one found
+*  @return   :  true if connected
+*********************************************************/
+bool CaptureClient::startServer(const std::string &exe, int port, unsigned long timeout_ms,
+	const std::string &serial)
+{
+	std::string port_text = std::to_string(port);
+#ifdef _WIN32
+	std::string command = "\"" + exe + "\" --serve " + port_text;
+	if (!serial.empty())
+		command += " \"" + serial + "\"";
+	STARTUPINFOA startup = { 0 };
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION process = { 0 };
+	if (!CreateProcessA(NULL, &command[0], NULL, NULL, FALSE, 0, NULL, NULL, &startup, &process))
+	{
+		std::cerr << "Could not start " << exe << " (" << GetLastError() << ")" << std::endl;
+		return false;
+	}
+	CloseHandle(process.hThread);
+	CloseHandle(process.hProcess);
+#else
+	//forked twice, so the service is nobody's child to wait for
+	pid_t child = fork();
+	if (child < 0)
+	{
+		std::cerr << "Could not start " << exe << std::endl;
+		return false;
+	}
+	if (child == 0)
+	{
+		if (fork() == 0)
+			execl(exe.c_str(), exe.c_str(), "--serve", port_text.c_str(),
+				serial.empty() ? (char *)NULL : serial.c_str(), (char *)NULL);
+		_exit(127);
+	}
+	waitpid(child, NULL, 0);
+#endif
+	return connect(port, timeout_ms);
+}
+
+bool CaptureClient::connected()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return connected_;
+}
+
+/********************************************************
+*  @function :  capture
+*  @brief    :  request a capture, return once the frame is taken; the
+*               reconstruction goes on in the service
+*  @input    :  id of the pose, timeout_ms
+*  @return   :  true if the frame was taken
+*********************************************************/
+bool CaptureClient::capture(const std::string &id, unsigned long timeout_ms)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		replies_[id] = Reply();
+	}
+	if (!send("CAPTURE " + id))
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		replies_.erase(id);
+		return false;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	changed_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, &id] {
+		const Reply &r = replies_[id];
+		return r.captured || r.failed || !connected_;
+	});
+	std::map<std::string, Reply>::iterator it = replies_.find(id);
+	if (it->second.failed)
+		std::cerr << "Capture " << id << " failed: " << it->second.error << std::endl;
+	bool captured = it->second.captured;
+	if (!captured)
+		replies_.erase(it);	//nobody waits for its mesh
+	return captured;
+}
+
+/********************************************************
+*  @function :  waitSaved
+*  @brief    :  wait until the mesh of a capture is on disk
+*  @input    :  id of the pose, &file, timeout_ms, times to fill in or NULL
+*  @return   :  true if saved, file holds its full path
+*********************************************************/
+bool CaptureClient::waitSaved(const std::string &id, std::string &file, unsigned long timeout_ms,
+	CaptureTimes *times)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (replies_.find(id) == replies_.end())
+		return false;	//not captured, or already given up on
+	changed_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, &id] {
+		const Reply &r = replies_[id];
+		return r.saved || r.failed || !connected_;
+	});
+	//saved, failed or given up on, the caller is done with it either way
+	Reply r = replies_[id];
+	replies_.erase(id);
+	if (r.failed)
+		std::cerr << "Capture " << id << " failed: " << r.error << std::endl;
+	file = r.file;
+	if (times && r.saved)
+	{
+		//a service without RECONSTRUCTING or RECONSTRUCTED replies counts
+		//the missing steps as reconstruction
+		std::chrono::steady_clock::time_point started = r.started ? r.started_at : r.captured_at;
+		std::chrono::steady_clock::time_point reconstructed = r.reconstructed ? r.reconstructed_at : r.saved_at;
+		times->queue = std::chrono::duration<double, std::milli>(started - r.captured_at).count();
+		times->reconstruct = std::chrono::duration<double, std::milli>(reconstructed - started).count();
+		times->save = std::chrono::duration<double, std::milli>(r.saved_at - reconstructed).count();
+	}
+	return r.saved;
+}
+
+void CaptureClient::quit()
+{
+	if (send("QUIT"))
+	{
+		//the service answers BYE and closes, which ends the reader
+		std::unique_lock<std::mutex> lock(mutex_);
+		changed_.wait_for(lock, std::chrono::seconds(5), [this] { return !connected_; });
+	}
+	disconnect();
+}
+
+bool CaptureClient::send(const std::string &line)
+{
+	std::string message = line + "\n";
+	if (!connected())
+		return false;
+	return ::send(SOCK, message.c_str(), (int)message.size(), SEND_FLAGS) == (int)message.size();
+}
+
+void CaptureClient::readLoop()
+{
+	std::string line;
+	char buffer[512];
+	while (true)
+	{
+		int got = recv(SOCK, buffer, sizeof(buffer), 0);
+		if (got <= 0)
+			break;
+		for (int i = 0; i < got; i++)
+		{
+			if (buffer[i] == '\r')
+				continue;
+			if (buffer[i] != '\n')
+			{
+				line += buffer[i];
+				continue;
+			}
+			handle(line);
+			line.clear();
+		}
+	}
+	std::lock_guard<std::mutex> lock(mutex_);
+	connected_ = false;
+	changed_.notify_all();
+}
+
+//CAPTURED <id> | RECONSTRUCTING <id> | RECONSTRUCTED <id> | SAVED <id> <file> |
+//FAILED <id> <error>
+void CaptureClient::handle(const std::string &line)
+{
+	size_t first = line.find(' ');
+	if (first == std::string::npos)
+		return;	//PONG, BYE
+	std::string kind = line.substr(0, first);
+	size_t second = line.find(' ', first + 1);
+	std::string id = line.substr(first + 1, second == std::string::npos ? std::string::npos : second - first - 1);
+	std::string rest = second == std::string::npos ? "" : line.substr(second + 1);
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mutex_);
+	//late replies of a request given up on are dropped, not kept forever
+	std::map<std::string, Reply>::iterator it = replies_.find(id);
+	if (it == replies_.end())
+		return;
+	Reply &r = it->second;
+	if (kind == "CAPTURED")
+	{
+		r.captured = true;
+		r.captured_at = now;
+	}
+	else if (kind == "RECONSTRUCTING")
+	{
+		r.started = true;
+		r.started_at = now;
+	}
+	else if (kind == "RECONSTRUCTED")
+	{
+		r.reconstructed = true;
+		r.reconstructed_at = now;
+	}
+	else if (kind == "SAVED")
+	{
+		if (!r.captured)
+			r.captured_at = now;
+		r.captured = true;
+		r.saved = true;
+		r.saved_at = now;
+		r.file = rest;
+	}
+	else if (kind == "FAILED")
+	{
+		r.failed = true;
+		r.error = rest;
+	}
+	changed_.notify_all();
+}
+
+void CaptureClient::disconnect()
+{
+	if ((SOCKET)socket_ != INVALID_SOCKET)
+	{
+		shutdown(SOCK, SD_BOTH);
+		closesocket(SOCK);
+	}
+	if (reader_.joinable())
+		reader_.join();
+	socket_ = (uintptr_t)INVALID_SOCKET;
+	std::lock_guard<std::mutex> lock(mutex_);
+	connected_ = false;
+}
@@ -0,0 +1,85 @@
+/********************************************************
+* @file    : capture_client.h
+* @brief   : client of the resident capture service
+* @details : simple-capture-sample.exe --serve keeps the scanner and its
+*            frame processor open and takes capture requests on a
+*            localhost port, see its ReadMe.txt. The replies of a request
+*            come in steps, CAPTURED once the frame is taken and SAVED
+*            once it is reconstructed and on disk, so a caller can
+*            move the robot on after the first and pick up the mesh
+*            later. A reader thread collects the replies, so one thread
+*            may wait for captures while another waits for saves.
+*********************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+//time the service spent on a capture after the frame was taken, in milliseconds
+struct CaptureTimes
+{
+	double queue;	//behind earlier frames, until its reconstruction started
+	double reconstruct;
+	double save;
+};
+
+class CaptureClient
+{
+public:
+	CaptureClient();
+	~CaptureClient();
+
+	//connect to a service already running on this machine
+	bool connect(int port, unsigned long timeout_ms);
+
+	//start exe --serve port [serial] and connect to it
+	bool startServer(const std::string &exe, int port, unsigned long timeout_ms,
+		const std::string &serial = "");
+
+	bool connected();
+
+	//request a capture and wait until the frame is taken
+	bool capture(const std::string &id, unsigned long timeout_ms);
+
+	//wait until the frame of a capture is saved, file gets its path
+	bool waitSaved(const std::string &id, std::string &file, unsigned long timeout_ms,
+		CaptureTimes *times = NULL);
+
+	//ask the service to exit and disconnect
+	void quit();
+
+private:
+	struct Reply
+	{
+		Reply() : captured(false), started(false), reconstructed(false), saved(false), failed(false) {}
+		bool captured;
+		bool started;
+		bool reconstructed;
+		bool saved;
+		bool failed;
+		std::string file;
+		std::string error;
+		//when each reply came in
+		std::chrono::steady_clock::time_point captured_at;
+		std::chrono::steady_clock::time_point started_at;
+		std::chrono::steady_clock::time_point reconstructed_at;
+		std::chrono::steady_clock::time_point saved_at;
+	};
+
+	bool send(const std::string &line);
+	void readLoop();
+	void handle(const std::string &line);
+	void disconnect();
+
+	uintptr_t socket_;	//a SOCKET, winsock2.h stays out of this header
+	bool connected_;
+	std::thread reader_;
+	std::mutex mutex_;
+	std::condition_variable changed_;
+	std::map<std::string, Reply> replies_;
+};
@@ -0,0 +1,199 @@
+/********************************************************
+* @file    : ik_check.cpp
+* @brief   : reachability of the scan poses before the campaign starts
+*********************************************************/
+#include "stdafx.h"
+#include "ik_check.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <fstream>
+#include <moveit_msgs/MoveItErrorCodes.h>
+
+bool IkKey::operator<(const IkKey &other) const
+{
+	for (int i = 0; i < 7; i++)
+	{
+		if (v[i] != other.v[i])
+			return v[i] < other.v[i];
+	}
+	return false;
+}
+
+static int32_t quantize(double value, double step)
+{
+	return (int32_t)floor(value / step + 0.5);
+}
+
+IkKey ikKey(const geometry_msgs::Pose &pose)
+{
+	const geometry_msgs::Quaternion &q = pose.orientation;
+	double sign = q.w < 0 ? -1 : 1;
+	IkKey key;
+	key.v[0] = quantize(pose.position.x, IK_POSITION_STEP);
+	key.v[1] = quantize(pose.position.y, IK_POSITION_STEP);
+	key.v[2] = quantize(pose.position.z, IK_POSITION_STEP);
+	key.v[3] = quantize(sign * q.x, IK_ORIENTATION_STEP);
+	key.v[4] = quantize(sign * q.y, IK_ORIENTATION_STEP);
+	key.v[5] = quantize(sign * q.z, IK_ORIENTATION_STEP);
+	key.v[6] = quantize(sign * q.w, IK_ORIENTATION_STEP);
+	return key;
+}
+
+/********************************************************
+*  @function :  load
+*  @brief    :  read the cache at path; lines that do not parse are
+*               dropped, the rest is kept
+*  @input    :  path, group and link the answers are for
+*  @return   :  null
+*********************************************************/
+void IkCache::load(const char *path, const std::string &group, const std::string &link)
+{
+	group_ = group;
+	link_ = link;
+	entries_.clear();
+	std::ifstream in(path);
+	std::string text;
+	if (!std::getline(in, text))
+		return;
+	int version = 0;
+	char file_group[64], file_link[64];
+	if (sscanf(text.c_str(), "# autoscan ik cache %d %63s %63s", &version, file_group, file_link) != 3 ||
+		version != IK_CACHE_VERSION || group != file_group || link != file_link)
+		return;
+
+	while (std::getline(in, text))
+	{
+		IkKey key;
+		IkSolution solution;
+		unsigned int count = 0;
+		int used = 0;
+		if (sscanf(text.c_str(), "%d %d %d %d %d %d %d %d %u%n", &key.v[0], &key.v[1], &key.v[2],
+			&key.v[3], &key.v[4], &key.v[5], &key.v[6], &solution.error_code, &count, &used) != 9)
+			continue;
+		const char *p = text.c_str() + used;
+		solution.joints.resize(count);
+		for (unsigned int i = 0; i < count && p; i++)
+		{
+			int field = 0;
+			if (sscanf(p, "%lf%n", &solution.joints[i], &field) != 1)
+				p = NULL;
+			else
+				p += field;
+		}
+		if (p == NULL)
+			continue;	//torn by a crash
+		solution.checked = true;
+		solution.reachable = solution.error_code == moveit_msgs::MoveItErrorCodes::SUCCESS;
+		entries_[key] = solution;
+	}
+}
+
+//the whole cache to a new file, then over the old one
+bool IkCache::save(const char *path) const
+{
+	std::string temp = std::string(path) + ".tmp";
+	FILE *file = fopen(temp.c_str(), "w");
+	if (file == NULL)
+		return false;
+	fprintf(file, "# autoscan ik cache %d %s %s\n", IK_CACHE_VERSION, group_.c_str(), link_.c_str());
+	for (std::map<IkKey, IkSolution>::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+	{
+		const IkKey &key = it->first;
+		fprintf(file, "%d %d %d %d %d %d %d %d %u", key.v[0], key.v[1], key.v[2], key.v[3], key.v[4],
+			key.v[5], key.v[6], it->second.error_code, (unsigned int)it->second.joints.size());
+		for (size_t i = 0; i < it->second.joints.size(); i++)
+			fprintf(file, " %.9g", it->second.joints[i]);
+		fputc('\n', file);
+	}
+	bool written = fclose(file) == 0;
+	if (written)
+	{
+		remove(path);
+		written = rename(temp.c_str(), path) == 0;
+	}
+	return written;
+}
+
+bool IkCache::find(const geometry_msgs::Pose &pose, IkSolution &solution) const
+{
+	std::map<IkKey, IkSolution>::const_iterator it = entries_.find(ikKey(pose));
+	if (it == entries_.end())
+		return false;
+	solution = it->second;
+	return true;
+}
+
+void IkCache::put(const geometry_msgs::Pose &pose, const IkSolution &solution)
+{
+	if (solution.checked && (solution.error_code == moveit_msgs::MoveItErrorCodes::SUCCESS ||
+		solution.error_code == moveit_msgs::MoveItErrorCodes::NO_IK_SOLUTION))
+		entries_[ikKey(pose)] = solution;
+}
+
+IkCheck::IkCheck()
+	: client(IK_SERVICE)
+{
+}
+
+void IkCheck::configure(const char *group, const char *link, const char *frame, bool avoid_collisions)
+{
+	moveit_msgs::PositionIKRequest &ik = request_.ik_request;
+	ik.group_name = group;
+	ik.ik_link_name = link;
+	ik.pose_stamped.header.frame_id = frame;
+	ik.robot_state.is_diff = true;	//solve from the current state
+	ik.avoid_collisions = avoid_collisions;
+	ik.timeout = ros::Duration(0, IK_SOLVER_TIMEOUT_MS * 1000000);
+}
+
+/********************************************************
+*  @function :  solve
+*  @brief    :  ask for an IK solution of every pose, keeping up to
+*               IK_PIPELINE calls in flight
+*  @input    :  &poses, &solutions gets one answer per pose
+*  @return   :  number of poses checked, the first ones in order
+*********************************************************/
+size_t IkCheck::solve(const std::vector<geometry_msgs::Pose> &poses, std::vector<IkSolution> &solutions)
+{
+	solutions.assign(poses.size(), IkSolution());
+	IkClient::Future calls[IK_PIPELINE];
+	size_t sent = 0, done = 0, checked = 0;
+	bool failed = false;
+	for (;;)
+	{
+		//keep the pipeline full
+		while (!failed && sent < poses.size() && sent - done < IK_PIPELINE)
+		{
+			request_.ik_request.pose_stamped.pose = poses[sent];
+			calls[sent % IK_PIPELINE] = client.callAsync(request_, responses_[sent % IK_PIPELINE], IK_CALL_TIMEOUT);
+			if (calls[sent % IK_PIPELINE].status() == ros::CALL_FAILED)
+				failed = true;
+			else
+				sent++;
+		}
+		if (done == sent)
+			break;
+
+		//answered in order, the oldest call completes first; once one
+		//fails the ones behind it are still waited for, not sent again
+		size_t slot = done % IK_PIPELINE;
+		if (calls[slot].wait() == ros::CALL_SUCCEEDED && !failed)
+		{
+			const moveit_msgs::GetPositionIKResponse &response = responses_[slot];
+			IkSolution &solution = solutions[done];
+			solution.checked = true;
+			solution.error_code = response.error_code.val;
+			solution.reachable = solution.error_code == moveit_msgs::MoveItErrorCodes::SUCCESS;
+			const sensor_msgs::JointState &joints = response.solution.joint_state;
+			solution.joints.assign(joints.position, joints.position + joints.position_length);
+			checked++;
+		}
+		else
+		{
+			failed = true;
+		}
+		done++;
+	}
+	return checked;
+}
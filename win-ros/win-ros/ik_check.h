@@ -0,0 +1,114 @@
+/********************************************************
+* @file    : ik_check.h
+* @brief   : reachability of the scan poses before the campaign starts
+* @details : Every pose goes through MoveIt's GetPositionIK service
+*            (move_group's compute_ik) before the robot moves, so poses
+*            without an IK solution are skipped instead of costing a
+*            publish, plan and wait cycle each. Calls are pipelined: up to
+*            IK_PIPELINE requests are in flight at once, and as rosserial
+*            answers a client's calls in order, the oldest one is always
+*            the next to complete.
+*            Answers are kept in an IkCache on disk, keyed by the pose
+*            quantized to IK_POSITION_STEP and IK_ORIENTATION_STEP, so a
+*            repeated campaign asks only about poses it has not seen. The
+*            cache holds SUCCESS and NO_IK_SOLUTION answers only; other
+*            errors say nothing about the pose and are asked again. It is
+*            only valid for the robot, group and planning scene it was
+*            made with: delete it when any of them change.
+*            IK is necessary, not sufficient: a reachable pose can still
+*            fail to plan, and is then reported by the move as before.
+*********************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "ros.h"
+#include <geometry_msgs/Pose.h>
+#include <moveit_msgs/GetPositionIK.h>
+
+#define IK_SERVICE "compute_ik"
+#define IK_CACHE_VERSION 1
+//calls in flight, the most ServiceClient keeps track of
+#define IK_PIPELINE 16
+//quantization of the cache key: 0.1 mm and 1e-4 of a unit quaternion,
+//ten times finer than the goal tolerances
+#define IK_POSITION_STEP 1e-4
+#define IK_ORIENTATION_STEP 1e-4
+//deadline of one call, and of the solver on the ROS side
+#define IK_CALL_TIMEOUT 5000
+#define IK_SOLVER_TIMEOUT_MS 50
+
+typedef ros::ServiceClient<moveit_msgs::GetPositionIKRequest, moveit_msgs::GetPositionIKResponse> IkClient;
+
+//a pose quantized, see IK_POSITION_STEP
+struct IkKey
+{
+	int32_t v[7];
+
+	bool operator<(const IkKey &other) const;
+};
+
+//key of a pose; q and -q are the same orientation and get the same key
+IkKey ikKey(const geometry_msgs::Pose &pose);
+
+struct IkSolution
+{
+	IkSolution() : checked(false), reachable(false), error_code(0) {}
+
+	bool checked;		//false if nobody could tell
+	bool reachable;
+	int error_code;		//MoveItErrorCodes of the answer
+	std::vector<double> joints;	//the solution, in the group's joint order
+};
+
+/********************************************************
+*  @class    :  IkCache
+*  @brief    :  IK answers by pose, one text line each:
+*                 # autoscan ik cache 1 <group> <link>
+*                 <key> <error_code> <joint count> <joints>
+*********************************************************/
+class IkCache
+{
+public:
+	//start empty when the file is missing or was made for another
+	//group or link
+	void load(const char *path, const std::string &group, const std::string &link);
+	bool save(const char *path) const;
+
+	bool find(const geometry_msgs::Pose &pose, IkSolution &solution) const;
+	//keeps checked answers that tell something about the pose
+	void put(const geometry_msgs::Pose &pose, const IkSolution &solution);
+
+	size_t size() const { return entries_.size(); }
+
+private:
+	std::string group_;
+	std::string link_;
+	std::map<IkKey, IkSolution> entries_;
+};
+
+/********************************************************
+*  @class    :  IkCheck
+*  @brief    :  pipelined GetPositionIK calls; register client with the
+*               node handle before it connects
+*********************************************************/
+class IkCheck
+{
+public:
+	IkCheck();
+
+	void configure(const char *group, const char *link, const char *frame, bool avoid_collisions);
+
+	//solve every pose, IK_PIPELINE calls at a time; stops at the first
+	//call that fails or times out and leaves the rest unchecked
+	//returns the number of poses checked
+	size_t solve(const std::vector<geometry_msgs::Pose> &poses, std::vector<IkSolution> &solutions);
+
+	IkClient client;
+
+private:
+	moveit_msgs::GetPositionIKRequest request_;
+	moveit_msgs::GetPositionIKResponse responses_[IK_PIPELINE];
+};
@@ -0,0 +1,295 @@
+/********************************************************
+* @file    : path_optimizer.cpp
+* @brief   : order the poses of a campaign for the shortest robot travel
+*********************************************************/
+#include "stdafx.h"
+#include "path_optimizer.h"
+
+#include <math.h>
+#include <algorithm>
+#include <thread>
+#include <utility>
+
+//no pose: past the end of the path
+#define NO_POSE ((size_t)-1)
+//smallest gain a change must bring, keeps rounding from cycling
+#define MIN_GAIN 1e-9
+
+PathOptimizer::PathOptimizer(const PoseSet &poses, const PathMetric &metric)
+	: poses_(poses), metric_(metric), neighbours_(0)
+{
+}
+
+double PathOptimizer::cost(size_t a, size_t b) const
+{
+	if (a == NO_POSE || b == NO_POSE)
+		return 0;
+	double dx = poses_.x[a] - poses_.x[b];
+	double dy = poses_.y[a] - poses_.y[b];
+	double dz = poses_.z[a] - poses_.z[b];
+	double translation = sqrt(metric_.axis_weight[0] * dx * dx +
+		metric_.axis_weight[1] * dy * dy + metric_.axis_weight[2] * dz * dz);
+
+	//q and -q are the same orientation
+	double dot = fabs(poses_.qx[a] * poses_.qx[b] + poses_.qy[a] * poses_.qy[b] +
+		poses_.qz[a] * poses_.qz[b] + poses_.qw[a] * poses_.qw[b]);
+	double angle = 2 * acos(std::min(dot, 1.0));
+	return translation + metric_.rotation_weight * angle;
+}
+
+double PathOptimizer::pathCost(const std::vector<size_t> &order) const
+{
+	double total = 0;
+	for (size_t i = 1; i < order.size(); i++)
+		total += cost(order[i - 1], order[i]);
+	return total;
+}
+
+/********************************************************
+*  @function :  buildNeighbours
+*  @brief    :  find the closest poses of every pose, one stripe of poses
+*               per core
+*  @input    :  null
+*  @return   :  null
+*********************************************************/
+void PathOptimizer::buildNeighbours()
+{
+	size_t n = poses_.size();
+	neighbours_ = std::min((size_t)PATH_NEIGHBOURS, n - 1);
+	neighbour_.assign(n * neighbours_, 0);
+
+	size_t threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, n);
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; t++)
+	{
+		workers.push_back(std::thread([this, n, t, threads] {
+			std::vector<std::pair<double, size_t> > candidates;
+			candidates.reserve(n);
+			for (size_t i = t; i < n; i += threads)
+			{
+				candidates.clear();
+				for (size_t j = 0; j < n; j++)
+				{
+					if (j != i)
+						candidates.push_back(std::make_pair(cost(i, j), j));
+				}
+				std::partial_sort(candidates.begin(), candidates.begin() + neighbours_, candidates.end());
+				for (size_t k = 0; k < neighbours_; k++)
+					neighbour_[i * neighbours_ + k] = candidates[k].second;
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+}
+
+//greedy path from pose 0, always to the closest pose not visited yet
+void PathOptimizer::nearestNeighbour(std::vector<size_t> &path) const
+{
+	size_t n = poses_.size();
+	std::vector<bool> visited(n, false);
+	path.clear();
+	path.push_back(0);
+	visited[0] = true;
+	while (path.size() < n)
+	{
+		size_t from = path.back();
+		size_t next = NO_POSE;
+		for (size_t k = 0; k < neighbours_ && next == NO_POSE; k++)
+		{
+			size_t c = neighbour_[from * neighbours_ + k];
+			if (!visited[c])
+				next = c;
+		}
+		if (next == NO_POSE)
+		{
+			//every close pose is taken, look at all of them
+			double best = 0;
+			for (size_t c = 0; c < n; c++)
+			{
+				if (visited[c])
+					continue;
+				double d = cost(from, c);
+				if (next == NO_POSE || d < best)
+				{
+					next = c;
+					best = d;
+				}
+			}
+		}
+		path.push_back(next);
+		visited[next] = true;
+	}
+}
+
+/********************************************************
+*  @function :  twoOpt
+*  @brief    :  for each pose a and close pose c, reverse the stretch
+*               between them if joining a to c shortens the path. The
+*               path stays open and starts at pose 0.
+*  @input    :  &path, &position of each pose in the path
+*  @return   :  true if the path got shorter
+*********************************************************/
+bool PathOptimizer::twoOpt(std::vector<size_t> &path, std::vector<size_t> &position) const
+{
+	size_t n = path.size();
+	bool improved = false;
+	bool changed = true;
+	while (changed && !expired())
+	{
+		changed = false;
+		for (size_t a = 0; a < n; a++)
+		{
+			for (size_t k = 0; k < neighbours_; k++)
+			{
+				size_t c = neighbour_[a * neighbours_ + k];
+				size_t p = std::min(position[a], position[c]);
+				size_t q = std::max(position[a], position[c]);
+				if (q == p + 1)
+					continue;	//already joined
+
+				//path[p] path[p+1] ... path[q] path[q+1]  ->  path[p] path[q] ... path[p+1] path[q+1]
+				size_t u = path[p], v = path[p + 1], w = path[q];
+				size_t x = q + 1 < n ? path[q + 1] : NO_POSE;
+				double delta = cost(u, w) + cost(v, x) - cost(u, v) - cost(w, x);
+				if (delta >= -MIN_GAIN)
+					continue;
+
+				std::reverse(path.begin() + p + 1, path.begin() + q + 1);
+				for (size_t i = p + 1; i <= q; i++)
+					position[path[i]] = i;
+				changed = improved = true;
+			}
+		}
+	}
+	return improved;
+}
+
+/********************************************************
+*  @function :  orOpt
+*  @brief    :  move a run of one to three poses next to a pose close to
+*               either end of it, forwards or reversed
+*  @input    :  &path, &position of each pose in the path
+*  @return   :  true if the path got shorter
+*********************************************************/
+bool PathOptimizer::orOpt(std::vector<size_t> &path, std::vector<size_t> &position) const
+{
+	size_t n = path.size();
+	bool improved = false;
+	for (size_t i = 1; i < n && !expired(); i++)
+	{
+		for (size_t length = 1; length <= 3 && i + length <= n; length++)
+		{
+			size_t prev = path[i - 1];
+			size_t first = path[i];
+			size_t last = path[i + length - 1];
+			size_t next = i + length < n ? path[i + length] : NO_POSE;
+			double removed = cost(prev, first) + cost(last, next) - cost(prev, next);
+			if (removed <= MIN_GAIN)
+				continue;
+
+			//best place: between path[at] and path[at+1]
+			double best = -MIN_GAIN;
+			size_t best_at = NO_POSE;
+			bool best_reversed = false;
+			for (int end = 0; end < 2; end++)
+			{
+				size_t from = end ? last : first;
+				for (size_t k = 0; k < neighbours_; k++)
+				{
+					size_t c = neighbour_[from * neighbours_ + k];
+					//after c, or before it
+					for (int side = 0; side < 2; side++)
+					{
+						if (side == 1 && position[c] == 0)
+							continue;
+						size_t at = side ? position[c] - 1 : position[c];
+						if (at + 1 >= i && at < i + length)
+							continue;	//in or next to the run itself
+						size_t g = path[at];
+						size_t h = at + 1 < n ? path[at + 1] : NO_POSE;
+						double forward = cost(g, first) + cost(last, h) - cost(g, h) - removed;
+						double reversed = cost(g, last) + cost(first, h) - cost(g, h) - removed;
+						if (forward < best)
+						{
+							best = forward;
+							best_at = at;
+							best_reversed = false;
+						}
+						if (reversed < best)
+						{
+							best = reversed;
+							best_at = at;
+							best_reversed = true;
+						}
+					}
+				}
+			}
+			if (best_at == NO_POSE)
+				continue;
+
+			std::vector<size_t> run(path.begin() + i, path.begin() + i + length);
+			if (best_reversed)
+				std::reverse(run.begin(), run.end());
+			path.erase(path.begin() + i, path.begin() + i + length);
+			size_t insert = best_at < i ? best_at + 1 : best_at + 1 - length;
+			path.insert(path.begin() + insert, run.begin(), run.end());
+			size_t low = std::min(i, insert);
+			size_t high = std::max(i, insert) + length;
+			for (size_t j = low; j < high && j < n; j++)
+				position[path[j]] = j;
+			improved = true;
+			break;
+		}
+	}
+	return improved;
+}
+
+/********************************************************
+*  @function :  optimize
+*  @brief    :  nearest neighbour path, refined until no change helps
+*               or the time is up
+*  @input    :  time_limit_ms
+*  @return   :  pose indices in the order to visit them
+*********************************************************/
+std::vector<size_t> PathOptimizer::optimize(unsigned long time_limit_ms)
+{
+	size_t n = poses_.size();
+	std::vector<size_t> path;
+	if (n < 3)
+	{
+		for (size_t i = 0; i < n; i++)
+			path.push_back(i);
+		return path;
+	}
+
+	deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(time_limit_ms);
+	buildNeighbours();
+	nearestNeighbour(path);
+
+	std::vector<size_t> position(n);
+	for (size_t i = 0; i < n; i++)
+		position[path[i]] = i;
+	while (!expired())
+	{
+		bool shorter = twoOpt(path, position);
+		shorter = orOpt(path, position) || shorter;
+		if (!shorter)
+			break;
+	}
+	return path;
+}
+
+void reorderPoses(PoseSet &poses, const std::vector<size_t> &order)
+{
+	PoseSet ordered;
+	ordered.reserve(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		size_t j = order[i];
+		ordered.push(poses.x[j], poses.y[j], poses.z[j],
+			poses.qx[j], poses.qy[j], poses.qz[j], poses.qw[j], poses.line[j]);
+	}
+	std::swap(poses, ordered);
+}
@@ -0,0 +1,65 @@
+/********************************************************
+* @file    : path_optimizer.h
+* @brief   : order the poses of a campaign for the shortest robot travel
+* @details : The cost of a move is the weighted distance between the two
+*            positions plus the rotation angle between the two
+*            orientations, scaled to metres by rotation_weight. The order
+*            starts at the first pose of the file and is built by nearest
+*            neighbour, then refined with 2-opt (reverse a stretch of the
+*            path) and Or-opt (move one to three poses elsewhere, either
+*            way round) until neither finds a shorter path or the time
+*            limit runs out. Both only look at the closest poses of each
+*            pose; those lists are built on all cores up front.
+*********************************************************/
+#pragma once
+
+#include <stddef.h>
+#include <chrono>
+#include <vector>
+#include "pose_loader.h"
+
+//metres of travel one radian of tool rotation is worth
+#define PATH_ROTATION_WEIGHT 0.1
+//closest poses the refinement considers for each pose
+#define PATH_NEIGHBOURS 12
+
+struct PathMetric
+{
+	PathMetric() : rotation_weight(PATH_ROTATION_WEIGHT)
+	{
+		axis_weight[0] = axis_weight[1] = axis_weight[2] = 1.0;
+	}
+	double axis_weight[3];	//x, y, z, e.g. to favour moves along a fast axis
+	double rotation_weight;
+};
+
+class PathOptimizer
+{
+public:
+	PathOptimizer(const PoseSet &poses, const PathMetric &metric = PathMetric());
+
+	//cost of the move between poses a and b
+	double cost(size_t a, size_t b) const;
+
+	//cost of visiting the poses in this order
+	double pathCost(const std::vector<size_t> &order) const;
+
+	//order of the poses, starting at pose 0
+	std::vector<size_t> optimize(unsigned long time_limit_ms = 10000);
+
+private:
+	bool expired() const { return std::chrono::steady_clock::now() >= deadline_; }
+	void buildNeighbours();
+	void nearestNeighbour(std::vector<size_t> &path) const;
+	bool twoOpt(std::vector<size_t> &path, std::vector<size_t> &position) const;
+	bool orOpt(std::vector<size_t> &path, std::vector<size_t> &position) const;
+
+	const PoseSet &poses_;
+	PathMetric metric_;
+	size_t neighbours_;			//per pose in neighbour_
+	std::vector<size_t> neighbour_;	//closest poses first
+	std::chrono::steady_clock::time_point deadline_;
+};
+
+//put the poses in the given order, lines go along for messages
+void reorderPoses(PoseSet &poses, const std::vector<size_t> &order);
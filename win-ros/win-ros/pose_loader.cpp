@@ -0,0 +1,495 @@
+/********************************************************
+* @file    : pose_loader.cpp
+* @brief   : load the scan poses of a campaign
+*********************************************************/
+#include "stdafx.h"
+#include "pose_loader.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//text files smaller than this are parsed on the calling thread
+#define PARALLEL_PARSE_BYTES (4 << 20)
+
+void PoseSet::clear()
+{
+	x.clear(); y.clear(); z.clear();
+	qx.clear(); qy.clear(); qz.clear(); qw.clear();
+	line.clear();
+}
+
+void PoseSet::reserve(size_t count)
+{
+	x.reserve(count); y.reserve(count); z.reserve(count);
+	qx.reserve(count); qy.reserve(count); qz.reserve(count); qw.reserve(count);
+	line.reserve(count);
+}
+
+void PoseSet::push(double px, double py, double pz,
+	double oqx, double oqy, double oqz, double oqw, uint32_t source_line)
+{
+	x.push_back(px); y.push_back(py); z.push_back(pz);
+	qx.push_back(oqx); qy.push_back(oqy); qz.push_back(oqz); qw.push_back(oqw);
+	line.push_back(source_line);
+}
+
+void PoseSet::append(const PoseSet &other, uint32_t line_offset)
+{
+	x.insert(x.end(), other.x.begin(), other.x.end());
+	y.insert(y.end(), other.y.begin(), other.y.end());
+	z.insert(z.end(), other.z.begin(), other.z.end());
+	qx.insert(qx.end(), other.qx.begin(), other.qx.end());
+	qy.insert(qy.end(), other.qy.begin(), other.qy.end());
+	qz.insert(qz.end(), other.qz.begin(), other.qz.end());
+	qw.insert(qw.end(), other.qw.begin(), other.qw.end());
+	for (size_t i = 0; i < other.line.size(); i++)
+		line.push_back(other.line[i] + line_offset);
+}
+
+/********************************************************
+*  @class    :  MappedFile
+*  @brief    :  read only view of a whole file
+*********************************************************/
+class MappedFile
+{
+public:
+	MappedFile() : data_(NULL), size_(0)
+#ifdef _WIN32
+		, file_(INVALID_HANDLE_VALUE), mapping_(NULL)
+#endif
+	{}
+	~MappedFile() { close(); }
+
+	bool open(const char *path)
+	{
+#ifdef _WIN32
+		file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file_ == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file_, &size))
+			return false;
+		size_ = (size_t)size.QuadPart;
+		if (size_ == 0)
+			return true;	//an empty file cannot be mapped
+		mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping_ == NULL)
+			return false;
+		data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+		return data_ != NULL;
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		size_ = (size_t)st.st_size;
+		if (size_ > 0)
+		{
+			void *view = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+			data_ = view == MAP_FAILED ? NULL : (const char*)view;
+		}
+		::close(fd);
+		return size_ == 0 || data_ != NULL;
+#endif
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data_)
+			UnmapViewOfFile(data_);
+		if (mapping_)
+			CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE)
+			CloseHandle(file_);
+		mapping_ = NULL;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if (data_)
+			munmap((void*)data_, size_);
+#endif
+		data_ = NULL;
+		size_ = 0;
+	}
+
+	const char *data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	const char *data_;
+	size_t size_;
+#ifdef _WIN32
+	HANDLE file_;
+	HANDLE mapping_;
+#endif
+};
+
+static const double kPow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/********************************************************
+*  @function :  parseNumber
+*  @brief    :  parse one decimal number from [p, end). Mantissas up to
+*               2^53 with exponents up to 22 are exact powers of ten
+*               apart, one multiply or divide rounds them correctly; the
+*               rest goes to strtod.
+*  @input    :  p, end, &value
+*  @return   :  the character after the number, NULL if there is none
+*********************************************************/
+static const char *parseNumber(const char *p, const char *end, double &value)
+{
+	const char *start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+	int significant = 0;
+	int exponent = 0;
+	bool digits = false;
+	bool exact = true;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		digits = true;
+		if (significant < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa)
+				significant++;
+		}
+		else
+		{
+			exponent++;
+			exact = exact && *p == '0';
+		}
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			digits = true;
+			if (significant < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					significant++;
+				exponent--;
+			}
+			else
+			{
+				exact = exact && *p == '0';
+			}
+		}
+	}
+	if (!digits)
+		return NULL;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *q = p + 1;
+		bool negative_exponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			negative_exponent = *q++ == '-';
+		if (q < end && *q >= '0' && *q <= '9')
+		{
+			int e = 0;
+			for (; q < end && *q >= '0' && *q <= '9'; q++)
+				e = e < 10000 ? e * 10 + (*q - '0') : e;
+			exponent += negative_exponent ? -e : e;
+			p = q;
+		}
+	}
+
+	if (exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double m = (double)mantissa;
+		value = exponent < 0 ? m / kPow10[-exponent] : m * kPow10[exponent];
+	}
+	else
+	{
+		//the mapped file has no terminator, strtod gets a copy
+		char token[128];
+		size_t length = std::min((size_t)(p - start), sizeof(token) - 1);
+		memcpy(token, start, length);
+		token[length] = '\0';
+		value = strtod(token, NULL);
+		return p;
+	}
+	if (negative)
+		value = -value;
+	return p;
+}
+
+static bool isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+/********************************************************
+*  @function :  checkPose
+*  @brief    :  reject non finite values and quaternions that are not
+*               close to unit length, normalize the others
+*  @input    :  v[7], &error
+*  @return   :  true if the pose is usable
+*********************************************************/
+static bool checkPose(double *v, std::string &error)
+{
+	for (int i = 0; i < 7; i++)
+	{
+		if (!(v[i] - v[i] == 0))
+		{
+			error = "not a finite number";
+			return false;
+		}
+	}
+	double norm = sqrt(v[3] * v[3] + v[4] * v[4] + v[5] * v[5] + v[6] * v[6]);
+	if (!(fabs(norm - 1) <= POSE_QUATERNION_TOLERANCE))
+	{
+		char message[64];
+		sprintf(message, "quaternion norm %g is not 1", norm);
+		error = message;
+		return false;
+	}
+	//leave quaternions that are unit to the last bits as they are, so a
+	//saved pose set loads back unchanged
+	if (fabs(norm - 1) > 1e-12)
+	{
+		for (int i = 3; i < 7; i++)
+			v[i] /= norm;
+	}
+	return true;
+}
+
+//one slice of a text file, lines are counted from 1 within the slice
+struct TextChunk
+{
+	const char *begin;
+	const char *end;
+	PoseSet poses;
+	uint32_t lines;
+	uint32_t error_line;
+	std::string error;
+};
+
+static void parseText(TextChunk &chunk)
+{
+	const char *p = chunk.begin;
+	const char *end = chunk.end;
+	uint32_t line = 0;
+	chunk.poses.reserve((end - p) / 64);
+	while (p < end)
+	{
+		line++;
+		const char *eol = (const char*)memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+
+		while (p < eol && isBlank(*p))
+			p++;
+		if (p == eol || *p == '#')
+		{
+			p = eol + 1;
+			continue;
+		}
+
+		double v[7];
+		int n = 0;
+		while (n < 7 && p < eol)
+		{
+			p = parseNumber(p, eol, v[n]);
+			if (p == NULL)
+				break;
+			n++;
+			while (p < eol && isBlank(*p))
+				p++;
+		}
+		if (n < 7 || p != eol)
+		{
+			chunk.error_line = line;
+			chunk.error = "expected x y z qx qy qz qw";
+			return;
+		}
+		if (!checkPose(v, chunk.error))
+		{
+			chunk.error_line = line;
+			return;
+		}
+		chunk.poses.push(v[0], v[1], v[2], v[3], v[4], v[5], v[6], line);
+		p = eol + 1;
+	}
+	chunk.lines = line;
+}
+
+/********************************************************
+*  @function :  loadText
+*  @brief    :  split the text at line ends into one slice per core,
+*               parse the slices side by side and join them in order
+*  @input    :  data, size, &poses, &error
+*  @return   :  true if every line parsed
+*********************************************************/
+static bool loadText(const char *data, size_t size, PoseSet &poses, std::string &error)
+{
+	size_t threads = size < PARALLEL_PARSE_BYTES ? 1 : std::max(1u, std::thread::hardware_concurrency());
+	std::vector<TextChunk> chunks;
+	const char *p = data;
+	const char *end = data + size;
+	for (size_t i = 0; i < threads && p < end; i++)
+	{
+		const char *stop = i + 1 == threads ? end : std::max(p, data + size / threads * (i + 1));
+		const char *eol = stop < end ? (const char*)memchr(stop, '\n', end - stop) : NULL;
+		stop = eol ? eol + 1 : end;
+		TextChunk chunk;
+		chunk.begin = p;
+		chunk.end = stop;
+		chunk.lines = 0;
+		chunk.error_line = 0;
+		chunks.push_back(chunk);
+		p = stop;
+	}
+
+	if (chunks.size() == 1)
+	{
+		parseText(chunks[0]);
+	}
+	else
+	{
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < chunks.size(); i++)
+			workers.push_back(std::thread(parseText, std::ref(chunks[i])));
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	size_t total = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+		total += chunks[i].poses.size();
+	poses.reserve(total);
+
+	uint32_t line_offset = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if (!chunks[i].error.empty())
+		{
+			error = "line " + std::to_string(line_offset + chunks[i].error_line) + ": " + chunks[i].error;
+			return false;
+		}
+		poses.append(chunks[i].poses, line_offset);
+		line_offset += chunks[i].lines;
+	}
+	return true;
+}
+
+static bool loadBinary(const char *data, size_t size, PoseSet &poses, std::string &error)
+{
+	uint32_t version;
+	uint64_t count;
+	memcpy(&version, data + 4, sizeof(version));
+	memcpy(&count, data + 8, sizeof(count));
+	if (version != POSE_BINARY_VERSION)
+	{
+		error = "unknown binary version " + std::to_string(version);
+		return false;
+	}
+	if (count > (size - 16) / (7 * sizeof(double)) || size != 16 + count * 7 * sizeof(double))
+	{
+		error = "binary size does not match its pose count";
+		return false;
+	}
+
+	size_t n = (size_t)count;
+	std::vector<double> *columns[7] = { &poses.x, &poses.y, &poses.z, &poses.qx, &poses.qy, &poses.qz, &poses.qw };
+	for (int c = 0; c < 7; c++)
+	{
+		columns[c]->resize(n);
+		if (n)
+			memcpy(&(*columns[c])[0], data + 16 + c * n * sizeof(double), n * sizeof(double));
+	}
+	poses.line.resize(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		poses.line[i] = (uint32_t)(i + 1);	//the pose number stands in for the line
+		double v[7] = { poses.x[i], poses.y[i], poses.z[i], poses.qx[i], poses.qy[i], poses.qz[i], poses.qw[i] };
+		if (!checkPose(v, error))
+		{
+			error = "pose " + std::to_string(i + 1) + ": " + error;
+			return false;
+		}
+		poses.qx[i] = v[3]; poses.qy[i] = v[4]; poses.qz[i] = v[5]; poses.qw[i] = v[6];
+	}
+	return true;
+}
+
+/********************************************************
+*  @function :  loadPoses
+*  @brief    :  load a text or binary pose file
+*  @input    :  path, &poses, &error
+*  @return   :  true if loaded; on failure poses is empty and error
+*               says why
+*********************************************************/
+bool loadPoses(const char *path, PoseSet &poses, std::string &error)
+{
+	poses.clear();
+	MappedFile file;
+	if (!file.open(path))
+	{
+		error = std::string("cannot open ") + path;
+		return false;
+	}
+
+	bool ok;
+	if (file.size() >= 16 && memcmp(file.data(), POSE_BINARY_MAGIC, 4) == 0)
+		ok = loadBinary(file.data(), file.size(), poses, error);
+	else
+		ok = loadText(file.data(), file.size(), poses, error);
+	if (!ok)
+		poses.clear();
+	return ok;
+}
+
+bool savePosesBinary(const char *path, const PoseSet &poses, std::string &error)
+{
+	FILE *out = fopen(path, "wb");
+	if (out == NULL)
+	{
+		error = std::string("cannot create ") + path;
+		return false;
+	}
+	uint32_t version = POSE_BINARY_VERSION;
+	uint64_t count = poses.size();
+	fwrite(POSE_BINARY_MAGIC, 1, 4, out);
+	fwrite(&version, sizeof(version), 1, out);
+	fwrite(&count, sizeof(count), 1, out);
+	const std::vector<double> *columns[7] = { &poses.x, &poses.y, &poses.z, &poses.qx, &poses.qy, &poses.qz, &poses.qw };
+	for (int c = 0; c < 7; c++)
+	{
+		if (count)
+			fwrite(&(*columns[c])[0], sizeof(double), (size_t)count, out);
+	}
+	bool ok = ferror(out) == 0;
+	if (fclose(out) != 0)
+		ok = false;
+	if (!ok)
+		error = std::string("cannot write ") + path;
+	return ok;
+}
@@ -0,0 +1,49 @@
+/********************************************************
+* @file    : pose_loader.h
+* @brief   : load the scan poses of a campaign
+* @details : Two formats are read, told apart by their first bytes:
+*            - text, one pose per line: x y z qx qy qz qw, separated by
+*              blanks or commas. Blank lines and lines starting with '#'
+*              are skipped.
+*            - binary, see POSE_BINARY_MAGIC: a 16 byte header followed by
+*              the seven columns of the pose set, count doubles each,
+*              little endian. savePosesBinary() writes it.
+*            The file is mapped instead of read and large text files are
+*            parsed on all cores. A quaternion whose norm is off by more
+*            than POSE_QUATERNION_TOLERANCE fails the load, smaller errors
+*            are normalized away.
+*********************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//"APOS", version 1, then the pose count as uint64
+#define POSE_BINARY_MAGIC "APOS"
+#define POSE_BINARY_VERSION 1
+#define POSE_QUATERNION_TOLERANCE 1e-2
+
+/********************************************************
+*  @class    :  PoseSet
+*  @brief    :  poses as one array per component
+*********************************************************/
+struct PoseSet
+{
+	std::vector<double> x, y, z;
+	std::vector<double> qx, qy, qz, qw;
+	std::vector<uint32_t> line;	//line in the source file, for messages
+
+	size_t size() const { return x.size(); }
+	bool empty() const { return x.empty(); }
+	void clear();
+	void reserve(size_t count);
+	void push(double px, double py, double pz,
+		double oqx, double oqy, double oqz, double oqw, uint32_t source_line);
+	void append(const PoseSet &other, uint32_t line_offset);
+};
+
+//load a text or binary pose file, error says what and where on failure
+bool loadPoses(const char *path, PoseSet &poses, std::string &error);
+
+bool savePosesBinary(const char *path, const PoseSet &poses, std::string &error);
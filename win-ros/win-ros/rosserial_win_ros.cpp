@@ -14,6 +14,10 @@
 #include <fstream>
 #include <iostream>
 #include <cstddef>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <thread>
 //#include "rosserial_hello_world.h"
 
 #include "ros.h"  
@@ -33,239 +37,1462 @@
 #include <actionlib_msgs/GoalStatus.h>
 #include <actionlib_msgs/GoalStatusArray.h>
 #include <custom_msg/Execute_Status.h>
+#include <moveit_msgs/MoveGroupAction.h>
+#include <actionlib/client/simple_action_client.h>
+#include <geometry_msgs/PoseArray.h>
+#include <actionlib_msgs/GoalID.h>
+#include <chrono>
+#include <ctime>
+#ifdef _WIN32
 #include <windows.h> 
+#else
+#include <limits.h>
+#include <sys/stat.h>
+#define MAX_PATH PATH_MAX
+#endif
+#include "campaign_scheduler.h"
+#include "capture_client.h"
+#include "pose_loader.h"
+#include "path_optimizer.h"
+#include "campaign_journal.h"
+#include "supervisor.h"
+#include "telemetry.h"
+#include "simulation.h"
+#include "ik_check.h"
+#include <tf/transform_buffer.h>
 using std::string;
 using namespace std;
 
-//subscribe callback
-static int goal_exe_status;
-//void execute_pose_callback(const custom_msg::Execute_Status &goalStatus)
-//{
-//	printf("Waiting to receive goalStatus\n");
-//	goal_exe_status = goalStatus.data;
-//}
-void execute_pose_callback(const actionlib_msgs::GoalStatusArray &goalStatus)
+//MoveIt move_group action, planning group and end effector of the arm
+#define MOVE_GROUP_ACTION "move_group"
+#define PLANNING_GROUP "arm"
+#define END_EFFECTOR_LINK "grasping_frame"
+#define PLANNING_FRAME "base_link"
+//goal tolerances, same as the MoveGroup interface defaults
+#define GOAL_POSITION_TOLERANCE 1e-4
+#define GOAL_ORIENTATION_TOLERANCE 1e-3
+//deadlines in milliseconds
+#define SERVER_TIMEOUT 10000
+#define MOVE_TIMEOUT 60000
+
+//batch mode: a whole pose list goes out in one PoseArray, whose length
+//field only has 8 bits on the wire
+#define BATCH_TOPIC "goal_array"
+#define BATCH_STATUS_TOPIC "goal_array_status"
+#define BATCH_ACK_TOPIC "goal_array_ack"
+#define MAX_BATCH_POSES 255
+
+//longest --optimize may take to order the poses, in milliseconds
+#define PATH_OPTIMIZE_TIMEOUT 10000
+
+//MoveGroupResult carries whole trajectories and a full PoseArray is
+//about 14 KB, so both buffers are large
+typedef ros::NodeHandle_<WindowsSocket, 25, 25, 65536, 16384> MoveItNodeHandle;
+typedef actionlib::SimpleActionClient<moveit_msgs::MoveGroupAction> MoveGroupClient;
+
+#define DEFAULT_ROS_MASTER "192.168.186.129"
+
+/*
+ * In-process supervision instead of relaunching the whole program:
+ *  - link: the rosserial connection, reconnected when it stays down
+ *  - capture: the capture service, reconnected or started again
+ *  - campaign: a pass over the unfinished poses, started again when it
+ *    ends with poses left or makes no progress for CAMPAIGN_STALL_TIMEOUT
+ */
+#define LINK_SYNC_TIMEOUT 3000
+#define LINK_CONNECT_TIMEOUT 10000
+#define CAMPAIGN_STALL_TIMEOUT 300000
+//--supervise gives up after this many passes in a row without progress
+#define MAX_IDLE_PASSES 5
+
+static Supervisor supervisor;
+
+//simple-capture-sampled.exe·
+static std::string sprPath = "C:/Users/mlang/Desktop/autoscanner/artec-sdk-samples-v2.0-20171207/samples/simple-capture/bin-vc14-x64/simple-capture-sample.exe";
+//where a campaign keeps its journal, telemetry and one mesh per pose;
+//with --cells each cell has a directory of its own in there
+#define CAMPAIGN_DIR "scans"
+#define JOURNAL_FILE "journal.log"
+#define IK_CACHE_FILE "ik_cache.txt"
+#define FRAME_POSES_FILE "frame_poses.txt"
+//--tf: the newest /tf may be this old when the capture has no later one;
+//the robot stands still from the goal until the capture returns
+#define TF_MAX_AGE_MS 500
+//--tf: after a capture, spin the link at most this long for /tf to catch up
+#define TF_CATCH_UP_MS 300
+//resident capture service: the sample started with --serve, cells
+//without a port of their own take the next one up
+#define CAPTURE_PORT 11511
+#define CAPTURE_START_TIMEOUT 30000
+#define CAPTURE_TIMEOUT 10000
+#define SAVE_TIMEOUT 60000
+
+//--simulate: stand-ins answer instead of the robot and the scanner
+static bool simulate = false;
+
+//reconstruction is the CPU heavy part of a scan; a capture takes a slot
+//and its mesh gives it back, so all cells together never reconstruct
+//more than --reconstructions meshes at once
+static Semaphore reconstruction_slots;
+
+//the scanner exe run per pose opens the cell's scanner, or the first
+//one it finds for a cell without a serial; one at a time
+static std::mutex scanner_exe_mutex;
+//--cells with more than one cell, scanners are not interchangeable
+static bool several_cells = false;
+
+/*
+ * A cell is one robot and one scanner, with its own link, pose plan,
+ * journal, telemetry and output directory. A plain run has one cell;
+ * --cells runs several from one process, each on its own thread. Cells
+ * share the supervisor and the reconstruction slots, nothing else.
+ */
+struct Cell
+{
+	Cell();
+
+	string name;			//empty for the only cell of a plain run
+	string prefix;			//put before the messages of the cell
+	string ros_master;
+	string pose_file;
+	string dir;
+	int capture_port;
+	string scanner_serial;	//empty for the first scanner found
+	unsigned int captures;	//capture requests so far, see captureId()
+
+	MoveItNodeHandle nh;
+	MoveGroupClient move_group;
+
+	//batch mode, see runBatch()
+	unsigned int batch_seq;
+	vector<int> waypoint_status;
+	void batchStatus(const actionlib_msgs::GoalStatusArray &status);
+	ros::Subscriber<actionlib_msgs::GoalStatusArray, Cell> batch_status_sub;
+	geometry_msgs::PoseArray batch_poses;
+	vector<geometry_msgs::Pose> batch_buffer;
+	ros::Publisher batch_pub;
+	actionlib_msgs::GoalID batch_ack;
+	ros::Publisher batch_ack_pub;
+
+	PoseSet poses;
+	//finished poses, a restarted campaign goes on where it stopped
+	CampaignJournal journal;
+	//per pose timings, see telemetry.h
+	Telemetry telemetry;
+	vector<size_t> pending;
+	//the pose each mesh was captured at, see recordFramePose()
+	FILE *frame_poses;
+
+	CaptureClient capture_service;
+	bool use_capture_service;
+	bool started_capture_service;
+
+	SimRobot sim_robot;
+	SimScanner sim_scanner;
+
+	//--ik-check, see ik_check.h
+	IkCheck ik;
+	IkCache ik_cache;
+
+	//--tf: where the end effector was at each capture, see capturePose()
+	unique_ptr<tf::TransformBuffer<> > tf;
+	vector<geometry_msgs::Transform> tf_poses;
+	vector<char> has_tf_pose;
+
+	int link_component;
+	int capture_component;
+	int campaign_component;
+	bool restart_pass;
+};
+
+Cell::Cell()
+	: ros_master(DEFAULT_ROS_MASTER), dir(CAMPAIGN_DIR), capture_port(CAPTURE_PORT), captures(0),
+	move_group(MOVE_GROUP_ACTION),
+	batch_seq(0), batch_status_sub(BATCH_STATUS_TOPIC, &Cell::batchStatus, this),
+	batch_pub(BATCH_TOPIC, &batch_poses), batch_ack_pub(BATCH_ACK_TOPIC, &batch_ack),
+	frame_poses(NULL), use_capture_service(false), started_capture_service(false),
+	link_component(-1), capture_component(-1), campaign_component(-1), restart_pass(false)
+{
+}
+
+//a scan keeps the node handle from spinning, give the link a moment to sync again
+bool linkAlive(Cell &cell)
+{
+	for (int i = 0; i < LINK_SYNC_TIMEOUT / 100; i++)
+	{
+		cell.nh.spinOnce();
+		if (cell.nh.connected())
+			return true;
+		cell.nh.wait(100);
+	}
+	return false;
+}
+
+bool connectLink(Cell &cell)
+{
+	cell.nh.initNode(&cell.ros_master[0]);
+	for (int i = 0; i < LINK_CONNECT_TIMEOUT / 100 && !cell.nh.connected(); i++)
+	{
+		cell.nh.spinOnce();
+		cell.nh.wait(100);
+	}
+	return cell.nh.connected();
+}
+
+//false once the campaign was restarted, the rest of the pass goes to the next one
+bool passGoesOn(Cell &cell)
+{
+	supervisor.check(cell.campaign_component);
+	return !cell.restart_pass;
+}
+
+//the message arrays of a pose goal, must live until the goal is sent
+struct PoseGoal
+{
+	moveit_msgs::MoveGroupGoal goal;
+	moveit_msgs::Constraints constraints;
+	moveit_msgs::PositionConstraint position;
+	moveit_msgs::OrientationConstraint orientation;
+	shape_msgs::SolidPrimitive region;
+	double region_dimensions[1];
+	geometry_msgs::Pose region_pose;
+};
+
+/********************************************************
+*  @function :  poseAt
+*  @brief    :  one pose of a pose set as a message
+*  @input    :  &poses, index
+*  @return   :  the pose
+*********************************************************/
+geometry_msgs::Pose poseAt(const PoseSet &poses, size_t index)
+{
+	geometry_msgs::Pose pose;
+	pose.position.x = poses.x[index];
+	pose.position.y = poses.y[index];
+	pose.position.z = poses.z[index];
+	pose.orientation.x = poses.qx[index];
+	pose.orientation.y = poses.qy[index];
+	pose.orientation.z = poses.qz[index];
+	pose.orientation.w = poses.qw[index];
+	return pose;
+}
+
+/********************************************************
+*  @function :  makePoseGoal
+*  @brief    :  build a plan-and-execute MoveGroup goal for an end effector pose
+*  @input    :  &pose_, &goal_
+*  @return   :  null
+*********************************************************/
+void makePoseGoal(const geometry_msgs::Pose &pose_, PoseGoal &goal_)
+{
+	//position: a small sphere around the target
+	goal_.region.type = shape_msgs::SolidPrimitive::SPHERE;
+	goal_.region_dimensions[0] = GOAL_POSITION_TOLERANCE;
+	goal_.region.dimensions_length = 1;
+	goal_.region.dimensions = goal_.region_dimensions;
+	goal_.region_pose.position = pose_.position;
+	goal_.region_pose.orientation.w = 1.0;
+
+	goal_.position.header.frame_id = PLANNING_FRAME;
+	goal_.position.link_name = END_EFFECTOR_LINK;
+	goal_.position.constraint_region.primitives_length = 1;
+	goal_.position.constraint_region.primitives = &goal_.region;
+	goal_.position.constraint_region.primitive_poses_length = 1;
+	goal_.position.constraint_region.primitive_poses = &goal_.region_pose;
+	goal_.position.weight = 1.0;
+
+	goal_.orientation.header.frame_id = PLANNING_FRAME;
+	goal_.orientation.link_name = END_EFFECTOR_LINK;
+	goal_.orientation.orientation = pose_.orientation;
+	goal_.orientation.absolute_x_axis_tolerance = GOAL_ORIENTATION_TOLERANCE;
+	goal_.orientation.absolute_y_axis_tolerance = GOAL_ORIENTATION_TOLERANCE;
+	goal_.orientation.absolute_z_axis_tolerance = GOAL_ORIENTATION_TOLERANCE;
+	goal_.orientation.weight = 1.0;
+
+	goal_.constraints.position_constraints_length = 1;
+	goal_.constraints.position_constraints = &goal_.position;
+	goal_.constraints.orientation_constraints_length = 1;
+	goal_.constraints.orientation_constraints = &goal_.orientation;
+
+	moveit_msgs::MotionPlanRequest &request = goal_.goal.request;
+	request.group_name = PLANNING_GROUP;
+	request.num_planning_attempts = 1;
+	request.allowed_planning_time = 5.0;
+	request.max_velocity_scaling_factor = 1.0;
+	request.max_acceleration_scaling_factor = 1.0;
+	request.start_state.is_diff = true;	//plan from the current state
+	request.goal_constraints_length = 1;
+	request.goal_constraints = &goal_.constraints;
+
+	goal_.goal.planning_options.plan_only = false;
+	goal_.goal.planning_options.planning_scene_diff.is_diff = true;
+	goal_.goal.planning_options.planning_scene_diff.robot_state.is_diff = true;
+}
+
+/********************************************************
+*  @function :  moveToPose
+*  @brief    :  plan and execute a move to the pose, wait for the outcome
+*  @input    :  &cell, &pose_, index of the pose for telemetry
+*  @return   :  GoalStatus of the move, LOST if it could not be sent
+*********************************************************/
+int moveToPose(Cell &cell, const geometry_msgs::Pose &pose_, size_t index)
+{
+	PhaseTimer publish(cell.telemetry, index, PHASE_PUBLISH);
+	if (simulate)
+	{
+		publish.stop();
+		PhaseTimer motion(cell.telemetry, index, PHASE_MOTION);
+		return cell.sim_robot.move(pose_);
+	}
+
+	//notice a link that dropped while the scanner was running
+	if (!supervisor.await(cell.link_component, LINK_CONNECT_TIMEOUT))
+	{
+		printf("%sno link to %s!\n", cell.prefix.c_str(), cell.ros_master.c_str());
+		return actionlib_msgs::GoalStatus::LOST;
+	}
+	if (!cell.move_group.isServerConnected() && !cell.move_group.waitForServer(SERVER_TIMEOUT))
+	{
+		printf("%sno %s action server!\n", cell.prefix.c_str(), MOVE_GROUP_ACTION);
+		return actionlib_msgs::GoalStatus::LOST;
+	}
+
+	PoseGoal goal;
+	makePoseGoal(pose_, goal);
+	if (!cell.move_group.sendGoal(goal.goal))
+	{
+		printf("%ssend goal failed!\n", cell.prefix.c_str());
+		return actionlib_msgs::GoalStatus::LOST;
+	}
+
+	publish.stop();
+
+	//returns the moment the result is reported
+	PhaseTimer motion(cell.telemetry, index, PHASE_MOTION);
+	if (!cell.move_group.waitForResult(MOVE_TIMEOUT))
+	{
+		printf("%smove did not finish in %d ms, cancel it!\n", cell.prefix.c_str(), MOVE_TIMEOUT);
+		cell.move_group.cancelGoal();
+		cell.move_group.stopTrackingGoal();
+		return actionlib_msgs::GoalStatus::LOST;
+	}
+	printf("%smove_group error code %d\n", cell.prefix.c_str(), (int)cell.move_group.getResult().error_code.val);
+	return cell.move_group.getState();
+}
+
+/*
+ * Batch mode protocol, served by the ROS side node:
+ *  - BATCH_TOPIC: geometry_msgs/PoseArray, all poses of a batch in order,
+ *    header.seq is the batch number. The whole sequence is planned at once.
+ *  - BATCH_STATUS_TOPIC: actionlib_msgs/GoalStatusArray, one entry per
+ *    waypoint with goal_id.id "<batch>/<index>": ACTIVE while moving there,
+ *    SUCCEEDED once reached, ABORTED/REJECTED if it cannot be reached.
+ *  - BATCH_ACK_TOPIC: actionlib_msgs/GoalID "<batch>/<index>", sent when
+ *    the scan at a reached waypoint is done; the robot dwells until then.
+ */
+void Cell::batchStatus(const actionlib_msgs::GoalStatusArray &status)
+{
+	for (int i = 0; i < status.status_list_length; i++)
+	{
+		unsigned int seq, index;
+		const char *id = status.status_list[i].goal_id.id;
+		if (id == NULL || sscanf(id, "%u/%u", &seq, &index) != 2)
+			continue;
+		if (seq != batch_seq || index >= waypoint_status.size())
+			continue;	//an old batch or another client
+		waypoint_status[index] = status.status_list[i].status;
+	}
+}
+
+//let the link deliver what came in; a simulated robot reports through
+//the same GoalStatusArray callback
+void spinLink(Cell &cell)
+{
+	if (!simulate)
+	{
+		cell.nh.spinOnce();
+		return;
+	}
+	string id;
+	int code;
+	actionlib_msgs::GoalStatus status;
+	actionlib_msgs::GoalStatusArray array;
+	array.status_list_length = 1;
+	array.status_list = &status;
+	while (cell.sim_robot.pollStatus(id, code))
+	{
+		status.goal_id.id = id.c_str();
+		status.status = (uint8_t)code;
+		cell.batchStatus(array);
+	}
+}
+
+bool terminalStatus(int status)
+{
+	return status == actionlib_msgs::GoalStatus::PREEMPTED || status == actionlib_msgs::GoalStatus::SUCCEEDED ||
+		status == actionlib_msgs::GoalStatus::ABORTED || status == actionlib_msgs::GoalStatus::REJECTED ||
+		status == actionlib_msgs::GoalStatus::RECALLED || status == actionlib_msgs::GoalStatus::LOST;
+}
+
+/********************************************************
+*  @function :  runBatch
+*  @brief    :  send up to MAX_BATCH_POSES poses in one message, then
+*               follow the per-waypoint progress and scan at each
+*               waypoint as soon as it is reached
+*  @input    :  &cell, indices of the poses to visit, first, count,
+*               handler called once per waypoint
+*  @return   :  number of waypoints reached
+*********************************************************/
+int runBatch(Cell &cell, const vector<size_t> &indices, size_t first, size_t count,
+	void (*handler)(Cell &cell, size_t index, int status))
 {
-	actionlib_msgs::GoalStatus *goal = goalStatus.status_list;
-	if (goal != NULL)
+	const PoseSet &poses = cell.poses;
+	Telemetry &telemetry = cell.telemetry;
+	cell.batch_buffer.resize(count);
+	for (size_t i = 0; i < count; i++)
+		cell.batch_buffer[i] = poseAt(poses, indices[first + i]);
+
+	cell.batch_seq++;
+	cell.waypoint_status.assign(count, actionlib_msgs::GoalStatus::PENDING);
+	cell.batch_poses.header.seq = cell.batch_seq;
+	cell.batch_poses.header.frame_id = PLANNING_FRAME;
+	cell.batch_poses.poses_length = (uint8_t)count;
+	cell.batch_poses.poses = &cell.batch_buffer[0];
+
+	//each waypoint's cycle starts when the robot heads for it
+	telemetry.begin(indices[first], poses.line[indices[first]]);
+	PhaseTimer publish(telemetry, indices[first], PHASE_PUBLISH);
+	if (simulate)
 	{
-		printf("ǿ\n");
-		cout<<goal_exe_status<<endl;
-		goal_exe_status = goal->status;
+		cell.sim_robot.startBatch(cell.batch_seq, cell.batch_buffer);
 	}
 	else
 	{
-		printf("don't get goal_exe_status!\n");
+		if (!supervisor.await(cell.link_component, LINK_CONNECT_TIMEOUT) || cell.batch_pub.publish(&cell.batch_poses) <= 0)
+		{
+			printf("%ssend batch %u failed!\n", cell.prefix.c_str(), cell.batch_seq);
+			telemetry.end(indices[first], "lost");
+			return 0;
+		}
+		cell.nh.flush();
+	}
+	publish.stop();
+	printf("%sbatch %u: %u poses sent\n", cell.prefix.c_str(), cell.batch_seq, (unsigned int)count);
+
+	//waypoints are handled in order; give up after MOVE_TIMEOUT without progress
+	size_t next = 0;
+	int reached = 0;
+	unsigned long last_progress = cell.nh.time();
+	double motion_start = telemetry.now();
+	while (next < count)
+	{
+		spinLink(cell);
+		if (!terminalStatus(cell.waypoint_status[next]))
+		{
+			if (cell.nh.time() - last_progress >= MOVE_TIMEOUT)
+			{
+				printf("%sbatch %u: no progress at waypoint %u\n", cell.prefix.c_str(), cell.batch_seq, (unsigned int)next);
+				//the stalled waypoint's record is open and the wait was
+				//its motion; the ones behind it were never headed for
+				telemetry.add(indices[first + next], PHASE_MOTION, telemetry.now() - motion_start);
+				handler(cell, indices[first + next], actionlib_msgs::GoalStatus::LOST);
+				for (next++; next < count; next++)
+				{
+					telemetry.begin(indices[first + next], poses.line[indices[first + next]]);
+					handler(cell, indices[first + next], actionlib_msgs::GoalStatus::LOST);
+				}
+				break;
+			}
+			//a poll is 20 ms of real time, a simulated robot would have
+			//gone on by 20 ms times the clock speed
+			if (simulate)
+				cell.sim_robot.waitStatus(20);
+			else
+				cell.nh.wait(20);
+			continue;
+		}
+		int status = cell.waypoint_status[next];
+		telemetry.add(indices[first + next], PHASE_MOTION, telemetry.now() - motion_start);
+		handler(cell, indices[first + next], status);
+		if (status == actionlib_msgs::GoalStatus::SUCCEEDED)
+			reached++;
+
+		//release the robot to the next waypoint
+		if (simulate)
+		{
+			cell.sim_robot.ack(cell.batch_seq, next);
+		}
+		else
+		{
+			char id[32];
+			sprintf(id, "%u/%u", cell.batch_seq, (unsigned int)next);
+			cell.batch_ack.id = id;
+			cell.batch_ack_pub.publish(&cell.batch_ack);
+			cell.nh.flush();
+		}
+		next++;
+		last_progress = cell.nh.time();
+		if (next < count)
+			telemetry.begin(indices[first + next], poses.line[indices[first + next]]);
+		motion_start = telemetry.now();
 	}
+	return reached;
+}
+
+/********************************************************
+*  @function :  openCaptureService
+*  @brief    :  connect to the resident capture service, start it if it
+*               is not running yet
+*  @input    :  &cell
+*  @return   :  true if captures go through the service
+*********************************************************/
+bool openCaptureService(Cell &cell)
+{
+	if (cell.capture_service.connect(cell.capture_port, 500))
+		return true;
+	printf("%sStarting capture service...\n", cell.prefix.c_str());
+	cell.started_capture_service = cell.capture_service.startServer(sprPath, cell.capture_port,
+		CAPTURE_START_TIMEOUT, cell.scanner_serial);
+	return cell.started_capture_service;
+}
+
+//the capture service, or its stand-in in a simulation
+bool requestCapture(Cell &cell, const string &id)
+{
+	if (simulate)
+		return cell.sim_scanner.capture(id, CAPTURE_TIMEOUT);
+	return cell.capture_service.capture(id, CAPTURE_TIMEOUT);
+}
+
+bool waitForMesh(Cell &cell, const string &id, string &file, CaptureTimes *times)
+{
+	if (simulate)
+		return cell.sim_scanner.waitSaved(id, file, SAVE_TIMEOUT, times);
+	return cell.capture_service.waitSaved(id, file, SAVE_TIMEOUT, times);
+}
+
+//capture id of a new request for a pose, attached to the request and the
+//saved file name; by its line in the pose file like the journal, so a
+//resumed campaign in another order does not reuse names, and numbered, so
+//a late reply to an attempt given up on is not taken for a retry's; cells
+//scanning side by side get their name in it
+string captureId(Cell &cell, size_t index)
+{
+	char id[32];
+	sprintf(id, "pose-%03u-%u", (unsigned int)cell.poses.line[index], ++cell.captures);
+	return cell.name.empty() ? string(id) : cell.name + "-" + id;
+}
 
+/********************************************************
+*  @function :  runScannerExe
+*  @brief    :  capture, reconstruct and save one frame with the scanner
+*               exe (simple-capture-sample --capture), from the cell's
+*               scanner into a file named like a service capture
+*  @input    :  &cell, index of the pose, &file gets the mesh file
+*  @return   :  true if the mesh was saved
+*********************************************************/
+bool runScannerExe(Cell &cell, size_t index, string &file)
+{
+	//without a serial the exe takes the first scanner it finds, which
+	//may be another cell's
+	if (several_cells && cell.scanner_serial.empty())
+	{
+		printf("%sno scanner serial for the cell, no capture without the service!\n", cell.prefix.c_str());
+		return false;
+	}
+	file = captureId(cell, index) + ".obj";
+	string command = sprPath + " --capture " + file;
+	if (!cell.scanner_serial.empty())
+		command += " " + cell.scanner_serial;
+	std::lock_guard<std::mutex> lock(scanner_exe_mutex);
+	return system(command.c_str()) == 0;
 }
 
 /********************************************************
-*  @function :  posePublish
-*  @brief    :  publish pose to ros to make the robot arrive to the position
-*  @input    :  null
+*  @function :  recordFramePose
+*  @brief    :  note the robot pose a saved mesh was captured at, so
+*               registration can start from where the scanner was
+*               (scanning-and-process-sample --poses); one line per mesh,
+*               file name then x y z qx qy qz qw in PLANNING_FRAME
+*  @input    :  &cell, index of the pose, mesh file
 *  @return   :  null
-*  @author   :  xiaohui zhou  2017/11/27 20:38
 *********************************************************/
-int posePublish(geometry_msgs::Pose &pose_)
+void recordFramePose(Cell &cell, size_t index, const string &file)
 {
-	//printf("start publish pose!\n");
-	ros::NodeHandle nh;
-	char *ros_master = "192.168.186.129";
+	if (cell.frame_poses == NULL || file.empty())
+		return;
+	if (index < cell.has_tf_pose.size() && cell.has_tf_pose[index])
+	{
+		const geometry_msgs::Transform &pose = cell.tf_poses[index];
+		fprintf(cell.frame_poses, "%s %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", file.c_str(),
+			pose.translation.x, pose.translation.y, pose.translation.z,
+			pose.rotation.x, pose.rotation.y, pose.rotation.z, pose.rotation.w);
+	}
+	else
+	{
+		const PoseSet &poses = cell.poses;
+		fprintf(cell.frame_poses, "%s %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", file.c_str(),
+			poses.x[index], poses.y[index], poses.z[index],
+			poses.qx[index], poses.qy[index], poses.qz[index], poses.qw[index]);
+	}
+	fflush(cell.frame_poses);
+}
 
-	//printf("Connecting to server at %s\n", ros_master);
-	nh.initNode(ros_master);
+/********************************************************
+*  @function :  capturePose
+*  @brief    :  --tf, look up where the end effector was when the frame
+*               was taken, for recordFramePose() to write instead of the
+*               goal; the goal stays when /tf cannot tell
+*  @input    :  &cell, index of the pose, time the capture was requested
+*  @return   :  null
+*********************************************************/
+void capturePose(Cell &cell, size_t index, const ros::Time &time)
+{
+	if (!cell.tf || index >= cell.has_tf_pose.size())
+		return;
+	geometry_msgs::Transform &pose = cell.tf_poses[index];
+	ros::Time stamp;
+	//nothing spun the link while the scanner had the thread, read what
+	//came in until /tf has a transform as new as the frame
+	for (unsigned long start = cell.nh.time(); cell.nh.time() - start < TF_CATCH_UP_MS; cell.nh.wait(10))
+	{
+		cell.nh.spinOnce();
+		if (cell.tf->lookup(PLANNING_FRAME, END_EFFECTOR_LINK, ros::Time(), pose, &stamp) == tf::LOOKUP_OK &&
+			stamp.toSec() >= time.toSec())
+			break;
+	}
+	tf::LookupStatus status = cell.tf->lookup(PLANNING_FRAME, END_EFFECTOR_LINK, time, pose);
+	//none came after the frame, the robot has not moved since the newest
+	if (status == tf::LOOKUP_FUTURE &&
+		cell.tf->lookup(PLANNING_FRAME, END_EFFECTOR_LINK, ros::Time(), pose, &stamp) == tf::LOOKUP_OK &&
+		time.toSec() - stamp.toSec() <= TF_MAX_AGE_MS / 1000.0)
+		status = tf::LOOKUP_OK;
+	cell.has_tf_pose[index] = status == tf::LOOKUP_OK;
+	if (status != tf::LOOKUP_OK)
+		printf("%sno /tf pose for pose %u, the goal is recorded\n", cell.prefix.c_str(), (unsigned int)index);
+}
 
-	//printf("Advertising cmd_vel message\n");
-	geometry_msgs::Pose target_pose1;
-	ros::Publisher display_publisher("goal", &target_pose1);
-	nh.advertise(display_publisher);
+/********************************************************
+*  @function :  reportMove
+*  @brief    :  report how the move to a pose ended
+*  @input    :  &cell, index of the pose, goal_exe_status
+*  @return   :  true if the robot arrived
+*********************************************************/
+bool reportMove(Cell &cell, size_t index, int goal_exe_status)
+{
+	const PoseSet &poses = cell.poses;
+	const char *prefix = cell.prefix.c_str();
+	supervisor.beat(cell.campaign_component);
+	//жmove plan ִ״̬succeedscannerɨ
+	switch (goal_exe_status)
+	{
+	case 1:
+		printf("%sThis goal has been accepted by the simple action server! \n", prefix);
+		break;
+	case 2:
+		printf("%sArm move plan PREEMPTED=2!\n", prefix);
+		break;
+	case 3:
+		printf("%sArm move plan SUCCEEDED=3!\n", prefix);
+		return true;
+	case 4:
+		printf("%sArm move plan ABORTED=4!\n", prefix);
+		printf("%sfail path line %u: %g %g %g %g %g %g %g\n", prefix, poses.line[index],
+			poses.x[index], poses.y[index], poses.z[index],
+			poses.qx[index], poses.qy[index], poses.qz[index], poses.qw[index]);
+		break;
+	case 5:
+		printf("%sArm move plan REJECTED=5!\n", prefix);
+		break;
+	case 6:
+		printf("%sArm move plan PREEMPTING=6!\n", prefix);
+		break;
+	case 7:
+		printf("%sArm move plan RECALLING=7!\n", prefix);
+		break;
+	case 8:
+		printf("%sArm move plan RECALLED=8!\n", prefix);
+		break;
+	case 9:
+		printf("%sArm move plan LOST=9!\n", prefix);
+		break;
+	default:
+		break;
+	}
+	//unreachable poses are not tried again on resume, lost ones are
+	if (goal_exe_status == actionlib_msgs::GoalStatus::ABORTED ||
+		goal_exe_status == actionlib_msgs::GoalStatus::REJECTED)
+	{
+		cell.journal.skipped(poses.line[index], goal_exe_status);
+		cell.telemetry.end(index, "unreachable");
+	}
+	else
+	{
+		cell.telemetry.end(index, "not reached");
+	}
+	return false;
+}
 
-	//printf("Go robot go!\n");
-	int spin_pub_i = 30;
-	while (spin_pub_i > 0)
+/********************************************************
+*  @function :  scanAtPose
+*  @brief    :  report how the move to a pose ended, scan if it arrived
+*  @input    :  &cell, index of the pose, goal_exe_status
+*  @return   :  null
+*********************************************************/
+void scanAtPose(Cell &cell, size_t index, int goal_exe_status)
+{
+	if (!reportMove(cell, index, goal_exe_status))
+		return;
+	Telemetry &telemetry = cell.telemetry;
+	printf("%sStart Scanner!\n", cell.prefix.c_str());
+	const char *outcome = "capture failed";
+	reconstruction_slots.acquire();
+	if (cell.use_capture_service && supervisor.check(cell.capture_component))
 	{
-		display_publisher.publish(&pose_);
+		string file;
+		CaptureTimes times;
+		string id = captureId(cell, index);
+		PhaseTimer capture(telemetry, index, PHASE_CAPTURE);
+		ros::Time requested = cell.nh.now();
+		bool captured = requestCapture(cell, id);
+		capture.stop();
+		if (captured)
+			capturePose(cell, index, requested);
+		if (captured && waitForMesh(cell, id, file, &times))
+		{
+			printf("%sSaved %s\n", cell.prefix.c_str(), file.c_str());
+			cell.journal.done(cell.poses.line[index], file);
+			recordFramePose(cell, index, file);
+			telemetry.add(index, PHASE_QUEUE, times.queue);
+			telemetry.add(index, PHASE_RECONSTRUCT, times.reconstruct);
+			telemetry.add(index, PHASE_SAVE, times.save);
+			outcome = "ok";
+		}
+		else if (captured)
+		{
+			outcome = "save failed";
+		}
+	}
+	else
+	{
+		//the exe captures, reconstructs and saves in one go
+		string file;
+		PhaseTimer capture(telemetry, index, PHASE_CAPTURE);
+		if (runScannerExe(cell, index, file))
+		{
+			cell.journal.done(cell.poses.line[index], file);
+			outcome = "ok";
+		}
+	}
+	reconstruction_slots.release();
+	telemetry.end(index, outcome);
+	printf("%sScanner done!\n", cell.prefix.c_str());
+}
 
-		nh.spinOnce();
-		spin_pub_i--;
-		Sleep(100);
+void makeDirectory(const char *path)
+{
+#ifdef _WIN32
+	CreateDirectoryA(path, NULL);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+//move a file over whatever is at the target
+bool replaceFile(const string &from, const char *to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED) != 0;
+#else
+	return rename(from.c_str(), to) == 0;
+#endif
+}
+
+//how captureStage took a pose, CaptureHandoff::kind
+enum CaptureKind
+{
+	CAPTURE_BY_EXE,		//data is the mesh file the exe left
+	CAPTURE_BY_SERVICE	//data is the capture id, a reconstruction slot is held
+};
+
+/********************************************************
+*  @function :  captureStage
+*  @brief    :  pipelined campaign, run the scanner at the current pose
+*  @input    :  &cell, index of the pose, &capture gets the capture id
+*               or the new mesh file, and which of them it is
+*  @return   :  true if the frame was taken
+*********************************************************/
+bool captureStage(Cell &cell, size_t index, CaptureHandoff &capture)
+{
+	PhaseTimer timer(cell.telemetry, index, PHASE_CAPTURE);
+	//the service answers as soon as the frame is taken, the slot is
+	//given back once processStage has the mesh
+	if (cell.use_capture_service && supervisor.check(cell.capture_component))
+	{
+		capture.kind = CAPTURE_BY_SERVICE;
+		capture.data = captureId(cell, index);
+		reconstruction_slots.acquire();
+		ros::Time requested = cell.nh.now();
+		if (requestCapture(cell, capture.data))
+		{
+			capturePose(cell, index, requested);
+			return true;
+		}
+		reconstruction_slots.release();
+		timer.stop();
+		cell.telemetry.end(index, "capture failed");
+		return false;
 	}
 
-	printf("publish pose done!\n");
-	return 0;
+	printf("%sStart Scanner at pose %u!\n", cell.prefix.c_str(), (unsigned int)index);
+	if (runScannerExe(cell, index, capture.data))
+	{
+		capture.kind = CAPTURE_BY_EXE;
+		return true;
+	}
+	printf("%sScanner left no mesh at pose %u!\n", cell.prefix.c_str(), (unsigned int)index);
+	timer.stop();
+	cell.telemetry.end(index, "capture failed");
+	return false;
 }
 
 /********************************************************
-*  @function :  statusSubscriber
-*  @brief    :  get robot plan status
-*  @input[in]:  null
-*  @return   :  int
-*  @author   :  xiaohui zhou
+*  @function :  processStage
+*  @brief    :  pipelined campaign, file the mesh of a pose
+*  @input    :  &cell, index of the pose, capture from captureStage
+*  @return   :  true if the mesh was saved
 *********************************************************/
-int statusSubscriber()
+bool processStage(Cell &cell, size_t index, const CaptureHandoff &capture)
 {
-	//printf("start subscribe execute status!\n");
-	ros::NodeHandle nh;
-	char *ros_master = "192.168.186.129";
+	Telemetry &telemetry = cell.telemetry;
+	//from the service the capture is an id, wait for its mesh; the exe
+	//fallback may have taken it even with the service configured
+	string file = capture.data;
+	if (capture.kind == CAPTURE_BY_SERVICE)
+	{
+		CaptureTimes times;
+		bool saved = waitForMesh(cell, capture.data, file, &times);
+		reconstruction_slots.release();
+		if (!saved)
+		{
+			telemetry.end(index, "save failed");
+			return false;
+		}
+		telemetry.add(index, PHASE_QUEUE, times.queue);
+		telemetry.add(index, PHASE_RECONSTRUCT, times.reconstruct);
+		telemetry.add(index, PHASE_SAVE, times.save);
+	}
 
-	//printf("Connecting to server at %s\n", ros_master);
-	nh.initNode(ros_master);
+	PhaseTimer timer(telemetry, index, PHASE_SAVE);
+	//named by the pose file line, as the journal knows the pose
+	char target[MAX_PATH];
+	sprintf(target, "%s/pose-%03u.obj", cell.dir.c_str(), (unsigned int)cell.poses.line[index]);
+	if (!replaceFile(file, target))
+	{
+		printf("%scould not save %s as %s!\n", cell.prefix.c_str(), file.c_str(), target);
+		timer.stop();
+		telemetry.end(index, "save failed");
+		return false;
+	}
+	cell.journal.done(cell.poses.line[index], target);
+	recordFramePose(cell, index, target);
+	timer.stop();
+	telemetry.end(index, "ok");
+	return true;
+}
 
-	int spin_sub_i = 10;
-	ros::Subscriber <actionlib_msgs::GoalStatusArray>
-		poseSub("execute_pose", &execute_pose_callback);
-	nh.subscribe(poseSub);
-	//printf("Waiting to receive messages\n");
-	while (spin_sub_i > 0)
+//poses the journal has no record of, in campaign order
+vector<size_t> unfinishedPoses(Cell &cell)
+{
+	vector<size_t> pending;
+	for (size_t i = 0; i < cell.poses.size(); i++)
 	{
-		nh.spinOnce();
-		printf("nh.spinOnce();\n");
-		spin_sub_i--;
-		Sleep(200);
+		if (!cell.journal.finished(cell.poses.line[i]))
+			pending.push_back(i);
 	}
-	printf("Subscriber status done!\n");
-	return 0;
+	return pending;
 }
 
 /********************************************************
-*  @function :  split
-*  @brief    :  տոַָ
-*  @input    :  &s, &seperator
-*  @return   :  string,string
-*  @author   :  xiaohui zhou  2017/11/27 21:02
+*  @function :  checkReach
+*  @brief    :  pre-flight IK check of the pending poses, answered from
+*               the cache where it can; poses without a solution are
+*               journaled as unreachable and never sent to the robot
+*  @input    :  &cell
+*  @return   :  null
 *********************************************************/
-vector<string> split(const string &s, const string &seperator) {
-	vector<string> result;
-	typedef string::size_type string_size;
-	string_size i = 0;
-
-	while (i != s.size()) {
-		//ҵַ׸ڷָĸ
-		int flag = 0;
-		while (i != s.size() && flag == 0) {
-			flag = 1;
-			for (string_size x = 0; x < seperator.size(); ++x)
-				if (s[i] == seperator[x]) {
-					++i;
-					flag = 0;
-					break;
-				}
+void checkReach(Cell &cell)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	string cache_path = cell.dir + "/" IK_CACHE_FILE;
+	cell.ik_cache.load(cache_path.c_str(), PLANNING_GROUP, END_EFFECTOR_LINK);
+
+	vector<IkSolution> solutions(cell.pending.size());
+	vector<size_t> asked;
+	vector<geometry_msgs::Pose> targets;
+	for (size_t k = 0; k < cell.pending.size(); k++)
+	{
+		geometry_msgs::Pose pose = poseAt(cell.poses, cell.pending[k]);
+		if (!cell.ik_cache.find(pose, solutions[k]))
+		{
+			asked.push_back(k);
+			targets.push_back(pose);
 		}
+	}
 
-		//ҵһַָָ֮ȡ
-		flag = 0;
-		string_size j = i;
-		while (j != s.size() && flag == 0) {
-			for (string_size x = 0; x < seperator.size(); ++x)
-				if (s[j] == seperator[x]) {
-					flag = 1;
-					break;
-				}
-			if (flag == 0)
-				++j;
+	vector<IkSolution> answers(targets.size());
+	size_t checked = 0;
+	if (simulate)
+	{
+		for (; checked < targets.size(); checked++)
+		{
+			answers[checked].checked = true;
+			answers[checked].reachable = cell.sim_robot.reachable(targets[checked]);
+			answers[checked].error_code = moveit_msgs::MoveItErrorCodes::SUCCESS;
+			if (!answers[checked].reachable)
+				answers[checked].error_code = moveit_msgs::MoveItErrorCodes::NO_IK_SOLUTION;
+		}
+	}
+	else if (!targets.empty() && supervisor.await(cell.link_component, LINK_CONNECT_TIMEOUT))
+	{
+		checked = cell.ik.solve(targets, answers);
+	}
+	for (size_t i = 0; i < asked.size(); i++)
+	{
+		solutions[asked[i]] = answers[i];
+		cell.ik_cache.put(targets[i], answers[i]);
+	}
+	if (checked > 0 && !cell.ik_cache.save(cache_path.c_str()))
+		printf("%scannot write %s, IK answers are not kept!\n", cell.prefix.c_str(), cache_path.c_str());
+
+	unsigned int unreachable = 0;
+	for (size_t k = 0; k < cell.pending.size(); k++)
+	{
+		if (!solutions[k].checked || solutions[k].reachable)
+			continue;
+		uint32_t line = cell.poses.line[cell.pending[k]];
+		printf("%sno IK solution for line %u, skipped\n", cell.prefix.c_str(), line);
+		cell.journal.skipped(line, actionlib_msgs::GoalStatus::ABORTED);
+		unreachable++;
+	}
+	printf("%sIK check: %u poses, %u from the cache, %u solved in %lu ms, %u unreachable\n", cell.prefix.c_str(),
+		(unsigned int)cell.pending.size(), (unsigned int)(cell.pending.size() - asked.size()), (unsigned int)checked,
+		(unsigned long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count(),
+		unreachable);
+	if (checked < targets.size())
+		printf("%sno IK answer for %u poses, they go to the robot unchecked\n", cell.prefix.c_str(),
+			(unsigned int)(targets.size() - checked));
+	cell.pending = unfinishedPoses(cell);
+}
+
+/********************************************************
+*  @function :  runPass
+*  @brief    :  visit the pending poses of a cell once and scan where
+*               the robot arrives, stop early if the campaign is restarted
+*  @input    :  &cell, batch_mode, pipeline_mode
+*  @return   :  null
+*********************************************************/
+void runPass(Cell &cell, bool batch_mode, bool pipeline_mode)
+{
+	const vector<size_t> &pending = cell.pending;
+	if (batch_mode)
+	{
+		//planned once per batch instead of once per pose
+		int reached = 0;
+		for (size_t first = 0; first < pending.size() && passGoesOn(cell); first += MAX_BATCH_POSES)
+		{
+			size_t count = min((size_t)MAX_BATCH_POSES, pending.size() - first);
+			reached += runBatch(cell, pending, first, count, &scanAtPose);
+		}
+		printf("%s%d of %u poses reached\n", cell.prefix.c_str(), reached, (unsigned int)pending.size());
+	}
+	else if (pipeline_mode)
+	{
+		CampaignScheduler campaign(
+			[&cell, &pending](size_t i) {
+				if (!passGoesOn(cell))
+					return false;
+				cell.telemetry.begin(pending[i], cell.poses.line[pending[i]]);
+				return reportMove(cell, pending[i], moveToPose(cell, poseAt(cell.poses, pending[i]), pending[i]));
+			},
+			[&cell, &pending](size_t i, CaptureHandoff &capture) { return captureStage(cell, pending[i], capture); },
+			[&cell, &pending](size_t i, const CaptureHandoff &capture) { return processStage(cell, pending[i], capture); });
+		campaign.run(pending.size());
+		campaign.report(stdout);
+	}
+	else
+	{
+		for (size_t k = 0; k < pending.size() && passGoesOn(cell); k++)
+		{
+			size_t i = pending[k];
+			printf("%s#################################Go robot go!\n", cell.prefix.c_str());
+			cout << cell.prefix << cell.poses.x[i] << endl;
+			cell.telemetry.begin(i, cell.poses.line[i]);
+			scanAtPose(cell, i, moveToPose(cell, poseAt(cell.poses, i), i));
+		}
+	}
+}
+
+//what every cell of a run does the same way
+struct RunOptions
+{
+	bool batch_mode;
+	bool pipeline_mode;
+	bool optimize;
+	bool restart;
+	bool supervise;
+	bool ik_check;
+	bool tf;
+	const char *telemetry_file;	//NULL for the default in the cell directory
+	SimConfig simulation;
+};
+
+/********************************************************
+*  @function :  openCell
+*  @brief    :  load the poses of a cell, open its journal and telemetry,
+*               connect its robot and scanner and put them under
+*               supervision
+*  @input    :  &cell, &options, number of the cell for the simulation seed
+*  @return   :  false if the poses cannot be loaded
+*********************************************************/
+bool openCell(Cell &cell, const RunOptions &options, unsigned int number)
+{
+	const char *prefix = cell.prefix.c_str();
+	string error;
+	if (!loadPoses(cell.pose_file.c_str(), cell.poses, error))
+	{
+		printf("%sError loading %s: %s\n", prefix, cell.pose_file.c_str(), error.c_str());
+		return false;
+	}
+	printf("%s%u poses loaded from %s\n", prefix, (unsigned int)cell.poses.size(), cell.pose_file.c_str());
+
+	if (options.optimize)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		PathOptimizer optimizer(cell.poses);
+		vector<size_t> identity(cell.poses.size());
+		for (size_t i = 0; i < identity.size(); i++)
+			identity[i] = i;
+		vector<size_t> order = optimizer.optimize(PATH_OPTIMIZE_TIMEOUT);
+		printf("%spath cost %.3f -> %.3f in %lu ms\n", prefix, optimizer.pathCost(identity), optimizer.pathCost(order),
+			(unsigned long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count());
+		reorderPoses(cell.poses, order);
+	}
+
+	if (simulate)
+	{
+		//cells do not fail in step
+		SimConfig config = options.simulation;
+		config.seed += number;
+		cell.sim_robot.configure(config);
+		cell.sim_scanner.configure(config);
+		cell.telemetry.setScale(config.speed);
+	}
+
+	//skip what an earlier run of the same poses finished
+	makeDirectory(cell.dir.c_str());
+	string journal_path = cell.dir + "/" JOURNAL_FILE;
+	string frame_poses_path = cell.dir + "/" FRAME_POSES_FILE;
+	if (options.restart)
+	{
+		remove((journal_path + ".old").c_str());
+		rename(journal_path.c_str(), (journal_path + ".old").c_str());
+		remove(frame_poses_path.c_str());
+	}
+	if (!cell.journal.open(journal_path.c_str(), CampaignJournal::fingerprint(cell.poses), cell.poses.size()))
+		printf("%scannot write %s, progress is not kept!\n", prefix, journal_path.c_str());
+	cell.pending = unfinishedPoses(cell);
+	cell.frame_poses = fopen(frame_poses_path.c_str(), "a");
+	if (cell.frame_poses == NULL)
+		printf("%scannot write %s, registration cannot be seeded!\n", prefix, frame_poses_path.c_str());
+	string telemetry_path = options.telemetry_file ? options.telemetry_file : cell.dir + "/telemetry.csv";
+	if (!cell.telemetry.open(telemetry_path.c_str()))
+		printf("%scannot write %s, no timings are kept!\n", prefix, telemetry_path.c_str());
+	if (cell.pending.size() < cell.poses.size())
+		printf("%sresuming: %u of %u poses finished, %u scanned\n", prefix,
+			(unsigned int)(cell.poses.size() - cell.pending.size()), (unsigned int)cell.poses.size(),
+			(unsigned int)cell.journal.doneCount());
+
+	string component = cell.name.empty() ? "" : cell.name + "/";
+	Cell *c = &cell;
+	if (simulate)
+	{
+		//the stand-ins answer in-process, there is no link to watch
+		cell.use_capture_service = true;
+	}
+	else
+	{
+		//one connection for the whole run, goals go through the move_group action
+		cell.move_group.registerWith(cell.nh);
+		cell.nh.advertise(cell.batch_pub);
+		cell.nh.advertise(cell.batch_ack_pub);
+		cell.nh.subscribe(cell.batch_status_sub);
+		if (options.ik_check)
+		{
+			cell.ik.configure(PLANNING_GROUP, END_EFFECTOR_LINK, PLANNING_FRAME, true);
+			cell.nh.serviceClient(cell.ik.client);
 		}
-		if (i != j) {
-			result.push_back(s.substr(i, j - i));
-			i = j;
+		if (options.tf)
+		{
+			cell.tf.reset(new tf::TransformBuffer<>());
+			cell.tf->registerWith(cell.nh);
+			cell.tf_poses.resize(cell.poses.size());
+			cell.has_tf_pose.assign(cell.poses.size(), 0);
 		}
+		if (!connectLink(cell))
+			printf("%sno link to %s yet\n", prefix, cell.ros_master.c_str());
+		cell.link_component = supervisor.watch((component + "link").c_str(),
+			[c] { return linkAlive(*c); }, [c] { return connectLink(*c); });
+
+		//keep the scanner open for the whole run instead of one process per pose
+		cell.use_capture_service = openCaptureService(cell);
+		if (!cell.use_capture_service)
+			printf("%sNo capture service, starting the scanner for every pose\n", prefix);
 	}
-	return result;
+	cell.capture_component = supervisor.watch((component + "capture").c_str(),
+		[c] { return simulate || c->capture_service.connected(); }, [c] { return openCaptureService(*c); });
+	cell.campaign_component = supervisor.watch((component + "campaign").c_str(),
+		[] { return true; }, [c] { c->restart_pass = true; return true; }, CAMPAIGN_STALL_TIMEOUT);
+	return true;
+}
+
+/********************************************************
+*  @function :  runCell
+*  @brief    :  one pass over the unfinished poses of a cell; with
+*               --supervise, more passes until every pose is finished or
+*               passes stop making progress
+*  @input    :  &cell, &options
+*  @return   :  null
+*********************************************************/
+void runCell(Cell &cell, const RunOptions &options)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (options.ik_check && !cell.pending.empty())
+		checkReach(cell);
+	int idle_passes = 0;
+	for (int pass = 0; !cell.pending.empty(); pass++)
+	{
+		if (pass > 0)
+		{
+			if (!options.supervise)
+				break;
+			supervisor.fail(cell.campaign_component, "poses left");
+			supervisor.await(cell.campaign_component, 0);
+		}
+		cell.restart_pass = false;
+		size_t finished = cell.journal.finishedCount();
+		runPass(cell, options.batch_mode, options.pipeline_mode);
+
+		if (cell.journal.finishedCount() > finished)
+			idle_passes = 0;
+		else if (++idle_passes >= MAX_IDLE_PASSES)
+		{
+			printf("%s%d passes without progress, giving up\n", cell.prefix.c_str(), idle_passes);
+			break;
+		}
+		cell.pending = unfinishedPoses(cell);
+	}
+
+	cell.journal.close();
+	if (cell.frame_poses)
+		fclose(cell.frame_poses);
+	cell.frame_poses = NULL;
+	printf("%s%u of %u poses scanned\n", cell.prefix.c_str(), (unsigned int)cell.journal.doneCount(),
+		(unsigned int)cell.poses.size());
+	if (cell.started_capture_service)
+		cell.capture_service.quit();
+	cell.telemetry.close();
+	if (simulate)
+	{
+		cell.sim_scanner.stop();
+		double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		double campaign = wall * options.simulation.speed;
+		printf("%ssimulated %.1f min of campaign in %.1f s, %.1f poses/h, robot moving %.0f%% of the time\n",
+			cell.prefix.c_str(), campaign / 60, wall, cell.journal.doneCount() * 3600.0 / max(campaign, 1e-3),
+			100 * cell.sim_robot.motionTime() / max(campaign * 1000, 1e-3));
+	}
+}
+
+/********************************************************
+*  @function :  loadCells
+*  @brief    :  read a cells file, one cell per line:
+*               name ros_master pose_file [capture_port [scanner_serial]]
+*               blank lines and lines starting with '#' are skipped
+*  @input    :  path, &cells, &error
+*  @return   :  true if every line was understood
+*********************************************************/
+bool loadCells(const char *path, vector<unique_ptr<Cell> > &cells, string &error)
+{
+	ifstream in(path);
+	if (!in)
+	{
+		error = string("cannot open ") + path;
+		return false;
+	}
+	set<string> names;
+	string text;
+	for (unsigned int line = 1; getline(in, text); line++)
+	{
+		istringstream fields(text);
+		unique_ptr<Cell> cell(new Cell);
+		if (!(fields >> cell->name) || cell->name[0] == '#')
+			continue;
+		if (!(fields >> cell->ros_master >> cell->pose_file))
+		{
+			error = "line " + to_string(line) + ": name, ros master and pose file expected";
+			return false;
+		}
+		if (!names.insert(cell->name).second)
+		{
+			error = "line " + to_string(line) + ": cell " + cell->name + " twice";
+			return false;
+		}
+		cell->capture_port = CAPTURE_PORT + (int)cells.size();
+		fields >> cell->capture_port >> cell->scanner_serial;
+		cell->prefix = "[" + cell->name + "] ";
+		cell->dir = string(CAMPAIGN_DIR "/") + cell->name;
+		cells.push_back(move(cell));
+	}
+	if (cells.empty())
+	{
+		error = "no cells";
+		return false;
+	}
+	return true;
+}
+
+//--benchmark-link: bursts of small frames, as state and telemetry
+//topics send them, with and without coalescing
+#define LINK_BENCH_BURSTS 2000
+#define LINK_BENCH_BURST 20
+#define LINK_BENCH_WINDOW 5
+
+//CPU time of the process in seconds, clock() is wall time on Windows
+double cpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME created, exited, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) / 1e7;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/********************************************************
+*  @function :  benchmarkLink
+*  @brief    :  publish bursts of small messages over a link of their
+*               own, one write per frame and then coalesced, and report
+*               frames, writes, packets/s and CPU time of each
+*  @input    :  rosserial server, host[:port]
+*  @return   :  0, 1 if the link did not come up
+*********************************************************/
+int benchmarkLink(const char *ros_master)
+{
+	ros::NodeHandle nh;
+	geometry_msgs::Twist twist;
+	ros::Publisher pub("link_benchmark", &twist);
+	nh.advertise(pub);
+	nh.initNode((char *)ros_master);
+	for (int i = 0; i < LINK_CONNECT_TIMEOUT / 100 && !nh.connected(); i++)
+	{
+		nh.spinOnce();
+		nh.wait(100);
+	}
+	if (!nh.connected())
+	{
+		printf("no link to %s!\n", ros_master);
+		return 1;
+	}
+
+	printf("%d bursts of %d messages\n", LINK_BENCH_BURSTS, LINK_BENCH_BURST);
+	printf("mode         frames   writes   writes/s   frames/s  cpu us/frame\n");
+	for (int coalesce = 0; coalesce < 2; coalesce++)
+	{
+		nh.setCoalescing(coalesce ? LINK_BENCH_WINDOW : 0);
+		unsigned long frames = nh.getFramesSent(), writes = nh.getWrites();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		double cpu = cpuSeconds();
+		for (int b = 0; b < LINK_BENCH_BURSTS; b++)
+		{
+			for (int m = 0; m < LINK_BENCH_BURST; m++)
+			{
+				twist.linear.x = b;
+				twist.angular.z = m;
+				pub.publish(&twist);
+			}
+			nh.spinOnce();
+		}
+		nh.flush();
+		cpu = cpuSeconds() - cpu;
+		double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		frames = nh.getFramesSent() - frames;
+		writes = nh.getWrites() - writes;
+		printf("%-10s %8lu %8lu %10.0f %10.0f %13.2f\n", coalesce ? "coalesced" : "per frame", frames, writes,
+			writes / wall, frames / wall, cpu * 1e6 / frames);
+	}
+	return 0;
 }
 
 int main(int argc, char * argv[])
 {
+	//--batch: send the whole pose list at once instead of one goal per pose
+	//--pipeline: overlap motion, capture and processing of successive poses
+	//--optimize: visit the poses in the order of least robot travel
+	//--convert out: write the poses as a binary pose file and stop
+	//--restart: start over instead of resuming from the journal
+	//--supervise: keep going over the unfinished poses until all are done
+	//--ik-check: skip poses without an IK solution before the robot moves
+	//--tf: record where /tf says the end effector was at each capture
+	//--telemetry file: where per pose timings go, .csv or .jsonl
+	//--simulate file: no robot and no scanner, stand-ins modelled by file
+	//--cells file: run several cells at once, see loadCells()
+	//--reconstructions n: most meshes reconstructed at once over all cells
+	//--benchmark-link host: time small-frame publishing on a link and stop
+	//the pose file may follow the options, pose.txt by default
+	RunOptions options;
+	options.batch_mode = false;
+	options.pipeline_mode = false;
+	options.optimize = false;
+	options.restart = false;
+	options.supervise = false;
+	options.ik_check = false;
+	options.tf = false;
+	options.telemetry_file = NULL;
+	const char *convert_to = NULL;
+	const char *simulation_file = NULL;
+	const char *cells_file = NULL;
+	int reconstructions = -1;
 	//ȡpose.txtļposeϢ
-	//pose.txtļѿո
-	vector<geometry_msgs::Pose> pose_vector;
-	char buffer[512];
-	//if (argc != 3)return printf("[usage] %s pose.txt scanner.exe\n", argv[0]);
-	//ifstream in(argv[1]);
-	ifstream in("pose.txt");
-	if (!in.is_open())
-	{
-		cout << "Error opening file"; exit(1);
-	}
-	while (!in.eof())
-	{
-		in.getline(buffer, 100);
-		//cout << buffer << endl;
-		vector<string> v = split(buffer, " ");
-		geometry_msgs::Pose pose_temp;
-		pose_temp.position.x = std::stod(v[0]);
-		pose_temp.position.y = std::stod(v[1]);
-		pose_temp.position.z = std::stod(v[2]);
-		pose_temp.orientation.x = std::stod(v[3]);
-		pose_temp.orientation.y = std::stod(v[4]);
-		pose_temp.orientation.z = std::stod(v[5]);
-		pose_temp.orientation.w = std::stod(v[6]);
-		printf("#################################start publish!\n");
-		cout << v[0] << endl;
-		posePublish(pose_temp);
-		printf("#################################Go robot go!\n");
-		//ͣ5
-		Sleep(2000);
-		printf("#################################start subscribe!\n");
-		statusSubscriber();
-		if (goal_exe_status == 4)
+	//pose.txtļѿո, or a binary pose file, see pose_loader.h
+	const char *pose_file = "pose.txt";
+	for (int i = 1; i < argc; i++)
+	{
+		string option = argv[i];
+		if (option == "--batch")
+			options.batch_mode = true;
+		else if (option == "--pipeline")
+			options.pipeline_mode = true;
+		else if (option == "--optimize")
+			options.optimize = true;
+		else if (option == "--restart")
+			options.restart = true;
+		else if (option == "--supervise")
+			options.supervise = true;
+		else if (option == "--ik-check")
+			options.ik_check = true;
+		else if (option == "--tf")
+			options.tf = true;
+		else if (option == "--convert" && i + 1 < argc)
+			convert_to = argv[++i];
+		else if (option == "--telemetry" && i + 1 < argc)
+			options.telemetry_file = argv[++i];
+		else if (option == "--simulate" && i + 1 < argc)
+			simulation_file = argv[++i];
+		else if (option == "--cells" && i + 1 < argc)
+			cells_file = argv[++i];
+		else if (option == "--reconstructions" && i + 1 < argc)
+			reconstructions = atoi(argv[++i]);
+		else if (option == "--benchmark-link" && i + 1 < argc)
+			return benchmarkLink(argv[++i]);
+		else
+			pose_file = argv[i];
+	}
+
+	string error;
+	if (convert_to)
+	{
+		PoseSet poses;
+		if (!loadPoses(pose_file, poses, error))
 		{
-			printf("wait execute successfully!\n");
-			Sleep(4000);
-			statusSubscriber();
+			printf("Error loading %s: %s\n", pose_file, error.c_str());
+			exit(1);
 		}
+		if (options.optimize)
+			reorderPoses(poses, PathOptimizer(poses).optimize(PATH_OPTIMIZE_TIMEOUT));
+		if (!savePosesBinary(convert_to, poses, error))
+		{
+			printf("%s\n", error.c_str());
+			return 1;
+		}
+		printf("%s written\n", convert_to);
+		return 0;
+	}
 
-		while (goal_exe_status == 1)
+	if (simulation_file)
+	{
+		if (!loadSimConfig(simulation_file, options.simulation, error))
 		{
-			printf("wait execute successfully!\n");
-			Sleep(1000);
-			statusSubscriber();
+			printf("Error loading %s: %s\n", simulation_file, error.c_str());
+			exit(1);
 		}
-		//Sleep(5000);//time for scanner to capture
-
-		//simple-capture-sampled.exe·
-		std::string sprPath = "C:/Users/mlang/Desktop/autoscanner/artec-sdk-samples-v2.0-20171207/samples/simple-capture/bin-vc14-x64/simple-capture-sample.exe";
-		//std::string sprPath = argv[2];
-		//жmove plan ִ״̬succeedscannerɨ
-		
-		switch (goal_exe_status)
+		simulate = true;
+		printf("simulating robot and scanner at %gx speed\n", options.simulation.speed);
+	}
+
+	vector<unique_ptr<Cell> > cells;
+	if (cells_file)
+	{
+		if (!loadCells(cells_file, cells, error))
 		{
-		case 1:
-			printf("This goal has been accepted by the simple action server! \n");
-			break;
-		case 2:
-			printf("Arm move plan PREEMPTED=2!\n");
-			break;
-		case 3:
-			printf("Arm move plan SUCCEEDED=3!\n");
-			printf("Start Scanner!\n");
-			system(sprPath.c_str());
-			printf("Scanner done!\n");
-			break;
-		case 4:
-			printf("Arm move plan ABORTED=4!\n");
-			cout << "fail path " << buffer << endl;
-			break;
-		case 5:
-			printf("Arm move plan REJECTED=5!\n");
-			break;
-		case 6:
-			printf("Arm move plan PREEMPTING=6!\n");
-			break;
-		case 7:
-			printf("Arm move plan RECALLING=7!\n");
-			break;
-		case 8:
-			printf("Arm move plan RECALLED=8!\n");
-			break;
-		case 9:
-			printf("Arm move plan LOST=9!\n");
-			break;
-		default:
-			break;
+			printf("Error loading %s: %s\n", cells_file, error.c_str());
+			exit(1);
 		}
-		goal_exe_status = 0;
+		if (options.telemetry_file)
+		{
+			printf("--telemetry is per cell with --cells, each cell writes to its directory\n");
+			options.telemetry_file = NULL;
+		}
+		//a core for each reconstruction, the rest for everything else
+		if (reconstructions < 0)
+			reconstructions = max(2, (int)thread::hardware_concurrency() / 2);
+	}
+	else
+	{
+		cells.push_back(unique_ptr<Cell>(new Cell));
+		cells[0]->pose_file = pose_file;
+	}
+	several_cells = cells.size() > 1;
+	reconstruction_slots.setLimit(reconstructions > 0 ? reconstructions : 0);
+	if (reconstructions > 0)
+		printf("at most %d reconstructions at once\n", reconstructions);
+
+	makeDirectory(CAMPAIGN_DIR);
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		if (!openCell(*cells[i], options, (unsigned int)i))
+			exit(1);
 	}
 
+	//a plain run keeps to the main thread, cells get one each
+	if (cells.size() == 1)
+	{
+		runCell(*cells[0], options);
+	}
+	else
+	{
+		vector<thread> threads;
+		for (size_t i = 0; i < cells.size(); i++)
+			threads.push_back(thread(runCell, ref(*cells[i]), cref(options)));
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+	supervisor.report(stdout);
+	bool finished = true;
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		if (!cells[i]->name.empty())
+			printf("cell %s:\n", cells[i]->name.c_str());
+		cells[i]->telemetry.summary(stdout);
+		finished = finished && cells[i]->pending.empty();
+	}
 	printf("All done!\n");
-	return 0;
-}
\ No newline at end of file
+	//the relaunch loop in test.cpp runs a supervised campaign until it finishes
+	return options.supervise && !finished ? 1 : 0;
+}
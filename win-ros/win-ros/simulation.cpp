@@ -0,0 +1,523 @@
+/********************************************************
+* @file    : simulation.cpp
+* @brief   : stand-ins for the robot and the scanner, for campaigns
+*            without hardware
+*********************************************************/
+#include "stdafx.h"
+#include "simulation.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <actionlib_msgs/GoalStatus.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+using actionlib_msgs::GoalStatus;
+
+//a mesh to save when no recorded frames are given
+static const char *placeholder_frame = "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n";
+
+SimConfig::SimConfig()
+	: speed(1), seed(1),
+	plan_ms(500), linear_speed(0.25), angular_speed(1.0), settle_ms(300), motion_jitter(0.1),
+	reject_rate(0), abort_rate(0), lost_rate(0),
+	capture_ms(1000), reconstruct_ms(3000), save_ms(500),
+	capture_failure_rate(0), save_failure_rate(0)
+{
+}
+
+/********************************************************
+*  @function :  loadSimConfig
+*  @brief    :  read a simulation file over the defaults
+*  @input    :  path, &config, &error
+*  @return   :  true if every line was understood
+*********************************************************/
+bool loadSimConfig(const char *path, SimConfig &config, std::string &error)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		error = std::string("cannot open ") + path;
+		return false;
+	}
+
+	struct { const char *key; double *value; } numbers[] = {
+		{ "speed", &config.speed },
+		{ "plan_ms", &config.plan_ms },
+		{ "linear_speed", &config.linear_speed },
+		{ "angular_speed", &config.angular_speed },
+		{ "settle_ms", &config.settle_ms },
+		{ "motion_jitter", &config.motion_jitter },
+		{ "reject_rate", &config.reject_rate },
+		{ "abort_rate", &config.abort_rate },
+		{ "lost_rate", &config.lost_rate },
+		{ "capture_ms", &config.capture_ms },
+		{ "reconstruct_ms", &config.reconstruct_ms },
+		{ "save_ms", &config.save_ms },
+		{ "capture_failure_rate", &config.capture_failure_rate },
+		{ "save_failure_rate", &config.save_failure_rate },
+	};
+
+	char text[1024];
+	bool ok = true;
+	for (unsigned int line = 1; ok && fgets(text, sizeof(text), file); line++)
+	{
+		char *comment = strchr(text, '#');
+		if (comment)
+			*comment = '\0';
+		char key[64], value[960];
+		int fields = sscanf(text, "%63s %959s", key, value);
+		if (fields <= 0)
+			continue;	//blank
+		if (fields == 1)
+		{
+			error = std::string("line ") + std::to_string(line) + ": " + key + " has no value";
+			ok = false;
+			break;
+		}
+
+		std::string name = key;
+		bool known = false;
+		if (name == "seed")
+		{
+			config.seed = (unsigned int)strtoul(value, NULL, 10);
+			known = true;
+		}
+		else if (name == "frames")
+		{
+			config.frames = value;
+			known = true;
+		}
+		for (size_t i = 0; !known && i < sizeof(numbers) / sizeof(numbers[0]); i++)
+		{
+			if (name != numbers[i].key)
+				continue;
+			char *end;
+			*numbers[i].value = strtod(value, &end);
+			if (*end != '\0' || *numbers[i].value < 0)
+			{
+				error = std::string("line ") + std::to_string(line) + ": bad value " + value + " for " + key;
+				ok = false;
+			}
+			known = true;
+		}
+		if (ok && !known)
+		{
+			error = std::string("line ") + std::to_string(line) + ": unknown key " + key;
+			ok = false;
+		}
+	}
+	fclose(file);
+	if (ok && (config.speed <= 0 || config.linear_speed <= 0 || config.angular_speed <= 0))
+	{
+		error = "speed, linear_speed and angular_speed must be positive";
+		ok = false;
+	}
+	return ok;
+}
+
+/********************************************************
+*  @function :  listFrames
+*  @brief    :  the OBJ files of a directory, sorted by name
+*  @input    :  directory
+*  @return   :  full paths
+*********************************************************/
+static std::vector<std::string> listFrames(const std::string &directory)
+{
+	std::vector<std::string> frames;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA((directory + "\\*.obj").c_str(), &found);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			frames.push_back(directory + "\\" + found.cFileName);
+		} while (FindNextFileA(find, &found));
+		FindClose(find);
+	}
+#else
+	DIR *dir = opendir(directory.c_str());
+	if (dir)
+	{
+		while (struct dirent *entry = readdir(dir))
+		{
+			std::string name = entry->d_name;
+			if (name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0)
+				frames.push_back(directory + "/" + name);
+		}
+		closedir(dir);
+	}
+#endif
+	std::sort(frames.begin(), frames.end());
+	return frames;
+}
+
+//a duration with the configured spread, never negative
+static double spread(std::mt19937 &random, double ms, double jitter)
+{
+	if (jitter <= 0)
+		return ms;
+	std::normal_distribution<double> normal(1.0, jitter);
+	return ms * std::max(0.0, normal(random));
+}
+
+SimRobot::SimRobot()
+	: placed_(false), motion_time_(0), stop_(false), seq_(0), acked_(-1)
+{
+}
+
+SimRobot::~SimRobot()
+{
+	stopBatch();
+}
+
+void SimRobot::configure(const SimConfig &config)
+{
+	stopBatch();
+	std::lock_guard<std::mutex> lock(mutex_);
+	config_ = config;
+	clock_.setSpeed(config.speed);
+	random_.seed(config.seed);
+	placed_ = false;
+	motion_time_ = 0;
+}
+
+double SimRobot::jitter(double ms)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return spread(random_, ms, config_.motion_jitter);
+}
+
+bool SimRobot::draw(double rate)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return rate > 0 && std::uniform_real_distribution<double>(0, 1)(random_) < rate;
+}
+
+/********************************************************
+*  @function :  reachable
+*  @brief    :  whether the pose has a plan; abort_rate of the poses have
+*               none, the same ones on every move and every run with the
+*               same seed, like poses out of reach of a real arm
+*  @input    :  &pose
+*  @return   :  false if a move there aborts
+*********************************************************/
+bool SimRobot::reachable(const geometry_msgs::Pose &pose) const
+{
+	const double values[7] = { pose.position.x, pose.position.y, pose.position.z,
+		pose.orientation.x, pose.orientation.y, pose.orientation.z, pose.orientation.w };
+	uint64_t hash = 14695981039346656037ULL ^ config_.seed;
+	for (int i = 0; i < 7; i++)
+	{
+		hash ^= (uint64_t)(int64_t)floor(values[i] * 1e4 + 0.5);
+		hash *= 1099511628211ULL;
+	}
+	return (hash >> 11) * (1.0 / 9007199254740992.0) >= config_.abort_rate;
+}
+
+/********************************************************
+*  @function :  motionModel
+*  @brief    :  time to travel from the current pose: the translation at
+*               linear_speed or the rotation at angular_speed, whichever
+*               takes longer, plus the settle time
+*  @input    :  &pose
+*  @return   :  simulated milliseconds
+*********************************************************/
+double SimRobot::motionModel(const geometry_msgs::Pose &pose) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!placed_)
+		return config_.settle_ms;
+	double dx = pose.position.x - at_.position.x;
+	double dy = pose.position.y - at_.position.y;
+	double dz = pose.position.z - at_.position.z;
+	double dot = fabs(pose.orientation.x * at_.orientation.x + pose.orientation.y * at_.orientation.y +
+		pose.orientation.z * at_.orientation.z + pose.orientation.w * at_.orientation.w);
+	double angle = 2 * acos(std::min(1.0, dot));
+	double travel = std::max(sqrt(dx * dx + dy * dy + dz * dz) / config_.linear_speed,
+		angle / config_.angular_speed);
+	return travel * 1000 + config_.settle_ms;
+}
+
+/********************************************************
+*  @function :  execute
+*  @brief    :  one move, taking as long as the models say
+*  @input    :  &pose, plan: false if the move was planned with its batch
+*  @return   :  GoalStatus of the outcome
+*********************************************************/
+int SimRobot::execute(const geometry_msgs::Pose &pose, bool plan)
+{
+	if (draw(config_.reject_rate))
+		return GoalStatus::REJECTED;
+	if (plan)
+		clock_.sleep(jitter(config_.plan_ms));
+	if (!reachable(pose))
+		return GoalStatus::ABORTED;
+
+	double ms = jitter(motionModel(pose));
+	clock_.sleep(ms);
+	std::lock_guard<std::mutex> lock(mutex_);
+	at_ = pose;
+	placed_ = true;
+	motion_time_ += ms;
+	//the robot got there, but nobody heard of it
+	if (std::uniform_real_distribution<double>(0, 1)(random_) < config_.lost_rate)
+		return GoalStatus::LOST;
+	return GoalStatus::SUCCEEDED;
+}
+
+int SimRobot::move(const geometry_msgs::Pose &pose)
+{
+	return execute(pose, true);
+}
+
+void SimRobot::startBatch(unsigned int seq, const std::vector<geometry_msgs::Pose> &waypoints)
+{
+	stopBatch();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = false;
+		seq_ = seq;
+		acked_ = -1;
+		statuses_.clear();
+	}
+	batch_ = std::thread(&SimRobot::batchLoop, this, seq, waypoints);
+}
+
+void SimRobot::batchLoop(unsigned int seq, std::vector<geometry_msgs::Pose> waypoints)
+{
+	//the whole sequence is planned at once
+	clock_.sleep(jitter(config_.plan_ms));
+	for (size_t i = 0; i < waypoints.size(); i++)
+	{
+		char id[32];
+		sprintf(id, "%u/%u", seq, (unsigned int)i);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (stop_)
+				return;
+			statuses_.push_back(std::make_pair(std::string(id), (int)GoalStatus::ACTIVE));
+			changed_.notify_all();
+		}
+		int status = execute(waypoints[i], false);
+
+		//dwell until the scan there is done
+		std::unique_lock<std::mutex> lock(mutex_);
+		statuses_.push_back(std::make_pair(std::string(id), status));
+		changed_.notify_all();
+		changed_.wait(lock, [this, i] { return stop_ || acked_ >= (long)i; });
+	}
+}
+
+void SimRobot::stopBatch()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+		changed_.notify_all();
+	}
+	if (batch_.joinable())
+		batch_.join();
+}
+
+bool SimRobot::pollStatus(std::string &goal_id, int &status)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (statuses_.empty())
+		return false;
+	goal_id = statuses_.front().first;
+	status = statuses_.front().second;
+	statuses_.pop_front();
+	return true;
+}
+
+void SimRobot::waitStatus(unsigned long timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	changed_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return !statuses_.empty(); });
+}
+
+void SimRobot::ack(unsigned int seq, size_t index)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (seq == seq_ && (long)index > acked_)
+		acked_ = (long)index;
+	changed_.notify_all();
+}
+
+double SimRobot::motionTime() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return motion_time_;
+}
+
+SimScanner::SimScanner()
+	: next_frame_(0), stop_(false)
+{
+}
+
+SimScanner::~SimScanner()
+{
+	stop();
+}
+
+void SimScanner::configure(const SimConfig &config)
+{
+	stop();
+	config_ = config;
+	clock_.setSpeed(config.speed);
+	//not the robot's sequence, or failures would line up with its draws
+	random_.seed(config.seed + 1);
+	frames_.clear();
+	if (!config.frames.empty())
+	{
+		frames_ = listFrames(config.frames);
+		if (frames_.empty())
+			printf("no OBJ frames in %s, saving placeholders\n", config.frames.c_str());
+	}
+	next_frame_ = 0;
+	stop_ = false;
+	worker_ = std::thread(&SimScanner::workLoop, this);
+}
+
+void SimScanner::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+		changed_.notify_all();
+	}
+	if (worker_.joinable())
+		worker_.join();
+}
+
+double SimScanner::jitter(double ms)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return spread(random_, ms, config_.motion_jitter);
+}
+
+bool SimScanner::draw(double rate)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return rate > 0 && std::uniform_real_distribution<double>(0, 1)(random_) < rate;
+}
+
+/********************************************************
+*  @function :  capture
+*  @brief    :  take a frame, return once it is taken
+*  @input    :  id of the pose, timeout_ms of real time
+*  @return   :  true if the frame was taken
+*********************************************************/
+bool SimScanner::capture(const std::string &id, unsigned long timeout_ms)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_[id] = Job();
+	}
+	double ms = jitter(config_.capture_ms);
+	bool failed = draw(config_.capture_failure_rate) || ms / clock_.speed() > timeout_ms;
+	clock_.sleep(std::min(ms, timeout_ms * clock_.speed()));
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (failed)
+	{
+		//nobody waits for the mesh of a failed capture
+		jobs_.erase(id);
+		printf("Capture %s failed: simulated\n", id.c_str());
+		return false;
+	}
+	jobs_[id].captured_at = clock_.now();
+	queue_.push_back(id);
+	changed_.notify_all();
+	return true;
+}
+
+bool SimScanner::writeFrame(const std::string &file)
+{
+	FILE *out = fopen(file.c_str(), "wb");
+	if (out == NULL)
+		return false;
+	bool ok = true;
+	if (frames_.empty())
+	{
+		ok = fputs(placeholder_frame, out) >= 0;
+	}
+	else
+	{
+		FILE *in = fopen(frames_[next_frame_++ % frames_.size()].c_str(), "rb");
+		ok = in != NULL;
+		char buffer[65536];
+		size_t got;
+		while (ok && (got = fread(buffer, 1, sizeof(buffer), in)) > 0)
+			ok = fwrite(buffer, 1, got, out) == got;
+		if (in)
+			fclose(in);
+	}
+	return fclose(out) == 0 && ok;
+}
+
+//reconstruct and save the captured frames in order, like the service
+void SimScanner::workLoop()
+{
+	while (true)
+	{
+		std::string id;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			changed_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+			if (stop_)
+				return;
+			id = queue_.front();
+			queue_.pop_front();
+			jobs_[id].started_at = clock_.now();
+		}
+
+		clock_.sleep(jitter(config_.reconstruct_ms));
+		double reconstructed = clock_.now();
+		clock_.sleep(jitter(config_.save_ms));
+		std::string file = id + ".obj";
+		bool saved = !draw(config_.save_failure_rate) && writeFrame(file);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		Job &job = jobs_[id];
+		job.reconstructed_at = reconstructed;
+		job.saved_at = clock_.now();
+		job.saved = saved;
+		job.failed = !saved;
+		job.file = file;
+		changed_.notify_all();
+	}
+}
+
+bool SimScanner::waitSaved(const std::string &id, std::string &file, unsigned long timeout_ms,
+	CaptureTimes *times)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	changed_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, &id] {
+		const Job &job = jobs_[id];
+		return job.saved || job.failed;
+	});
+	Job job = jobs_[id];
+	if (job.saved || job.failed)
+		jobs_.erase(id);
+	if (job.failed)
+		printf("Capture %s failed: simulated\n", id.c_str());
+	file = job.file;
+	if (times && job.saved)
+	{
+		times->queue = job.started_at - job.captured_at;
+		times->reconstruct = job.reconstructed_at - job.started_at;
+		times->save = job.saved_at - job.reconstructed_at;
+	}
+	return job.saved;
+}
@@ -0,0 +1,198 @@
+/********************************************************
+* @file    : simulation.h
+* @brief   : stand-ins for the robot and the scanner, for campaigns
+*            without hardware
+* @details : SimRobot takes the goals the orchestrator would send to
+*            move_group and answers with the GoalStatus a real move would
+*            end in, after the time the motion model gives for the
+*            distance from the last pose. Batches are answered the way the
+*            ROS side node does: an ACTIVE and a final status per waypoint
+*            as "<batch>/<index>" goal ids, dwelling at each waypoint until
+*            it is acknowledged. SimScanner answers capture requests like
+*            the capture service: capture() returns once the frame would
+*            be taken, a worker thread then reconstructs and saves it by
+*            copying the next recorded OBJ frame from disk.
+*            All times are simulated milliseconds, and the simulation runs
+*            SimConfig::speed times faster than real time. Failures are
+*            drawn from a seeded generator, so a run can be repeated.
+*            Neither needs Windows: off Windows the orchestrator builds
+*            with g++ -std=c++14 -pthread -I../ros_lib *.cpp
+*            ../ros_lib/WindowsSocket.cpp ../ros_lib/time.cpp
+*            ../ros_lib/duration.cpp and runs simulated campaigns.
+*********************************************************/
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <geometry_msgs/Pose.h>
+#include "capture_client.h"
+
+/********************************************************
+*  @class    :  SimConfig
+*  @brief    :  the models of a simulated campaign, read from a text file
+*               of "key value" lines; '#' starts a comment
+*********************************************************/
+struct SimConfig
+{
+	SimConfig();
+
+	double speed;				//simulated time runs this many times faster
+	unsigned int seed;
+
+	//robot: plan, then travel at the slower of the two speeds, then settle
+	double plan_ms;
+	double linear_speed;		//m/s
+	double angular_speed;		//rad/s
+	double settle_ms;
+	double motion_jitter;		//relative spread of every duration
+	double reject_rate;			//goal rejected at once
+	double abort_rate;			//poses with no plan, see SimRobot::reachable
+	double lost_rate;			//goal lost during the motion
+
+	//scanner
+	std::string frames;			//directory of recorded OBJ frames
+	double capture_ms;
+	double reconstruct_ms;
+	double save_ms;
+	double capture_failure_rate;
+	double save_failure_rate;
+};
+
+//load a simulation file, error says what and where on failure
+bool loadSimConfig(const char *path, SimConfig &config, std::string &error);
+
+/********************************************************
+*  @class    :  SimClock
+*  @brief    :  simulated time, sped up
+*********************************************************/
+class SimClock
+{
+public:
+	SimClock() : start_(std::chrono::steady_clock::now()), speed_(1) {}
+
+	void setSpeed(double speed) { speed_ = speed > 0 ? speed : 1; }
+	double speed() const { return speed_; }
+
+	//simulated milliseconds since construction
+	double now() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count() * speed_;
+	}
+
+	void sleep(double ms) const
+	{
+		if (ms > 0)
+			std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(ms / speed_));
+	}
+
+private:
+	std::chrono::steady_clock::time_point start_;
+	double speed_;
+};
+
+class SimRobot
+{
+public:
+	SimRobot();
+	~SimRobot();
+
+	void configure(const SimConfig &config);
+
+	//plan and execute a move, returns the GoalStatus it ends in
+	int move(const geometry_msgs::Pose &pose);
+
+	//visit the waypoints in order, replaces an unfinished batch
+	void startBatch(unsigned int seq, const std::vector<geometry_msgs::Pose> &waypoints);
+
+	//next status transition of the batch, in the order they happened
+	bool pollStatus(std::string &goal_id, int &status);
+
+	//wait up to timeout_ms of real time for a status to poll
+	void waitStatus(unsigned long timeout_ms);
+
+	//the scan at a waypoint is done, the robot may go on
+	void ack(unsigned int seq, size_t index);
+
+	//simulated time spent moving so far
+	double motionTime() const;
+
+	//the simulated answer of an IK or plan request for the pose
+	bool reachable(const geometry_msgs::Pose &pose) const;
+
+private:
+	int execute(const geometry_msgs::Pose &pose, bool plan);
+	double motionModel(const geometry_msgs::Pose &pose) const;
+	double jitter(double ms);
+	bool draw(double rate);
+	void batchLoop(unsigned int seq, std::vector<geometry_msgs::Pose> waypoints);
+	void stopBatch();
+
+	SimConfig config_;
+	SimClock clock_;
+	std::mt19937 random_;
+	bool placed_;	//false until the first pose is reached
+	geometry_msgs::Pose at_;
+	double motion_time_;
+
+	std::thread batch_;
+	bool stop_;
+	unsigned int seq_;	//the running batch
+	long acked_;		//its last acknowledged waypoint
+	std::deque<std::pair<std::string, int> > statuses_;
+	mutable std::mutex mutex_;
+	std::condition_variable changed_;
+};
+
+class SimScanner
+{
+public:
+	SimScanner();
+	~SimScanner();
+
+	//finds the recorded frames and starts the worker
+	void configure(const SimConfig &config);
+	void stop();
+
+	//same contract as CaptureClient
+	bool capture(const std::string &id, unsigned long timeout_ms);
+	bool waitSaved(const std::string &id, std::string &file, unsigned long timeout_ms,
+		CaptureTimes *times = NULL);
+
+private:
+	struct Job
+	{
+		Job() : captured_at(0), started_at(0), reconstructed_at(0), saved_at(0), saved(false), failed(false) {}
+		double captured_at;
+		double started_at;
+		double reconstructed_at;
+		double saved_at;
+		bool saved;
+		bool failed;
+		std::string file;
+	};
+
+	double jitter(double ms);
+	bool draw(double rate);
+	bool writeFrame(const std::string &file);
+	void workLoop();
+
+	SimConfig config_;
+	SimClock clock_;
+	std::mt19937 random_;
+	std::vector<std::string> frames_;
+	size_t next_frame_;
+
+	std::thread worker_;
+	bool stop_;
+	std::deque<std::string> queue_;	//captured, not saved yet
+	std::map<std::string, Job> jobs_;
+	std::mutex mutex_;
+	std::condition_variable changed_;
+};
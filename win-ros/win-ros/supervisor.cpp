@@ -0,0 +1,154 @@
+/********************************************************
+* @file    : supervisor.cpp
+* @brief   : keep the parts of a campaign running inside the process
+*********************************************************/
+#include "stdafx.h"
+#include "supervisor.h"
+
+#include <algorithm>
+#include <thread>
+
+//longest await() sleeps between checks, in milliseconds
+#define SUPERVISOR_POLL 100
+
+Supervisor::Supervisor()
+{
+}
+
+int Supervisor::watch(const char *name, Probe alive, Restart restart, unsigned long stall_ms)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Component c;
+	c.name = name;
+	c.alive = alive;
+	c.restart = restart;
+	c.stall_ms = stall_ms;
+	c.last_beat = c.last_restart = c.next_attempt = Clock::now();
+	c.backoff_level = 0;
+	c.failed = false;
+	c.restarting = false;
+	c.restarts = 0;
+	c.failed_restarts = 0;
+	components_.push_back(c);
+	return (int)components_.size() - 1;
+}
+
+void Supervisor::beat(int id)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	components_[id].last_beat = Clock::now();
+}
+
+void Supervisor::fail(int id, const char *reason)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	components_[id].failed = true;
+	components_[id].reason = reason;
+}
+
+/********************************************************
+*  @function :  check
+*  @brief    :  probe a component and restart it if it is down
+*  @input    :  id
+*  @return   :  true if the component is up
+*********************************************************/
+bool Supervisor::check(int id)
+{
+	Probe alive;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		alive = components_[id].alive;
+	}
+	bool up = alive();
+
+	Restart restart;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		Component &c = components_[id];
+		Clock::time_point now = Clock::now();
+		if (!c.failed && !up)
+		{
+			c.reason = "down";
+		}
+		else if (!c.failed && c.stall_ms > 0 && now - c.last_beat > std::chrono::milliseconds(c.stall_ms))
+		{
+			up = false;
+			c.reason = "no progress";
+		}
+		if (up && !c.failed)
+		{
+			//ran long enough since the last restart, forgive its past
+			if (c.backoff_level > 0 && now - c.last_restart > std::chrono::milliseconds(SUPERVISOR_STABLE_TIME))
+				c.backoff_level = 0;
+			return true;
+		}
+		if (c.restarting || now < c.next_attempt)
+			return false;	//someone else is on it, or backing off
+
+		c.restarting = true;
+		c.restarts++;
+		c.last_restart = now;
+		unsigned long delay = SUPERVISOR_BACKOFF_MIN << std::min(c.backoff_level, 16u);
+		c.next_attempt = now + std::chrono::milliseconds(std::min(delay, (unsigned long)SUPERVISOR_BACKOFF_MAX));
+		c.backoff_level++;
+		printf("supervisor: restarting %s (%s), restart %u\n", c.name.c_str(), c.reason.c_str(), c.restarts);
+		restart = c.restart;
+	}
+
+	bool restarted = restart();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	Component &c = components_[id];
+	c.restarting = false;
+	if (restarted)
+	{
+		c.failed = false;
+		c.last_beat = Clock::now();
+	}
+	else
+	{
+		c.failed_restarts++;
+		printf("supervisor: %s did not come back\n", c.name.c_str());
+	}
+	return restarted;
+}
+
+bool Supervisor::await(int id, unsigned long timeout_ms)
+{
+	Clock::time_point start = Clock::now();
+	while (!check(id))
+	{
+		Clock::time_point now = Clock::now();
+		if (timeout_ms > 0 && now - start >= std::chrono::milliseconds(timeout_ms))
+			return false;
+
+		//wake up when the backoff ends, or poll
+		Clock::duration wait = std::chrono::milliseconds(SUPERVISOR_POLL);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			Clock::duration backoff = components_[id].next_attempt - now;
+			if (backoff > Clock::duration::zero() && backoff < wait)
+				wait = backoff;
+		}
+		std::this_thread::sleep_for(wait);
+	}
+	return true;
+}
+
+unsigned int Supervisor::restarts(int id) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return components_[id].restarts;
+}
+
+void Supervisor::report(FILE *out) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	fprintf(out, "supervisor:\n");
+	for (size_t i = 0; i < components_.size(); i++)
+	{
+		const Component &c = components_[i];
+		fprintf(out, "  %-10s restarts %3u  failed restarts %3u%s%s\n", c.name.c_str(),
+			c.restarts, c.failed_restarts, c.reason.empty() ? "" : "  last: ", c.reason.c_str());
+	}
+}
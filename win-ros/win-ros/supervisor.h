@@ -0,0 +1,83 @@
+/********************************************************
+* @file    : supervisor.h
+* @brief   : keep the parts of a campaign running inside the process
+* @details : Each watched component has a probe that says whether it
+*            works and a restart that brings it back. A component also
+*            counts as down when it was failed explicitly, or when it has
+*            a stall timeout and sent no heartbeat for that long. check()
+*            restarts a component that is down, but never sooner than its
+*            backoff allows: the delay doubles with every restart, from
+*            SUPERVISOR_BACKOFF_MIN up to SUPERVISOR_BACKOFF_MAX, and
+*            falls back once the component ran SUPERVISOR_STABLE_TIME
+*            without trouble. Only the component that failed is
+*            restarted. Restarts are counted per component and printed by
+*            report().
+*            check() runs the probe and the restart on the calling
+*            thread, so a component that is not thread safe is checked
+*            from the thread that uses it.
+*********************************************************/
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//milliseconds
+#define SUPERVISOR_BACKOFF_MIN 500
+#define SUPERVISOR_BACKOFF_MAX 30000
+#define SUPERVISOR_STABLE_TIME 60000
+
+class Supervisor
+{
+public:
+	typedef std::function<bool()> Probe;	//true while the component works
+	typedef std::function<bool()> Restart;	//true if it came back
+
+	Supervisor();
+
+	//watch a component, stall_ms = 0 means it needs no heartbeats
+	int watch(const char *name, Probe alive, Restart restart, unsigned long stall_ms = 0);
+
+	//the component made progress
+	void beat(int id);
+
+	//the user of a component saw it fail
+	void fail(int id, const char *reason);
+
+	//true if the component is up, restarts it if it is down and its
+	//backoff has passed
+	bool check(int id);
+
+	//check until the component is up, sleeping through the backoff;
+	//timeout_ms = 0 waits forever
+	bool await(int id, unsigned long timeout_ms);
+
+	unsigned int restarts(int id) const;
+	void report(FILE *out) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Component
+	{
+		std::string name;
+		Probe alive;
+		Restart restart;
+		unsigned long stall_ms;
+		Clock::time_point last_beat;
+		Clock::time_point last_restart;
+		Clock::time_point next_attempt;	//backoff: no restart before this
+		unsigned int backoff_level;
+		bool failed;
+		bool restarting;
+		std::string reason;
+		unsigned int restarts;
+		unsigned int failed_restarts;
+	};
+
+	std::vector<Component> components_;
+	mutable std::mutex mutex_;
+};
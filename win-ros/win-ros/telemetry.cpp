@@ -0,0 +1,207 @@
+/********************************************************
+* @file    : telemetry.cpp
+* @brief   : where the time of a campaign goes, pose by pose
+*********************************************************/
+#include "stdafx.h"
+#include "telemetry.h"
+
+#include <algorithm>
+
+static const char *phase_names[PHASE_COUNT] = { "publish", "motion", "capture", "queue", "reconstruct", "save" };
+
+Telemetry::Telemetry()
+	: start_(std::chrono::steady_clock::now()), scale_(1), json_(false), file_(NULL), stop_(false)
+{
+}
+
+Telemetry::~Telemetry()
+{
+	close();
+}
+
+/********************************************************
+*  @function :  open
+*  @brief    :  start the clock and the writer; a .jsonl path gets JSON
+*               lines, anything else CSV with a header line
+*  @input    :  path
+*  @return   :  true if the file can be written
+*********************************************************/
+bool Telemetry::open(const char *path)
+{
+	close();
+	start_ = std::chrono::steady_clock::now();
+	std::string name = path;
+	json_ = name.size() >= 6 && name.compare(name.size() - 6, 6, ".jsonl") == 0;
+	file_ = fopen(path, "ab");
+	if (file_ == NULL)
+		return false;
+
+	fseek(file_, 0, SEEK_END);
+	if (!json_ && ftell(file_) == 0)
+	{
+		fprintf(file_, "index,line,start_ms");
+		for (int p = 0; p < PHASE_COUNT; p++)
+			fprintf(file_, ",%s_ms", phase_names[p]);
+		fprintf(file_, ",total_ms,outcome\n");
+	}
+	stop_ = false;
+	writer_ = std::thread(&Telemetry::writeLoop, this);
+	return true;
+}
+
+void Telemetry::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+		queued_.notify_one();
+	}
+	if (writer_.joinable())
+		writer_.join();
+	if (file_)
+		fclose(file_);
+	file_ = NULL;
+}
+
+double Telemetry::now() const
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count() * scale_;
+}
+
+void Telemetry::begin(size_t index, uint32_t line)
+{
+	Record record;
+	record.index = index;
+	record.line = line;
+	record.start = now();
+	for (int p = 0; p < PHASE_COUNT; p++)
+		record.phase[p] = -1;
+	record.total = 0;
+	std::lock_guard<std::mutex> lock(mutex_);
+	open_[index] = record;
+}
+
+void Telemetry::add(size_t index, TelemetryPhase phase, double ms)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<size_t, Record>::iterator it = open_.find(index);
+	if (it == open_.end())
+		return;
+	double &time = it->second.phase[phase];
+	time = (time < 0 ? 0 : time) + ms;
+}
+
+void Telemetry::end(size_t index, const char *outcome)
+{
+	double end_time = now();
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::map<size_t, Record>::iterator it = open_.find(index);
+	if (it == open_.end())
+		return;
+	Record record = it->second;
+	open_.erase(it);
+	record.total = end_time - record.start;
+	record.outcome = outcome;
+	done_.push_back(record);
+	if (file_)
+	{
+		pending_.push_back(format(record));
+		queued_.notify_one();
+	}
+}
+
+std::string Telemetry::format(const Record &record) const
+{
+	char text[512];
+	int n;
+	if (json_)
+	{
+		n = sprintf(text, "{\"index\":%u,\"line\":%u,\"start_ms\":%.1f",
+			(unsigned int)record.index, record.line, record.start);
+		for (int p = 0; p < PHASE_COUNT; p++)
+		{
+			if (record.phase[p] >= 0)
+				n += sprintf(text + n, ",\"%s_ms\":%.1f", phase_names[p], record.phase[p]);
+		}
+		sprintf(text + n, ",\"total_ms\":%.1f,\"outcome\":\"%s\"}\n", record.total, record.outcome.c_str());
+	}
+	else
+	{
+		n = sprintf(text, "%u,%u,%.1f", (unsigned int)record.index, record.line, record.start);
+		for (int p = 0; p < PHASE_COUNT; p++)
+		{
+			if (record.phase[p] >= 0)
+				n += sprintf(text + n, ",%.1f", record.phase[p]);
+			else
+				n += sprintf(text + n, ",");
+		}
+		sprintf(text + n, ",%.1f,%s\n", record.total, record.outcome.c_str());
+	}
+	return text;
+}
+
+void Telemetry::writeLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		queued_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+		if (pending_.empty())
+			break;	//stopped and drained
+
+		std::deque<std::string> batch;
+		batch.swap(pending_);
+		lock.unlock();
+		for (size_t i = 0; i < batch.size(); i++)
+			fwrite(batch[i].data(), 1, batch[i].size(), file_);
+		fflush(file_);
+		lock.lock();
+	}
+}
+
+//nearest rank
+static double percentile(const std::vector<double> &sorted, double p)
+{
+	size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.999999);
+	rank = std::max((size_t)1, std::min(rank, sorted.size()));
+	return sorted[rank - 1];
+}
+
+/********************************************************
+*  @function :  summary
+*  @brief    :  per phase and for the whole cycle: count, mean, p50,
+*               p90, p99 and max of the finished poses
+*  @input    :  out
+*  @return   :  null
+*********************************************************/
+void Telemetry::summary(FILE *out) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t ok = 0;
+	for (size_t i = 0; i < done_.size(); i++)
+		ok += done_[i].outcome == "ok" ? 1 : 0;
+	fprintf(out, "telemetry: %u poses, %u ok\n", (unsigned int)done_.size(), (unsigned int)ok);
+	fprintf(out, "  %-12s %6s %9s %9s %9s %9s %9s  ms\n", "phase", "n", "mean", "p50", "p90", "p99", "max");
+	for (int p = 0; p <= PHASE_COUNT; p++)
+	{
+		std::vector<double> times;
+		for (size_t i = 0; i < done_.size(); i++)
+		{
+			double t = p < PHASE_COUNT ? done_[i].phase[p] : done_[i].total;
+			if (t >= 0)
+				times.push_back(t);
+		}
+		const char *name = p < PHASE_COUNT ? phase_names[p] : "cycle";
+		if (times.empty())
+		{
+			fprintf(out, "  %-12s %6u\n", name, 0u);
+			continue;
+		}
+		std::sort(times.begin(), times.end());
+		double sum = 0;
+		for (size_t i = 0; i < times.size(); i++)
+			sum += times[i];
+		fprintf(out, "  %-12s %6u %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, (unsigned int)times.size(),
+			sum / times.size(), percentile(times, 50), percentile(times, 90), percentile(times, 99), times.back());
+	}
+}
@@ -0,0 +1,113 @@
+/********************************************************
+* @file    : telemetry.h
+* @brief   : where the time of a campaign goes, pose by pose
+* @details : Each pose gets one record: when it started, how long each
+*            phase took and how it ended. Phases a pose never reached are
+*            left out. Times come from a monotonic clock, in milliseconds
+*            since the telemetry was opened. Finished records are written
+*            by a writer thread, as CSV or, for a .jsonl file, as one JSON
+*            object per line, so recording never waits for the disk.
+*            summary() prints mean and percentiles per phase.
+*            All calls are thread safe, the stages of a pipelined
+*            campaign record their phases of the same pose.
+*********************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum TelemetryPhase
+{
+	PHASE_PUBLISH,		//reach the link and send the goal
+	PHASE_MOTION,		//wait for the plan and its execution
+	PHASE_CAPTURE,		//take the frame
+	PHASE_QUEUE,		//wait for the reconstruction of earlier frames
+	PHASE_RECONSTRUCT,	//build the mesh
+	PHASE_SAVE,			//write and file the mesh
+	PHASE_COUNT
+};
+
+class Telemetry
+{
+public:
+	Telemetry();
+	~Telemetry();
+
+	//records go to path from now on, appended if it exists
+	bool open(const char *path);
+	void close();
+
+	//milliseconds since open()
+	double now() const;
+
+	//a simulated campaign runs faster than real time, report its time
+	void setScale(double scale) { scale_ = scale; }
+
+	void begin(size_t index, uint32_t line);
+	void add(size_t index, TelemetryPhase phase, double ms);
+	void end(size_t index, const char *outcome);
+
+	void summary(FILE *out) const;
+
+private:
+	struct Record
+	{
+		size_t index;
+		uint32_t line;
+		double start;
+		double phase[PHASE_COUNT];	//negative if not reached
+		double total;
+		std::string outcome;
+	};
+
+	std::string format(const Record &record) const;
+	void writeLoop();
+
+	std::chrono::steady_clock::time_point start_;
+	double scale_;
+	bool json_;
+	FILE *file_;
+	std::map<size_t, Record> open_;	//begun, not ended yet
+	std::vector<Record> done_;
+	std::deque<std::string> pending_;
+	std::thread writer_;
+	mutable std::mutex mutex_;
+	std::condition_variable queued_;
+	bool stop_;
+};
+
+/********************************************************
+*  @class    :  PhaseTimer
+*  @brief    :  adds the time until it goes out of scope, or until
+*               stop(), to a phase
+*********************************************************/
+class PhaseTimer
+{
+public:
+	PhaseTimer(Telemetry &telemetry, size_t index, TelemetryPhase phase)
+		: telemetry_(telemetry), index_(index), phase_(phase), start_(telemetry.now()), running_(true) {}
+	~PhaseTimer() { stop(); }
+
+	//add the time so far, the phase ends here
+	void stop()
+	{
+		if (running_)
+			telemetry_.add(index_, phase_, telemetry_.now() - start_);
+		running_ = false;
+	}
+
+private:
+	Telemetry &telemetry_;
+	size_t index_;
+	TelemetryPhase phase_;
+	double start_;
+	bool running_;
+};